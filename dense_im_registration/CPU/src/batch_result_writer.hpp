@@ -0,0 +1,139 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _BATCH_RESULT_WRITER_HPP
+#define _BATCH_RESULT_WRITER_HPP
+
+#include <stdint.h>
+#include <cstdio>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "errCodes.h"
+
+/*
+* Compact fixed-size binary record storing the outcome of one registration job.
+* The output file is made of a BatchResultFileHeader followed by the records,
+* in completion order (use 'm_job_ind' to match them with the manifest).
+*/
+struct BatchResultRecord
+{
+    uint32_t m_job_ind;
+    int32_t  m_err_code;
+    float    m_reg_pts[8];
+    float    m_solve_time_us;
+};
+
+struct BatchResultFileHeader
+{
+    char     m_magic[4];    // "DIRB"
+    uint32_t m_version;
+    uint32_t m_record_size; // sizeof(BatchResultRecord)
+    uint32_t m_reserved;
+};
+
+/*
+* Asynchronous result writer: worker threads push records, a dedicated thread
+* flushes them to disk in batches so that file IO never stalls a solver.
+*/
+struct BatchResultWriter
+{
+public:
+    BatchResultWriter() {}
+    ~BatchResultWriter() { close(); }
+public:
+    /*
+    * open the output file and start the writer thread
+    */
+    Common::ErrCode
+    open(
+            const std::string & i_filename)
+    {
+        m_file = std::fopen(i_filename.c_str(), "wb");
+        if (m_file == NULL) {
+            return Common::IOCantOpenFile;
+        }
+        const BatchResultFileHeader header = {
+                {'D', 'I', 'R', 'B'}, 1, sizeof(BatchResultRecord), 0};
+        std::fwrite(&header, sizeof(header), 1, m_file);
+        m_stop = false;
+        m_thread = std::thread(&BatchResultWriter::write_loop, this);
+        return Common::NoError;
+    }
+
+    /*
+    * queue a record for writing (thread safe, non blocking on IO)
+    */
+    void
+    push(
+            const BatchResultRecord & i_record)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_pending.push_back(i_record);
+        }
+        m_cond.notify_one();
+    }
+
+    /*
+    * flush the pending records, stop the writer thread and close the file
+    */
+    void
+    close()
+    {
+        if (m_file == NULL) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_one();
+        m_thread.join();
+        std::fclose(m_file);
+        m_file = NULL;
+    }
+private:
+    void
+    write_loop()
+    {
+        std::vector<BatchResultRecord> to_write;
+        for (;;) {
+            bool stop = false;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this]{ return m_stop || !m_pending.empty(); });
+                to_write.swap(m_pending);
+                stop = m_stop;
+            }
+            if (!to_write.empty()) {
+                std::fwrite(&(to_write[0]), sizeof(BatchResultRecord),
+                        to_write.size(), m_file);
+                to_write.clear();
+            }
+            if (stop) {
+                return;
+            }
+        }
+    }
+private:
+    std::FILE *                    m_file = NULL;
+    bool                           m_stop = false;
+    std::thread                    m_thread;
+    std::mutex                     m_mutex;
+    std::condition_variable        m_cond;
+    std::vector<BatchResultRecord> m_pending;
+private:
+    // non-copyable
+    BatchResultWriter(BatchResultWriter const &);
+    BatchResultWriter & operator = (BatchResultWriter const &);
+};
+
+#endif /* _BATCH_RESULT_WRITER_HPP *  * */
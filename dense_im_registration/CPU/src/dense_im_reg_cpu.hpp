@@ -1,4 +1,3 @@
-
 /*
 * Authors:
 * Nicolas Stoiber (nicolas.stoi@gmail.com)
@@ -9,45 +8,49 @@
 #ifndef _DENSE_IM_REG_CPU_HPP
 #define _DENSE_IM_REG_CPU_HPP
 
-// ************************** EIGEN SPECIFIC DEFS *****************************
-// setting the flag below could help see if there are hidden allocations.
-//#define EIGEN_NO_AUTOMATIC_RESIZING
-//#define EIGEN_RUNTIME_NO_MALLOC
-#ifdef EIGEN_RUNTIME_NO_MALLOC
-#define malloc_allowed(v) Eigen::internal::set_is_malloc_allowed(v)
-#else
-#define malloc_allowed(v)
-#endif
-
-#define EIGEN_DEFAULT_TO_ROW_MAJOR // comment out this line to use ColMajor
-// ****************************************************************************
-
-#undef Success //(X11 and Eigen both define the Success macro)
-
-// match our own structure orders with Eigen internal's
-#ifdef EIGEN_DEFAULT_TO_ROW_MAJOR
-    #define MY_STORAGE_ORDER Eigen::RowMajor
-#else
-    #define MY_STORAGE_ORDER Eigen::ColMajor
-#endif
-
-#include <Eigen/Dense>
-
+#include <memory>
 #include <vector>
 
-#include <CImg.h>
-
-#include "errCodes.h"
-
-#include "im_processing_utils.hpp"
-#include "optimization_utils.hpp"
+#include "dense_im_reg_cpu_common.hpp"
+#include "dense_im_reg_cpu_config.hpp"
+#include "dense_im_reg_cpu_model.hpp"
+#include "dense_im_reg_cpu_workspace.hpp"
 
 
+/*
+* Single stream registration solver: one template model
+* (dense_im_reg_cpu_model.hpp) and one workspace
+* (dense_im_reg_cpu_workspace.hpp).
+* To track the same template in several streams/threads, share 'model()'
+* between as many DenseImageRegistrationWorkspace as needed instead of
+* creating several solvers. The model is copied on write: setting or
+* refreshing the template of this solver never modifies a model already
+* shared with other workspaces.
+*/
 template <typename FloatPrec>
 struct DenseImageRegistrationSolver
 {
 public:
     EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+public: // public typedefs
+    typedef DenseImageRegistrationModel<FloatPrec>     Model;
+    typedef DenseImageRegistrationWorkspace<FloatPrec> Workspace;
+    typedef typename Workspace::UpdateMode             UpdateMode;
+    typedef typename Workspace::CoarseSearchParams     CoarseSearchParams;
+    static const UpdateMode GaussNewtonUpdate = Workspace::GaussNewtonUpdate;
+    static const UpdateMode ESMUpdate = Workspace::ESMUpdate;
+    typedef typename Workspace::RegistrationStatus     RegistrationStatus;
+    static const RegistrationStatus RegConverged = Workspace::RegConverged;
+    static const RegistrationStatus RegIterationsDone = Workspace::RegIterationsDone;
+    static const RegistrationStatus RegDeadlineReached = Workspace::RegDeadlineReached;
+    typedef DenseImageRegistrationTypes<FloatPrec> Types;
+    typedef typename Types::MatrixNN MatrixNN;
+    typedef typename Types::MatrixN2 MatrixN2;
+    typedef typename Types::MatrixN4 MatrixN4;
+    typedef typename Types::MatrixN6 MatrixN6;
+    typedef typename Types::VecN     VecN;
+    typedef typename Types::Vec6     Vec6;
+    typedef typename Types::Matrix42 Matrix42;
 public:
     DenseImageRegistrationSolver() {}
     ~DenseImageRegistrationSolver() {}
@@ -63,10 +66,23 @@ public:
             const uint32_t  nb_levels,
             const FloatPrec lvl_resz_ratio);
 
+    /*
+    * same as above, from a solver configuration (see dense_im_reg_cpu_config.hpp),
+    * which also sets the registration settings (roi mode, update mode,
+    * convergence threshold, threads). The iteration cap of the configuration
+    * is left to the caller of 'register_image'.
+    */
+    Common::ErrCode
+    init(
+            const DenseImageRegistrationConfig<FloatPrec> & i_config);
+
     /*
     * record the template to be registered in images
     * i_normz_factor is a normalization factor to map image values to a favorable
     * floating point range (typically [0., 1.]
+    * Only the bounding box of the annotated quad is converted and downsampled
+    * (successively, level by level) to build the reference pyramid, in which
+    * the level template grids are then sampled.
     */
     Common::ErrCode
     set_template(
@@ -74,15 +90,155 @@ public:
             std::vector<FloatPrec> &                  i_annot_pts,
             FloatPrec                                 i_normz_factor = 1./255.);
 
+    /*
+    * same as above, on a single channel 8-bit image view
+    */
+    Common::ErrCode
+    set_template(
+            const Common::ImView<unsigned char> &     i_ref_image,
+            const std::vector<FloatPrec> &            i_annot_pts,
+            FloatPrec                                 i_normz_factor = 1./255.);
+
+    /*
+    * replace the template by the content of the last registered image, inside
+    * the quad found by the last call to 'register_image' (e.g. to follow slow
+    * appearance changes of a tracked target). The registration pyramid of that
+    * image is reused as is: only the level template grids (and their
+    * gradients) are resampled, the rest of the solver state is untouched.
+    * Returns NoRegisteredImage if the last registration lost the track (see
+    * 'set_tracking_loss_check').
+    */
+    Common::ErrCode
+    refresh_template();
+
     /*
     * register the recorded template (set with 'set_template' in the input
     * image.
     */
-    Common::ErrCode
+    inline Common::ErrCode
     register_image(
             const cimg_library::CImg<unsigned char> & i_reg_image,
             uint32_t                                  i_nb_iterations,
-            std::vector<FloatPrec> &                  io_reg_pts);
+            std::vector<FloatPrec> &                  io_reg_pts) {
+        return m_workspace.register_image(i_reg_image, i_nb_iterations, io_reg_pts);
+    }
+
+    /*
+    * same as above, on a single channel 8-bit image view (e.g. a frame of a
+    * memory-mapped raw frame file, see raw_frame_container.hpp), without any
+    * copy of the input image.
+    */
+    inline Common::ErrCode
+    register_image(
+            const Common::ImView<unsigned char> &     i_reg_image,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts) {
+        return m_workspace.register_image(i_reg_image, i_nb_iterations, io_reg_pts);
+    }
+
+    /*
+    * same as above, on an RGB image view (planar or interleaved), converted
+    * to luma while building the registration pyramid
+    */
+    inline Common::ErrCode
+    register_image(
+            const Common::RgbImView &                 i_reg_image,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts) {
+        return m_workspace.register_image(i_reg_image, i_nb_iterations, io_reg_pts);
+    }
+
+    /*
+    * deadline-bounded registration, see dense_im_reg_cpu_workspace.hpp
+    */
+    inline Common::ErrCode
+    register_image_within(
+            const cimg_library::CImg<unsigned char> & i_reg_image,
+            double                                    i_time_budget_us,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts,
+            RegistrationStatus &                      o_status) {
+        return m_workspace.register_image_within(i_reg_image, i_time_budget_us,
+                i_nb_iterations, io_reg_pts, o_status);
+    }
+    inline Common::ErrCode
+    register_image_within(
+            const Common::ImView<unsigned char> &     i_reg_image,
+            double                                    i_time_budget_us,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts,
+            RegistrationStatus &                      o_status) {
+        return m_workspace.register_image_within(i_reg_image, i_time_budget_us,
+                i_nb_iterations, io_reg_pts, o_status);
+    }
+    inline Common::ErrCode
+    register_image_within(
+            const Common::RgbImView &                 i_reg_image,
+            double                                    i_time_budget_us,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts,
+            RegistrationStatus &                      o_status) {
+        return m_workspace.register_image_within(i_reg_image, i_time_budget_us,
+                i_nb_iterations, io_reg_pts, o_status);
+    }
+
+    /*
+    * registration settings and statistics, see dense_im_reg_cpu_workspace.hpp
+    */
+    inline void set_roi_mode(bool i_enable, FloatPrec i_motion_margin = 32.) {
+        m_workspace.set_roi_mode(i_enable, i_motion_margin);
+    }
+    inline const Common::ImRoi & last_reg_roi() const {
+        return m_workspace.last_reg_roi();
+    }
+    inline uint32_t last_nb_roi_grows() const {
+        return m_workspace.last_nb_roi_grows();
+    }
+    inline void set_update_mode(UpdateMode i_update_mode) {
+        m_workspace.set_update_mode(i_update_mode);
+    }
+    inline void set_convergence_threshold(FloatPrec i_threshold) {
+        m_workspace.set_convergence_threshold(i_threshold);
+    }
+    inline void set_coarse_search(const CoarseSearchParams & i_params) {
+        m_workspace.set_coarse_search(i_params);
+    }
+    inline void set_nb_threads(uint32_t i_nb_threads) {
+        m_workspace.set_nb_threads(i_nb_threads);
+    }
+    inline void set_jacobian_reuse(bool i_enable, FloatPrec i_max_dist = 1.) {
+        m_workspace.set_jacobian_reuse(i_enable, i_max_dist);
+    }
+    inline uint32_t nb_jacobian_computations() const {
+        return m_workspace.nb_jacobian_computations();
+    }
+    inline uint32_t nb_jacobian_reuses() const {
+        return m_workspace.nb_jacobian_reuses();
+    }
+    inline uint32_t nb_rejected_steps() const {
+        return m_workspace.nb_rejected_steps();
+    }
+    inline void reset_jacobian_reuse_stats() {
+        m_workspace.reset_jacobian_reuse_stats();
+    }
+    inline void set_tracking_loss_check(
+            bool      i_enable,
+            FloatPrec i_min_ncc = 0.5,
+            uint32_t  i_nb_coarse_iterations = 3) {
+        m_workspace.set_tracking_loss_check(i_enable, i_min_ncc, i_nb_coarse_iterations);
+    }
+    inline FloatPrec last_confidence() const {
+        return m_workspace.last_confidence();
+    }
+    inline uint32_t last_nb_iterations() const {
+        return m_workspace.last_nb_iterations();
+    }
+    inline uint32_t last_finest_level() const {
+        return m_workspace.last_finest_level();
+    }
+    inline FloatPrec last_cost() const {
+        return m_workspace.last_cost();
+    }
 
     /*
     * get the level templates as images (mainly for debug purposes)
@@ -94,59 +250,17 @@ public:
     /*
     * get nb levels
     */
-    inline uint32_t nb_levels() const {return m_nb_levels;}
+    inline uint32_t nb_levels() const {return m_model ? m_model->nb_levels() : 0;}
+
+    /*
+    * template model of the solver (null before 'init'), to be shared with
+    * other workspaces
+    */
+    inline std::shared_ptr<const Model> model() const {return m_model;}
 
-public: // public typedefs
-    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, Eigen::Dynamic, MY_STORAGE_ORDER>
-            MatrixNN;
-    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, 2, MY_STORAGE_ORDER>
-            MatrixN2;
-    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, 4, MY_STORAGE_ORDER>
-            MatrixN4;
-    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, 6, MY_STORAGE_ORDER>
-            MatrixN6;
-    typedef Eigen::Matrix<FloatPrec, 1, Eigen::Dynamic, MY_STORAGE_ORDER>
-            VecN;
-    typedef Eigen::Matrix<FloatPrec, 1, 6, MY_STORAGE_ORDER>
-            Vec6;
-    typedef Eigen::Matrix<FloatPrec, 4, 2, MY_STORAGE_ORDER>
-            Matrix42;
-private: // private typedefs
-    typedef Common::ImDim<uint32_t>                         ImDim;
-    typedef std::vector<ImDim>                              LvlList_ImDim;
-    typedef std::vector<FloatPrec>                          LvlList_Ratio;
-    typedef std::vector<VecN>                               LvlList_VecN;
-    typedef std::vector<std::vector<FloatPrec> >            LvlList_StdN4;
-    typedef std::vector<MatrixN4>                           LvlList_MatN4;
-    typedef std::vector<MatrixN2>                           LvlList_MatN2;
-    typedef std::vector<cimg_library::CImg<unsigned char> > LvlList_Images;
-    typedef std::vector<MatrixNN>                           LvlList_MatNN;
-// public:
 private:
-    bool           m_is_init = false;
-    bool           m_template_is_set = false;
-    uint32_t       m_nb_levels = 3;
-    FloatPrec      m_lvl_resz_ratio = 0.5;
-    FloatPrec      m_normz_factor = 1./255.;
-    ImDim          m_ref_imdim;
-    LvlList_Ratio  m_lvl_abs_resz_ratio;
-    LvlList_ImDim  m_lvl_templdims;
-    LvlList_VecN   m_lvl_templates;
-    LvlList_StdN4  m_lvl_Ws;
-    LvlList_MatN4  m_lvl_Ws_eigen;
-    LvlList_MatN2  m_lvl_gridpts_eigen;
-    LvlList_Images m_reg_im_pyr; // registration image resolution pyramid
-    // solver containers
-    VecN           m_delta_vars;
-    LvlList_VecN   m_lvl_errs;
-    LvlList_MatNN  m_lvl_jacos;
-    LvlList_MatNN  m_lvl_jTj;
-    LvlList_VecN   m_lvl_jTb;
-    VecN           m_mr_errs; // mr: multi resolution
-    MatrixNN       m_mr_jaco;
-    MatrixNN       m_mr_jTj;
-    VecN           m_mr_jTb;
-    VecN           m_curr_pts;
+    std::shared_ptr<Model> m_model;
+    Workspace              m_workspace;
 private:
     // The following makes the copy contructor and the assignment operator
     // private to emulate a "non-copyable" class.
@@ -154,47 +268,13 @@ private:
     DenseImageRegistrationSolver & operator = (DenseImageRegistrationSolver const &);
 private:
     /*
-    * compute multi-resolution pixel error vector for a given configuration of
-    * points
-    */
-    void
-    compute_multires_pix_error(
-            const VecN & i_pts,
-            VecN &       o_mr_pix_err);
-
-    /*
-    * compute pixel error vector for a given configuration of
-    * points for a given resoltion level
+    * get a model that can be modified without affecting other workspaces:
+    * the current one if it is not shared, a copy of it otherwise.
     */
-    void
-    compute_lvl_pix_error(
-            const VecN & i_pts,
-            uint32_t     i_lvl,
-            VecN &       o_lvl_pix_err);
-
-    /*
-    * compute multi-resolution pixel jacobian matrix for a given configuration of
-    * points
-    */
-    void
-    compute_multires_pix_jacobian(
-            const VecN & i_pts,
-            MatrixNN &   o_mr_pix_err);
-
-    /*
-    * compute pixel jacobian matrix for a given configuration of
-    * points for a given resoltion level
-    */
-    void
-    compute_lvl_pix_jacobian(
-            const VecN & i_pts,
-            uint32_t     i_lvl,
-            MatrixNN &   o_mr_pix_err);
+    std::shared_ptr<Model>
+    writable_model() const;
 };
 
 #include "dense_im_reg_cpu.inl.hpp"
 
 #endif // #ifndef _DENSE_IM_REG_CPU_HPP
-
-
-
@@ -0,0 +1,420 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Solver configuration auto-tuner: given a latency budget per registration
+* and a sample workload (a reference image moved by random affine motions,
+* with exact ground truth), search the pyramid levels, level ratio, template
+* size, iteration cap, update kernel (Gauss-Newton / ESM) and thread count,
+* and emit the most accurate configuration whose registration latency fits
+* the budget on this machine, as a solver configuration file (see
+* dense_im_reg_cpu_config.hpp).
+*/
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "raw_frame_container.hpp"
+#include "synthetic_workload.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+
+#define FLOATPREC float
+
+typedef DenseImageRegistrationSolver<FLOATPREC> Solver;
+typedef DenseImageRegistrationConfig<FLOATPREC> SolverConfig;
+
+struct AutotuneSettings
+{
+    double    m_budget_us = 10000.;
+    double    m_latency_quantile = 0.9; // latency checked against the budget
+    FLOATPREC m_success_threshold = 1.; // max mean corner error, in pixels
+    uint32_t  m_nb_samples = 10;
+    uint32_t  m_max_nb_threads = 0;     // 0: all hardware threads
+    uint32_t  m_seed = 0;
+    Common::SyntheticMotion<FLOATPREC> m_motion;
+};
+
+/*
+* Outcome of one configuration on the sample workload
+*/
+struct AutotuneResult
+{
+    SolverConfig m_config;
+    double       m_success_rate = 0.;
+    double       m_mean_corner_err = 0.;
+    double       m_mean_latency_us = 0.;
+    double       m_quantile_latency_us = 0.;
+};
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./autotune_dense_im_reg_cpu "
+        "--budget-us us "
+        "[--ref-image image.(raw|png|...) --annot annot_info] "
+        "[--samples N] [--translation px] [--rotation rad] [--scale ratio] [--seed N] "
+        "[--quantile q] [--max-threads N] [--output solver.cfg] [--csv results.csv]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* Register all the samples with one configuration
+*/
+Common::ErrCode
+evaluate_config(
+        const SolverConfig &                                          i_config,
+        const AutotuneSettings &                                      i_settings,
+        const cimg_library::CImg<unsigned char> &                     i_ref_image,
+        const std::vector<FLOATPREC> &                                i_annot_pts,
+        const std::vector<Common::SyntheticRegistrationSample<FLOATPREC> > & i_samples,
+        AutotuneResult &                                              o_result)
+{
+    o_result = AutotuneResult();
+    o_result.m_config = i_config;
+    Solver solver;
+    Common::ErrCode errCode = solver.init(i_config);
+    if (errCode != Common::NoError) { return errCode; }
+    errCode = solver.set_template(Common::im_view_from_cimg(i_ref_image), i_annot_pts);
+    if (errCode != Common::NoError) { return errCode; }
+
+    std::vector<double> latencies_us(i_samples.size());
+    uint32_t nb_success = 0;
+    for (uint32_t i_s = 0; i_s<i_samples.size(); ++i_s) {
+        std::vector<FLOATPREC> reg_pts(i_samples[i_s].m_init_pts);
+        Common::Timer reg_timer;
+        errCode = solver.register_image(
+                i_samples[i_s].m_reg_image, i_config.m_nb_iterations, reg_pts);
+        latencies_us[i_s] = reg_timer.elapsed_us();
+        if (errCode != Common::NoError) { return errCode; }
+
+        const FLOATPREC corner_err = Common::mean_corner_error(
+                reg_pts, i_samples[i_s].m_gt_pts);
+        o_result.m_mean_corner_err += corner_err;
+        o_result.m_mean_latency_us += latencies_us[i_s];
+        if (corner_err < i_settings.m_success_threshold) {
+            nb_success++;
+        }
+    }
+    const double inv_nb_samples = 1. / std::max((size_t)1, i_samples.size());
+    o_result.m_success_rate = nb_success * inv_nb_samples;
+    o_result.m_mean_corner_err *= inv_nb_samples;
+    o_result.m_mean_latency_us *= inv_nb_samples;
+    std::sort(latencies_us.begin(), latencies_us.end());
+    const uint32_t q_ind = std::min((uint32_t)latencies_us.size() - 1,
+            (uint32_t)std::floor(i_settings.m_latency_quantile * latencies_us.size()));
+    o_result.m_quantile_latency_us = latencies_us[q_ind];
+    return Common::NoError;
+}
+
+/*
+* accuracy order: success rate first, then mean corner error
+*/
+bool
+is_more_accurate(
+        const AutotuneResult & i_a,
+        const AutotuneResult & i_b)
+{
+    if (i_a.m_success_rate != i_b.m_success_rate) {
+        return i_a.m_success_rate > i_b.m_success_rate;
+    }
+    return i_a.m_mean_corner_err < i_b.m_mean_corner_err;
+}
+
+std::string
+config_description(
+        const AutotuneResult & i_result)
+{
+    const SolverConfig & config = i_result.m_config;
+    std::ostringstream oss;
+    oss << "levels: " << config.m_nb_levels
+        << " | ratio: " << config.m_lvl_resz_ratio
+        << " | template: " << config.m_template_width << "x" << config.m_template_height
+        << " | update: " << (config.m_esm_update ? "ESM" : "Gauss-Newton")
+        << " | iterations: " << config.m_nb_iterations
+        << " | threads: " << config.m_nb_threads
+        << " | success: " << 100. * i_result.m_success_rate << " %"
+        << " | corner error: " << i_result.m_mean_corner_err << " px"
+        << " | latency: " << i_result.m_mean_latency_us << " us (mean), "
+        << i_result.m_quantile_latency_us << " us (quantile)";
+    return oss.str();
+}
+
+void
+write_csv_line(
+        std::ofstream &        io_csv,
+        const AutotuneResult & i_result,
+        bool                   i_fits_budget)
+{
+    const SolverConfig & config = i_result.m_config;
+    io_csv << config.m_nb_levels << "," << config.m_lvl_resz_ratio << ","
+        << config.m_template_width << "," << config.m_template_height << ","
+        << (config.m_esm_update ? "esm" : "gauss_newton") << ","
+        << config.m_nb_iterations << "," << config.m_nb_threads << ","
+        << i_result.m_success_rate << "," << i_result.m_mean_corner_err << ","
+        << i_result.m_mean_latency_us << "," << i_result.m_quantile_latency_us << ","
+        << (i_fits_budget ? 1 : 0) << "\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration solver auto-tuning (CPU) ..." << "\n" ;
+
+    // parse input arguments
+    AutotuneSettings settings;
+    std::string ref_im_path;
+    std::string annot_info_path;
+    std::string output_path("dense_im_reg_cpu_tuned.cfg");
+    std::string csv_path;
+    bool has_budget = false;
+    for (int arg_ind = 1; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--budget-us") && has_value) {
+            settings.m_budget_us = Common::str2val<double>(argv[++arg_ind]);
+            has_budget = true;
+        } else if ((opt == "--ref-image") && has_value) {
+            ref_im_path = argv[++arg_ind];
+        } else if ((opt == "--annot") && has_value) {
+            annot_info_path = argv[++arg_ind];
+        } else if ((opt == "--samples") && has_value) {
+            settings.m_nb_samples = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--translation") && has_value) {
+            settings.m_motion.m_max_translation = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--rotation") && has_value) {
+            settings.m_motion.m_max_rotation = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--scale") && has_value) {
+            settings.m_motion.m_max_scale_change = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--seed") && has_value) {
+            settings.m_seed = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--quantile") && has_value) {
+            settings.m_latency_quantile = Common::str2val<double>(argv[++arg_ind]);
+        } else if ((opt == "--max-threads") && has_value) {
+            settings.m_max_nb_threads = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--output") && has_value) {
+            output_path = argv[++arg_ind];
+        } else if ((opt == "--csv") && has_value) {
+            csv_path = argv[++arg_ind];
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+    if (!has_budget || (ref_im_path.empty() != annot_info_path.empty())
+            || (settings.m_nb_samples == 0)) {
+        print_usage();
+        exit(-1);
+    }
+    if (settings.m_max_nb_threads == 0) {
+        settings.m_max_nb_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // sample workload: the reference image (or a synthetic texture) moved by
+    // random affine motions
+    Common::ErrCode curr_errCode = Common::NoError;
+    cimg_library::CImg<unsigned char> ref_im;
+    std::vector<FLOATPREC> annot_pts;
+    if (ref_im_path.empty()) {
+        const uint32_t im_width = 640;
+        const uint32_t im_height = 480;
+        Common::generate_synthetic_texture(im_width, im_height, settings.m_seed, ref_im);
+        const FLOATPREC cx = 0.5 * im_width;
+        const FLOATPREC cy = 0.5 * im_height;
+        const FLOATPREC half_w = 0.25 * im_width;
+        const FLOATPREC half_h = 0.3 * im_height;
+        const FLOATPREC annot_pts_arr[] = {
+                cx - half_w, cy - half_h, cx + half_w, cy - half_h,
+                cx + half_w, cy + half_h, cx - half_w, cy + half_h};
+        annot_pts.assign(annot_pts_arr, annot_pts_arr + 8);
+    } else {
+        const bool ref_is_raw = (ref_im_path.size() > 4)
+                && (ref_im_path.compare(ref_im_path.size() - 4, 4, ".raw") == 0);
+        if (ref_is_raw) {
+            Common::RawFrameReader ref_frames;
+            curr_errCode = ref_frames.open(ref_im_path);
+            if ((curr_errCode != Common::NoError) || (ref_frames.nb_frames() == 0)
+                    || (ref_frames.format() != Common::RawFrameGray8)) {
+                std::cerr << "Error: " << ref_im_path << " must be a grayscale raw frame file.\n";
+                exit(-1);
+            }
+            const Common::ImView<uint8_t> frame = ref_frames.frame_view(0);
+            ref_im.assign(frame.width(), frame.height(), 1, 1);
+            for (uint32_t i_y = 0; i_y<frame.height(); ++i_y) {
+                std::copy(frame.row(i_y), frame.row(i_y) + frame.width(),
+                        ref_im.data() + (size_t)i_y * frame.width());
+            }
+        } else {
+            cimg_library::CImg<unsigned char> ref_im_asis;
+            try {
+                ref_im_asis.assign(ref_im_path.c_str());
+            } catch (...) {
+                std::cerr << "Error: can't read " << ref_im_path << ".\n";
+                exit(-1);
+            }
+            curr_errCode = Common::convert_to_gray(ref_im_asis, ref_im);
+            if (curr_errCode != Common::NoError) {
+                std::cerr << "Error converting " << ref_im_path << " (error " << curr_errCode << ").\n";
+                exit(-1);
+            }
+        }
+        curr_errCode = Common::parse_annot_info(annot_info_path, annot_pts);
+        if (curr_errCode != Common::NoError) {
+            std::cerr << "Error parsing annotation info (error " << curr_errCode << ").\n";
+            exit(-1);
+        }
+    }
+    std::mt19937 rng(settings.m_seed + 1);
+    std::vector<Common::SyntheticRegistrationSample<FLOATPREC> > samples(
+            settings.m_nb_samples);
+    for (uint32_t i_s = 0; i_s<settings.m_nb_samples; ++i_s) {
+        Common::generate_synthetic_sample(
+                ref_im, annot_pts, settings.m_motion, rng, samples[i_s]);
+    }
+
+    std::ofstream csv_file;
+    if (!csv_path.empty()) {
+        csv_file.open(csv_path.c_str());
+        csv_file << "nb_levels,lvl_resz_ratio,template_width,template_height,"
+            "update_mode,nb_iterations,nb_threads,success_rate,mean_corner_err,"
+            "mean_latency_us,quantile_latency_us,fits_budget\n";
+    }
+
+    // search space
+    const uint32_t nb_levels_list[] = {2, 3, 4};
+    const FLOATPREC ratio_list[] = {0.5, 0.7};
+    const uint32_t template_dims_list[][2] = {{100, 150}, {200, 300}, {300, 450}};
+    const bool esm_list[] = {false, true};
+    const uint32_t nb_iterations_list[] = {5, 10, 20};
+    SolverConfig base_config;
+    base_config.m_convergence_threshold = 0.01;
+    base_config.m_roi_mode = true;
+    base_config.m_roi_motion_margin = std::max((FLOATPREC)32.,
+            2 * settings.m_motion.m_max_translation);
+    base_config.m_nb_threads = 1;
+
+    // 1. single threaded pass over the kernel/geometry/iteration space.
+    // Iteration caps are tried in increasing order: once a cap is too slow
+    // even with ideal scaling over all the threads, larger caps are skipped.
+    std::vector<AutotuneResult> results;
+    Common::Timer tuning_timer;
+    for (uint32_t i_l = 0; i_l<sizeof(nb_levels_list) / sizeof(nb_levels_list[0]); ++i_l) {
+    for (uint32_t i_r = 0; i_r<sizeof(ratio_list) / sizeof(ratio_list[0]); ++i_r) {
+    for (uint32_t i_t = 0; i_t<sizeof(template_dims_list) / sizeof(template_dims_list[0]); ++i_t) {
+    for (uint32_t i_e = 0; i_e<sizeof(esm_list) / sizeof(esm_list[0]); ++i_e) {
+        for (uint32_t i_it = 0; i_it<sizeof(nb_iterations_list) / sizeof(nb_iterations_list[0]); ++i_it) {
+            SolverConfig config = base_config;
+            config.m_nb_levels = nb_levels_list[i_l];
+            config.m_lvl_resz_ratio = ratio_list[i_r];
+            config.m_template_width = template_dims_list[i_t][0];
+            config.m_template_height = template_dims_list[i_t][1];
+            config.m_esm_update = esm_list[i_e];
+            config.m_nb_iterations = nb_iterations_list[i_it];
+            AutotuneResult result;
+            curr_errCode = evaluate_config(
+                    config, settings, ref_im, annot_pts, samples, result);
+            if (curr_errCode != Common::NoError) {
+                // e.g. coarsest level template too small: not a candidate
+                break;
+            }
+            const bool fits_budget = result.m_quantile_latency_us <= settings.m_budget_us;
+            std::cout << config_description(result) << (fits_budget ? "" : " | over budget") << "\n";
+            if (csv_file.is_open()) {
+                write_csv_line(csv_file, result, fits_budget);
+            }
+            results.push_back(result);
+            if (result.m_quantile_latency_us
+                    > settings.m_budget_us * settings.m_max_nb_threads) {
+                break;
+            }
+        }
+    }
+    }
+    }
+    }
+
+    // 2. most accurate first: keep the first configuration fitting the budget,
+    // single threaded or with the smallest thread count that makes it fit.
+    std::stable_sort(results.begin(), results.end(), is_more_accurate);
+    bool has_best = false;
+    AutotuneResult best;
+    for (uint32_t i_res = 0; (i_res<results.size()) && !has_best; ++i_res) {
+        if (results[i_res].m_quantile_latency_us <= settings.m_budget_us) {
+            best = results[i_res];
+            has_best = true;
+            break;
+        }
+        if (results[i_res].m_quantile_latency_us
+                > settings.m_budget_us * settings.m_max_nb_threads) {
+            continue; // cannot fit, even with ideal scaling
+        }
+        for (uint32_t nb_threads = 2; nb_threads<=settings.m_max_nb_threads; nb_threads *= 2) {
+            SolverConfig config = results[i_res].m_config;
+            config.m_nb_threads = nb_threads;
+            AutotuneResult result;
+            curr_errCode = evaluate_config(
+                    config, settings, ref_im, annot_pts, samples, result);
+            if (curr_errCode != Common::NoError) {
+                break;
+            }
+            const bool fits_budget = result.m_quantile_latency_us <= settings.m_budget_us;
+            std::cout << config_description(result) << (fits_budget ? "" : " | over budget") << "\n";
+            if (csv_file.is_open()) {
+                write_csv_line(csv_file, result, fits_budget);
+            }
+            if (fits_budget) {
+                best = result;
+                has_best = true;
+                break;
+            }
+        }
+    }
+    std::cout << results.size() << " configurations evaluated in "
+        << tuning_timer.elapsed_s() << " s\n";
+
+    if (!has_best) {
+        std::cerr << "Error: no configuration fits a " << settings.m_budget_us
+            << " us budget on this machine.\n";
+        exit(-1);
+    }
+    std::cout << "best configuration within " << settings.m_budget_us << " us: "
+        << config_description(best) << "\n";
+
+    std::ostringstream comment;
+    comment << "tuned for a " << settings.m_budget_us << " us budget ("
+        << settings.m_latency_quantile << " latency quantile) on "
+        << settings.m_nb_samples << " samples: success " << 100. * best.m_success_rate
+        << " %, corner error " << best.m_mean_corner_err << " px, latency "
+        << best.m_quantile_latency_us << " us";
+    curr_errCode = save_dense_im_reg_config(output_path, best.m_config, comment.str());
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error writing " << output_path << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    std::cout << "solver configuration written to " << output_path << "\n";
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
@@ -0,0 +1,470 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Batch runner for many independent dense image registration jobs.
+* Each job is a (reference image, reference annotation, registration image,
+* registration init) tuple read from a job manifest. Jobs are distributed over
+* worker threads with a work-stealing scheduler, each worker keeping its own
+* solver workspace alive across jobs. Results are written asynchronously to a
+* compact binary file (see batch_result_writer.hpp).
+* With --lockstep K, each worker takes K jobs at a time and registers them in
+* lockstep, solving their normal equations in one SIMD batch (see
+* dense_im_reg_cpu_lockstep.hpp).
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "thread_utils.hpp"
+#include "timing_utils.hpp"
+#include "work_stealing_scheduler.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+#include "dense_im_reg_cpu_lockstep.hpp"
+#include "batch_result_writer.hpp"
+
+#define FLOATPREC float
+
+static const int nb_expected_args = 2;
+
+struct BatchJob
+{
+    std::string m_ref_im_path;
+    std::string m_ref_im_annot_info_path;
+    std::string m_reg_im_path;
+    std::string m_reg_im_init_info_path;
+};
+
+struct BatchConfig
+{
+    uint32_t  m_template_width = 200;
+    uint32_t  m_template_height = 300;
+    uint32_t  m_nb_res_levels = 3;
+    FLOATPREC m_lvl_resz_ratio = 0.5;
+    uint32_t  m_nb_iterations = 5;
+    uint32_t  m_nb_threads = 0; // 0: all hardware threads
+    bool      m_pin_threads = false;
+    bool      m_scaling_study = false;
+    uint32_t  m_nb_lockstep = 1; // jobs registered together by a worker
+};
+
+struct BatchRunStats
+{
+    double   m_elapsed_s = 0.;
+    uint32_t m_nb_jobs = 0;
+    uint32_t m_nb_failed = 0;
+    uint64_t m_nb_steals = 0;
+};
+
+typedef Common::WorkStealingScheduler<uint32_t> JobScheduler;
+typedef DenseImageRegistrationSolver<FLOATPREC> Solver;
+typedef Solver::Workspace Workspace;
+typedef Solver::Model Model;
+
+/*
+* Decoded inputs of a job
+*/
+struct BatchJobData
+{
+    cimg_library::CImg<unsigned char> m_ref_im_gray;
+    cimg_library::CImg<unsigned char> m_reg_im_gray;
+    std::vector<FLOATPREC>            m_annot_pts;
+    std::vector<FLOATPREC>            m_reg_pts;
+};
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << nb_expected_args << " arguments expected, options may follow." << "\n";
+    std::cout << "./batch_dense_im_reg_cpu "
+        "1_job_manifest_path "
+        "2_output_path "
+        "[--threads N] [--pin] [--scaling] [--iterations N] [--lockstep K]"
+        << "\n";
+    std::cout << "Each non-comment ('#') manifest line holds 4 paths:\n"
+        "ref_im_path ref_im_annot_info reg_im_path reg_im_init_info\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* Parse the job manifest: one job per line, 4 whitespace separated paths.
+* Empty lines and lines starting with '#' are ignored.
+*/
+Common::ErrCode
+parse_job_manifest(
+        const std::string &     i_filename,
+        std::vector<BatchJob> & o_jobs)
+{
+    std::ifstream txtFile(i_filename.c_str(), std::ifstream::in);
+    if (!txtFile.is_open()) {
+        std::cerr << "cannot open file " << i_filename << " for reading.\n";
+        return Common::IOCantOpenFile;
+    }
+
+    o_jobs.clear();
+    uint32_t line_ind = 0;
+    for (std::string line; std::getline(txtFile, line); ++line_ind) {
+        if (line.empty() || (line.at(0) == '#')) {
+            continue;
+        }
+        std::istringstream iss(line);
+        BatchJob job;
+        if (!(iss >> job.m_ref_im_path >> job.m_ref_im_annot_info_path
+                >> job.m_reg_im_path >> job.m_reg_im_init_info_path)) {
+            std::cerr << "Malformed job on manifest line " << line_ind + 1 << ".\n";
+            return Common::JobManifestParsingError;
+        }
+        o_jobs.push_back(job);
+    }
+    return Common::NoError;
+}
+
+/*
+* Load and decode the images and annotations of a job.
+*/
+Common::ErrCode
+load_job(
+        const BatchJob &                          i_job,
+        BatchJobData &                            o_data)
+{
+    cimg_library::CImg<unsigned char> ref_im_asis;
+    cimg_library::CImg<unsigned char> reg_im_asis;
+    try {
+        ref_im_asis.assign(i_job.m_ref_im_path.c_str());
+        reg_im_asis.assign(i_job.m_reg_im_path.c_str());
+    } catch (...) {
+        return Common::IOCantOpenFile;
+    }
+
+    Common::ErrCode errCode = Common::NoError;
+    errCode = Common::convert_to_gray(ref_im_asis, o_data.m_ref_im_gray);
+    if (errCode != Common::NoError) { return errCode; }
+    errCode = Common::convert_to_gray(reg_im_asis, o_data.m_reg_im_gray);
+    if (errCode != Common::NoError) { return errCode; }
+
+    errCode = Common::parse_annot_info(i_job.m_ref_im_annot_info_path, o_data.m_annot_pts);
+    if (errCode != Common::NoError) { return errCode; }
+    errCode = Common::parse_annot_info(i_job.m_reg_im_init_info_path, o_data.m_reg_pts);
+    if (errCode != Common::NoError) { return errCode; }
+    return Common::NoError;
+}
+
+/*
+* Run one registration job with the worker's solver workspace.
+*/
+Common::ErrCode
+process_job(
+        const BatchJob &                          i_job,
+        const BatchConfig &                       i_config,
+        Solver &                                  io_solver,
+        BatchResultRecord &                       o_record)
+{
+    BatchJobData data;
+    Common::ErrCode errCode = load_job(i_job, data);
+    if (errCode != Common::NoError) { return errCode; }
+
+    Common::Timer solve_timer;
+    errCode = io_solver.set_template(data.m_ref_im_gray, data.m_annot_pts);
+    if (errCode != Common::NoError) { return errCode; }
+    errCode = io_solver.register_image(
+            data.m_reg_im_gray, i_config.m_nb_iterations, data.m_reg_pts);
+    if (errCode != Common::NoError) { return errCode; }
+    o_record.m_solve_time_us = solve_timer.elapsed_us();
+
+    for (uint32_t i_c = 0; i_c<8; ++i_c) {
+        o_record.m_reg_pts[i_c] = data.m_reg_pts[i_c];
+    }
+    return Common::NoError;
+}
+
+/*
+* Run several registration jobs in lockstep: each job gets a slot (its
+* template model, and a workspace registering against it).
+* io_records[i_j] must hold the job index, it receives the job results.
+*/
+void
+process_jobs_lockstep(
+        const std::vector<BatchJob> &             i_jobs,
+        const BatchConfig &                       i_config,
+        const std::vector<std::shared_ptr<Model> > & io_slot_models,
+        const std::vector<Workspace *> &          io_slot_workspaces,
+        Common::BatchedSpdSolver<FLOATPREC, 8> &  io_normal_solver,
+        std::vector<BatchResultRecord> &          io_records)
+{
+    const uint32_t nb_jobs = io_records.size();
+    std::vector<BatchJobData> data(nb_jobs);
+    std::vector<Workspace *> workspaces;
+    std::vector<Common::ImView<unsigned char> > reg_images;
+    std::vector<std::vector<FLOATPREC> > reg_pts;
+    std::vector<uint32_t> record_inds;
+    for (uint32_t i_j = 0; i_j<nb_jobs; ++i_j) {
+        BatchResultRecord & record = io_records[i_j];
+        Common::ErrCode errCode = load_job(i_jobs[record.m_job_ind], data[i_j]);
+        Common::Timer template_timer;
+        if (errCode == Common::NoError) {
+            // the model is not modified while attached to the workspace
+            io_slot_workspaces[i_j]->release_model();
+            errCode = io_slot_models[i_j]->set_template(
+                    Common::im_view_from_cimg(data[i_j].m_ref_im_gray), data[i_j].m_annot_pts);
+        }
+        if (errCode == Common::NoError) {
+            errCode = io_slot_workspaces[i_j]->set_model(io_slot_models[i_j]);
+        }
+        record.m_solve_time_us = template_timer.elapsed_us();
+        record.m_err_code = errCode;
+        if (errCode == Common::NoError) {
+            workspaces.push_back(io_slot_workspaces[i_j]);
+            reg_images.push_back(Common::im_view_from_cimg(data[i_j].m_reg_im_gray));
+            reg_pts.push_back(data[i_j].m_reg_pts);
+            record_inds.push_back(i_j);
+        }
+    }
+
+    std::vector<Common::ErrCode> errCodes;
+    Common::Timer solve_timer;
+    const Common::ErrCode errCode = register_images_lockstep(workspaces, reg_images,
+            i_config.m_nb_iterations, reg_pts, io_normal_solver, errCodes);
+    const double solve_time_us = solve_timer.elapsed_us() / std::max((size_t)1, workspaces.size());
+    for (uint32_t i_t = 0; i_t<record_inds.size(); ++i_t) {
+        BatchResultRecord & record = io_records[record_inds[i_t]];
+        record.m_err_code = (errCode != Common::NoError) ? errCode : errCodes[i_t];
+        record.m_solve_time_us += solve_time_us;
+        for (uint32_t i_c = 0; i_c<8; ++i_c) {
+            record.m_reg_pts[i_c] = reg_pts[i_t][i_c];
+        }
+    }
+}
+
+/*
+* Worker thread body: keeps one solver workspace for all the jobs it processes.
+*/
+void
+run_worker(
+        uint32_t                      i_worker_ind,
+        const BatchConfig &           i_config,
+        const std::vector<BatchJob> & i_jobs,
+        JobScheduler &                io_scheduler,
+        BatchResultWriter *           io_writer,
+        std::atomic<uint32_t> &       io_nb_failed)
+{
+    if (i_config.m_pin_threads) {
+        Common::pin_current_thread_to_core(i_worker_ind);
+    }
+
+    Solver im_reg_solver;
+    const Common::ErrCode init_errCode = im_reg_solver.init(
+            i_config.m_template_width,
+            i_config.m_template_height,
+            i_config.m_nb_res_levels,
+            i_config.m_lvl_resz_ratio);
+
+    uint32_t job_ind = 0;
+    if ((i_config.m_nb_lockstep > 1) && (init_errCode == Common::NoError)) {
+        // lockstep slots: one template model and one workspace per job
+        const uint32_t nb_slots = i_config.m_nb_lockstep;
+        std::vector<std::shared_ptr<Model> > slot_models(nb_slots);
+        std::vector<std::unique_ptr<Workspace> > workspace_storage(nb_slots);
+        std::vector<Workspace *> slot_workspaces(nb_slots);
+        for (uint32_t i_s = 0; i_s<nb_slots; ++i_s) {
+            slot_models[i_s].reset(new Model(*im_reg_solver.model()));
+            workspace_storage[i_s].reset(new Workspace());
+            slot_workspaces[i_s] = workspace_storage[i_s].get();
+        }
+        Common::BatchedSpdSolver<FLOATPREC, 8> normal_solver;
+        std::vector<BatchResultRecord> records;
+        bool has_jobs = true;
+        while (has_jobs) {
+            records.clear();
+            while ((records.size() < nb_slots)
+                    && (has_jobs = io_scheduler.pop(i_worker_ind, job_ind))) {
+                BatchResultRecord record = BatchResultRecord();
+                record.m_job_ind = job_ind;
+                records.push_back(record);
+            }
+            if (records.empty()) {
+                break;
+            }
+            process_jobs_lockstep(i_jobs, i_config, slot_models, slot_workspaces,
+                    normal_solver, records);
+            for (uint32_t i_r = 0; i_r<records.size(); ++i_r) {
+                if (records[i_r].m_err_code != Common::NoError) {
+                    io_nb_failed++;
+                }
+                if (io_writer != NULL) {
+                    io_writer->push(records[i_r]);
+                }
+            }
+        }
+        return;
+    }
+    while (io_scheduler.pop(i_worker_ind, job_ind)) {
+        BatchResultRecord record = BatchResultRecord();
+        record.m_job_ind = job_ind;
+        Common::ErrCode errCode = init_errCode;
+        if (errCode == Common::NoError) {
+            errCode = process_job(i_jobs[job_ind], i_config, im_reg_solver, record);
+        }
+        record.m_err_code = errCode;
+        if (errCode != Common::NoError) {
+            io_nb_failed++;
+        }
+        if (io_writer != NULL) {
+            io_writer->push(record);
+        }
+    }
+}
+
+/*
+* Process all the jobs of the manifest with a given number of worker threads.
+*/
+BatchRunStats
+run_batch(
+        const BatchConfig &           i_config,
+        const std::vector<BatchJob> & i_jobs,
+        uint32_t                      i_nb_threads,
+        BatchResultWriter *           io_writer)
+{
+    JobScheduler scheduler(i_nb_threads);
+    std::vector<uint32_t> job_inds(i_jobs.size());
+    for (uint32_t i_job = 0; i_job<job_inds.size(); ++i_job) {
+        job_inds[i_job] = i_job;
+    }
+    scheduler.push_all(job_inds);
+
+    std::atomic<uint32_t> nb_failed(0);
+    Common::Timer batch_timer;
+    std::vector<std::thread> workers;
+    for (uint32_t i_w = 0; i_w<i_nb_threads; ++i_w) {
+        workers.push_back(std::thread(run_worker,
+                i_w, std::cref(i_config), std::cref(i_jobs),
+                std::ref(scheduler), io_writer, std::ref(nb_failed)));
+    }
+    for (uint32_t i_w = 0; i_w<workers.size(); ++i_w) {
+        workers[i_w].join();
+    }
+
+    BatchRunStats stats;
+    stats.m_elapsed_s = batch_timer.elapsed_s();
+    stats.m_nb_jobs = i_jobs.size();
+    stats.m_nb_failed = nb_failed;
+    stats.m_nb_steals = scheduler.nb_steals();
+    return stats;
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration batch runner (CPU) ..." << "\n" ;
+
+    if ((argc-1) < nb_expected_args) {
+        std::cerr << "Error: " << argc << " args instead of at least " << nb_expected_args << ".\n";
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    BatchConfig config;
+    uint32_t arg_ind = 1;
+    std::string manifest_path( argv[arg_ind] );
+    arg_ind++;
+    std::string output_path( argv[arg_ind] );
+    arg_ind++;
+    for (; arg_ind<(uint32_t)argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < (uint32_t)argc;
+        if ((opt == "--threads") && has_value) {
+            config.m_nb_threads = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--iterations") && has_value) {
+            config.m_nb_iterations = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--lockstep") && has_value) {
+            config.m_nb_lockstep = std::max(1u, Common::str2val<uint32_t>(argv[++arg_ind]));
+        } else if (opt == "--pin") {
+            config.m_pin_threads = true;
+        } else if (opt == "--scaling") {
+            config.m_scaling_study = true;
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+    const uint32_t max_nb_threads = (config.m_nb_threads > 0) ?
+            config.m_nb_threads : Common::nb_hardware_threads();
+
+    std::vector<BatchJob> jobs;
+    Common::ErrCode curr_errCode = parse_job_manifest(manifest_path, jobs);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error parsing job manifest (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    std::cout << jobs.size() << " jobs in manifest.\n";
+
+    // thread counts to run: 1, 2, 4, ... up to max for a scaling study
+    std::vector<uint32_t> thread_counts;
+    if (config.m_scaling_study) {
+        for (uint32_t nb_t = 1; nb_t<max_nb_threads; nb_t *= 2) {
+            thread_counts.push_back(nb_t);
+        }
+    }
+    thread_counts.push_back(max_nb_threads);
+
+    double single_thread_throughput = 0.;
+    for (uint32_t i_run = 0; i_run<thread_counts.size(); ++i_run) {
+        const uint32_t nb_threads = thread_counts[i_run];
+        // only the last run (max thread count) writes out its results
+        const bool is_last_run = (i_run + 1) == thread_counts.size();
+        BatchResultWriter writer;
+        if (is_last_run) {
+            curr_errCode = writer.open(output_path);
+            if (curr_errCode != Common::NoError) {
+                std::cerr << "Error opening output file (error " << curr_errCode << ").\n";
+                exit(-1);
+            }
+        }
+
+        const BatchRunStats stats = run_batch(
+                config, jobs, nb_threads, is_last_run ? &writer : NULL);
+        writer.close();
+
+        const double throughput = (stats.m_elapsed_s > 0.) ?
+                stats.m_nb_jobs / stats.m_elapsed_s : 0.;
+        if (nb_threads == 1) {
+            single_thread_throughput = throughput;
+        }
+        std::cout << "threads: " << nb_threads
+            << " | jobs: " << stats.m_nb_jobs
+            << " | failed: " << stats.m_nb_failed
+            << " | steals: " << stats.m_nb_steals
+            << " | time: " << stats.m_elapsed_s << " s"
+            << " | throughput: " << throughput << " jobs/s";
+        if (single_thread_throughput > 0.) {
+            std::cout << " | scaling efficiency: "
+                << 100. * throughput / (nb_threads * single_thread_throughput) << " %";
+        }
+        std::cout << "\n";
+    }
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
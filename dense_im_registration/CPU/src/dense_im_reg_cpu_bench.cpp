@@ -37,6 +37,7 @@ print_usage()
         "2_ref_im_annot_info "
         "3_reg_im_path "
         "4_reg_im_init_info "
+        "[5_solver_config (see autotune_dense_im_reg_cpu)]"
         << "\n";
     std::cout << "=========================================================\n";
 }
@@ -47,17 +48,21 @@ int main(int argc, char ** argv)
     std::cout << "dense image registration benchmark (CPU) ..." << "\n" ;
 
     //////////////////////////// ALGO PARAMETERS //////////////////////////////
-    const uint32_t template_width = 200;
-    const uint32_t template_height = 300;
-    const uint32_t nb_res_levels = 3;
-    const FLOATPREC lvl_resz_ratio = 0.5;
-    const uint32_t register_nb_iterations = 5;
+    // defaults, overridden by the optional solver configuration file
+    DenseImageRegistrationConfig<FLOATPREC> solver_config;
+    solver_config.m_template_width = 200;
+    solver_config.m_template_height = 300;
+    solver_config.m_nb_levels = 3;
+    solver_config.m_lvl_resz_ratio = 0.5;
+    solver_config.m_nb_iterations = 5;
+    solver_config.m_roi_mode = true;
+    solver_config.m_roi_motion_margin = 32.;
     ///////////////////////////////////////////////////////////////////////////
 
 
     DenseImageRegistrationSolver<FLOATPREC> im_reg_solver;
 
-    if ((argc-1) != nb_expected_args) {
+    if (((argc-1) != nb_expected_args) && ((argc-1) != nb_expected_args + 1)) {
         std::cerr << "Error: " << argc << " args instead of " << nb_expected_args << ".\n";
         print_usage();
         exit(-1);
@@ -73,6 +78,17 @@ int main(int argc, char ** argv)
     arg_ind++;
     std::string ref_im_init_info_path( argv[arg_ind] );
     arg_ind++;
+    if ((int)arg_ind < argc) {
+        const std::string solver_config_path( argv[arg_ind] );
+        arg_ind++;
+        const Common::ErrCode config_errCode = load_dense_im_reg_config(
+                solver_config_path, solver_config);
+        if (config_errCode != Common::NoError) {
+            std::cerr << "Error loading solver config " << solver_config_path
+                << " (error " << config_errCode << ").\n";
+            exit(-1);
+        }
+    }
 
     // load images
     cimg_library::CImg<unsigned char> ref_im_asis(ref_im_path.c_str());
@@ -110,8 +126,9 @@ int main(int argc, char ** argv)
             // reg_im_colorDisp.YCbCrtoRGB();
             break;
         case 3:
+            // registered as is: the solver converts it to luma while
+            // building its pyramid, over the registration roi only
             reg_im_colorDisp = reg_im_asis;
-            reg_im_gray = reg_im_asis.get_RGBtoYCbCr().get_channel(0);
             break;
     }
 
@@ -151,11 +168,7 @@ int main(int argc, char ** argv)
         std::cout << "\n";
     }
 
-    curr_errCode = im_reg_solver.init(
-            template_width,
-            template_height,
-            nb_res_levels,
-            lvl_resz_ratio);
+    curr_errCode = im_reg_solver.init(solver_config);
     if (curr_errCode != Common::NoError) {
         std::cerr << "Error in solver initialization (error " << curr_errCode << ")." << ".\n";
         exit(-1);
@@ -171,8 +184,8 @@ int main(int argc, char ** argv)
 
     std::vector<FLOATPREC> reg_pts(reginit_pts);
     curr_errCode = im_reg_solver.register_image(
-            reg_im_gray,
-            register_nb_iterations,
+            reg_im_asis,
+            solver_config.m_nb_iterations,
             reg_pts);
     if (curr_errCode != Common::NoError) {
         std::cerr << "Error in image registration (error " << curr_errCode << ")." << ".\n";
@@ -0,0 +1,286 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Test client of the local registration service (server_dense_im_reg_cpu):
+* replays a recorded frame sequence (raw frame file, see
+* raw_frame_container.hpp) through the server, as replay_dense_im_reg_cpu_raw
+* does in process. The template is set once on the first frame, then the quad
+* is tracked from frame to frame. Frames are written in the slots of a shared
+* memory frame ring (round robin) before their request is sent, as a capture
+* process would, so that only the request round trip is timed. The client
+* reports its round trip latencies next to the solver and service times
+* returned by the server, and the server statistics.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "local_socket_utils.hpp"
+#include "raw_frame_container.hpp"
+#include "shm_frame_ring.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu_service.hpp"
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./client_dense_im_reg_cpu "
+        "1_socket_path "
+        "2_frames.raw "
+        "3_first_frame_annot_info "
+        "[--slots N] [--iterations N] [--repeat N] [--output reg_pts.txt] [--shutdown]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* copy a frame of the sequence in a ring slot
+*/
+void
+write_frame_to_slot(
+        const Common::RawFrameReader & i_frames,
+        uint64_t                       i_frame,
+        const Common::ShmFrameRing &   io_ring,
+        uint32_t                       i_slot)
+{
+    for (uint32_t i_c = 0; i_c<i_frames.nb_channels(); ++i_c) {
+        const Common::ImView<uint8_t> plane = i_frames.frame_view(i_frame, i_c);
+        uint8_t * slot_plane = io_ring.slot_plane(i_slot, i_frames.height(), i_c);
+        for (uint32_t i_y = 0; i_y<i_frames.height(); ++i_y) {
+            std::memcpy(slot_plane + (size_t)i_y * io_ring.stride(),
+                    plane.row(i_y), i_frames.width());
+        }
+    }
+}
+
+void
+print_latency_stats(
+        const std::string &         i_name,
+        const ServiceLatencyStats & i_stats)
+{
+    std::cout << i_name << ": " << i_stats.m_nb_requests << " requests"
+        << " | mean: " << i_stats.m_mean_us << " us"
+        << " | median: " << i_stats.m_median_us << " us"
+        << " | p90: " << i_stats.m_p90_us << " us"
+        << " | p99: " << i_stats.m_p99_us << " us"
+        << " | max: " << i_stats.m_max_us << " us"
+        << "\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration service client (CPU) ..." << "\n" ;
+
+    if (argc < 4) {
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    const std::string socket_path(argv[1]);
+    const std::string frames_path(argv[2]);
+    const std::string annot_info_path(argv[3]);
+    uint32_t nb_slots = 4;
+    uint32_t nb_iterations = 0; // 0: server configuration
+    uint32_t nb_repeats = 1;
+    bool shutdown_server = false;
+    std::string output_path;
+    for (int arg_ind = 4; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--slots") && has_value) {
+            nb_slots = std::max(1u, Common::str2val<uint32_t>(argv[++arg_ind]));
+        } else if ((opt == "--iterations") && has_value) {
+            nb_iterations = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--repeat") && has_value) {
+            nb_repeats = std::max(1u, Common::str2val<uint32_t>(argv[++arg_ind]));
+        } else if ((opt == "--output") && has_value) {
+            output_path = argv[++arg_ind];
+        } else if (opt == "--shutdown") {
+            shutdown_server = true;
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    Common::RawFrameReader frames;
+    Common::ErrCode curr_errCode = frames.open(frames_path);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error opening " << frames_path << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    if (frames.nb_frames() == 0) {
+        std::cerr << "Error: " << frames_path << " holds no frame.\n";
+        exit(-1);
+    }
+    frames.preload();
+
+    std::vector<double> annot_pts;
+    curr_errCode = Common::parse_annot_info(annot_info_path, annot_pts);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error parsing annotation info (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+
+    // frame ring, named after the process
+#if defined(__unix__) || defined(__APPLE__)
+    const std::string ring_name = "/dense_im_reg_" + std::to_string(getpid());
+#else
+    const std::string ring_name = "/dense_im_reg";
+#endif
+    Common::ShmFrameRing ring;
+    curr_errCode = ring.create(ring_name, nb_slots, frames.width(), frames.height(),
+            frames.nb_channels());
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error creating frame ring " << ring_name
+            << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+
+    int fd = -1;
+    curr_errCode = Common::local_socket_connect(socket_path, fd);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error connecting to " << socket_path << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+
+    ServiceRequest request;
+    std::memset(&request, 0, sizeof(request));
+    ServiceReply reply;
+    request.m_type = ServiceAttachRing;
+    std::strncpy(request.m_ring_name, ring_name.c_str(), SERVICE_RING_NAME_SIZE - 1);
+    curr_errCode = service_call(fd, request, reply);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error attaching the frame ring (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+
+    // the template is set (once) on the first frame
+    write_frame_to_slot(frames, 0, ring, 0);
+    std::memset(&request, 0, sizeof(request));
+    request.m_type = ServiceSetTemplate;
+    request.m_request_id = 1;
+    request.m_slot = 0;
+    request.m_width = frames.width();
+    request.m_height = frames.height();
+    request.m_format = frames.format();
+    for (uint32_t i_c = 0; i_c<8; ++i_c) {
+        request.m_pts[i_c] = annot_pts[i_c];
+    }
+    Common::Timer template_timer;
+    curr_errCode = service_call(fd, request, reply);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error setting template (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    const uint32_t template_id = reply.m_template_id;
+    std::cout << "template " << template_id << " set in " << template_timer.elapsed_us()
+        << " us (solver: " << reply.m_solve_us << " us)\n";
+
+    // track the quad along the sequence
+    std::vector<double> round_trip_us;
+    std::vector<double> service_us;
+    std::vector<double> solve_us;
+    std::vector<std::vector<double> > frame_pts;
+    uint32_t nb_lost = 0;
+    uint32_t request_id = 2;
+    for (uint32_t i_r = 0; i_r<nb_repeats; ++i_r) {
+        frame_pts.clear();
+        std::vector<double> reg_pts(annot_pts);
+        for (uint64_t i_f = 1; i_f<frames.nb_frames(); ++i_f) {
+            const uint32_t slot = i_f % nb_slots;
+            write_frame_to_slot(frames, i_f, ring, slot);
+            std::memset(&request, 0, sizeof(request));
+            request.m_type = ServiceRegister;
+            request.m_request_id = request_id++;
+            request.m_template_id = template_id;
+            request.m_slot = slot;
+            request.m_width = frames.width();
+            request.m_height = frames.height();
+            request.m_format = frames.format();
+            request.m_nb_iterations = nb_iterations;
+            for (uint32_t i_c = 0; i_c<8; ++i_c) {
+                request.m_pts[i_c] = reg_pts[i_c];
+            }
+            Common::Timer request_timer;
+            curr_errCode = service_call(fd, request, reply);
+            round_trip_us.push_back(request_timer.elapsed_us());
+            service_us.push_back(reply.m_service_us);
+            solve_us.push_back(reply.m_solve_us);
+            if (curr_errCode == Common::TrackingLost) {
+                nb_lost++; // keep the last quad, the target may come back
+            } else if (curr_errCode != Common::NoError) {
+                std::cerr << "Error in image registration of frame " << i_f
+                    << " (error " << curr_errCode << ").\n";
+                exit(-1);
+            } else {
+                reg_pts.assign(reply.m_pts, reply.m_pts + 8);
+            }
+            frame_pts.push_back(reg_pts);
+        }
+    }
+    print_latency_stats("round trip", compute_service_latency_stats(round_trip_us));
+    print_latency_stats("server (service)", compute_service_latency_stats(service_us));
+    print_latency_stats("server (solver)", compute_service_latency_stats(solve_us));
+    if (nb_lost > 0) {
+        std::cout << "lost frames: " << nb_lost << "\n";
+    }
+
+    std::memset(&request, 0, sizeof(request));
+    request.m_type = ServiceGetStats;
+    request.m_request_id = request_id++;
+    if (service_call(fd, request, reply) == Common::NoError) {
+        print_latency_stats("server total (service)", reply.m_service_stats);
+        print_latency_stats("server total (solver)", reply.m_solve_stats);
+    }
+
+    request.m_type = ServiceReleaseTemplate;
+    request.m_request_id = request_id++;
+    request.m_template_id = template_id;
+    service_call(fd, request, reply);
+    if (shutdown_server) {
+        request.m_type = ServiceShutdown;
+        request.m_request_id = request_id++;
+        service_call(fd, request, reply);
+    }
+    Common::local_socket_close(fd);
+
+    if (!output_path.empty()) {
+        std::ofstream output_file(output_path.c_str());
+        for (uint32_t i_f = 0; i_f<frame_pts.size(); ++i_f) {
+            output_file << i_f + 1;
+            for (uint32_t i_c = 0; i_c<8; ++i_c) {
+                output_file << " " << frame_pts[i_f][i_c];
+            }
+            output_file << "\n";
+        }
+    }
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
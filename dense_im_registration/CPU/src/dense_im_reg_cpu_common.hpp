@@ -0,0 +1,267 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Definitions shared by the dense image registration template model, solver
+* workspace and solver: Eigen configuration, matrix types and the elementary
+* warping / sampling functions.
+*/
+
+#ifndef _DENSE_IM_REG_CPU_COMMON_HPP
+#define _DENSE_IM_REG_CPU_COMMON_HPP
+
+// ************************** EIGEN SPECIFIC DEFS *****************************
+// setting the flag below could help see if there are hidden allocations.
+//#define EIGEN_NO_AUTOMATIC_RESIZING
+//#define EIGEN_RUNTIME_NO_MALLOC
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+#define malloc_allowed(v) Eigen::internal::set_is_malloc_allowed(v)
+#else
+#define malloc_allowed(v)
+#endif
+
+#define EIGEN_DEFAULT_TO_ROW_MAJOR // comment out this line to use ColMajor
+// ****************************************************************************
+
+#undef Success //(X11 and Eigen both define the Success macro)
+
+// match our own structure orders with Eigen internal's
+#ifdef EIGEN_DEFAULT_TO_ROW_MAJOR
+    #define MY_STORAGE_ORDER Eigen::RowMajor
+#else
+    #define MY_STORAGE_ORDER Eigen::ColMajor
+#endif
+
+#include <Eigen/Dense>
+
+#include <limits>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+
+#include "coarse_search_utils.hpp"
+#include "color_conversion_utils.hpp"
+#include "im_processing_utils.hpp"
+#include "optimization_utils.hpp"
+
+
+/*
+* Matrix and vector types of the dense image registration classes
+*/
+template <typename FloatPrec>
+struct DenseImageRegistrationTypes
+{
+    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, Eigen::Dynamic, MY_STORAGE_ORDER>
+            MatrixNN;
+    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, 2, MY_STORAGE_ORDER>
+            MatrixN2;
+    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, 4, MY_STORAGE_ORDER>
+            MatrixN4;
+    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, 6, MY_STORAGE_ORDER>
+            MatrixN6;
+    typedef Eigen::Matrix<FloatPrec, 1, Eigen::Dynamic, MY_STORAGE_ORDER>
+            VecN;
+    typedef Eigen::Matrix<FloatPrec, 1, 6, MY_STORAGE_ORDER>
+            Vec6;
+    typedef Eigen::Matrix<FloatPrec, 4, 2, MY_STORAGE_ORDER>
+            Matrix42;
+    typedef Common::ImDim<uint32_t>                         ImDim;
+    typedef std::vector<ImDim>                              LvlList_ImDim;
+    typedef std::vector<FloatPrec>                          LvlList_Ratio;
+    typedef std::vector<VecN>                               LvlList_VecN;
+    typedef std::vector<MatrixN4>                           LvlList_MatN4;
+    typedef std::vector<MatrixN2>                           LvlList_MatN2;
+    typedef std::vector<cimg_library::CImg<FloatPrec> >     LvlList_Images;
+    typedef std::vector<MatrixNN>                           LvlList_MatNN;
+};
+
+
+/*
+* copy N*4 quad warping coefficients (row-major, see
+* Common::generate_quad_warping_coeffs) into an Eigen matrix. i_W needs no
+* particular alignment.
+*/
+template <typename FloatPrec>
+Common::ErrCode
+eigen_quad_warping_fromptr(
+        const FloatPrec *                                            i_W,
+        uint32_t                                                     N,
+        typename DenseImageRegistrationTypes<FloatPrec>::MatrixN4 & o_W_eigen)
+{
+    o_W_eigen.resize(N, 4);
+    typedef typename DenseImageRegistrationTypes<FloatPrec>::MatrixN4 MatN4;
+    typedef typename Eigen::Map<const MatN4, Eigen::Unaligned> MatrixN4_CstMap;
+    // copy elements from i_W into o_W_eigen:
+    o_W_eigen = MatrixN4_CstMap(i_W, N, 4);
+    return Common::NoError;
+}
+
+template <typename FloatPrec>
+Common::ErrCode
+eigen_quad_warping_fromstd(
+        const std::vector<FloatPrec> &                               i_W,
+        typename DenseImageRegistrationTypes<FloatPrec>::MatrixN4 & o_W_eigen)
+{
+    const uint32_t N = i_W.size() / 4;
+    return eigen_quad_warping_fromptr<FloatPrec>(&(i_W[0]), N, o_W_eigen);
+}
+
+/*
+* sample i_image at the (x, y) grid coordinates stored in the rows of
+* i_grid_coords (any N x 2 Eigen expression, e.g. a solver MatrixN2 or a Map on
+* external memory).
+*/
+template <typename FloatPrec, typename GridDerived>
+Common::ErrCode
+warp_grid(
+        const cimg_library::CImg<FloatPrec> &
+                i_image,
+        const Eigen::MatrixBase<GridDerived> &
+                i_grid_coords,
+        typename DenseImageRegistrationTypes<FloatPrec>::VecN &
+                o_pix_values)
+{
+    const uint32_t nb_pix = i_grid_coords.rows();
+    for (uint32_t i_pixind=0; i_pixind<nb_pix; ++i_pixind) {
+        o_pix_values(i_pixind) = Common::bilinear_pix_interp_clamped(
+                i_image, i_grid_coords(i_pixind, 0), i_grid_coords(i_pixind, 1));
+    }
+    return Common::NoError;
+}
+
+/*
+* sample i_image on the grid of a (width x height) template warped into the
+* quad i_lvl_pts (vertices A, B, C, D in image coordinates, same convention as
+* the W coefficients). Bilinear quads map template rows to straight segments,
+* so grid points are computed row by row instead of through the N x 4 W
+* matrix product.
+*/
+template <typename FloatPrec>
+void
+sample_quad_grid(
+        const cimg_library::CImg<FloatPrec> &                        i_image,
+        const typename DenseImageRegistrationTypes<FloatPrec>::Matrix42 &
+                                                                     i_lvl_pts,
+        const Common::ImDim<uint32_t> &                              i_templdim,
+        typename DenseImageRegistrationTypes<FloatPrec>::VecN &     o_values)
+{
+    const uint32_t width = i_templdim.width();
+    const uint32_t height = i_templdim.height();
+    const FloatPrec inv_w = 1. / (FloatPrec)(width - 1);
+    const FloatPrec inv_h = 1. / (FloatPrec)(height - 1);
+    for (uint32_t i_y = 0; i_y<height; ++i_y) {
+        const FloatPrec v = inv_h * i_y;
+        // row end points, on edges AD and BC
+        const FloatPrec x_l = (1-v) * i_lvl_pts(0, 0) + v * i_lvl_pts(3, 0);
+        const FloatPrec y_l = (1-v) * i_lvl_pts(0, 1) + v * i_lvl_pts(3, 1);
+        const FloatPrec x_r = (1-v) * i_lvl_pts(1, 0) + v * i_lvl_pts(2, 0);
+        const FloatPrec y_r = (1-v) * i_lvl_pts(1, 1) + v * i_lvl_pts(2, 1);
+        const FloatPrec dx = inv_w * (x_r - x_l);
+        const FloatPrec dy = inv_w * (y_r - y_l);
+        FloatPrec * dst = &(o_values(i_y * width));
+        for (uint32_t i_x = 0; i_x<width; ++i_x) {
+            dst[i_x] = Common::bilinear_pix_interp_clamped(
+                    i_image, x_l + i_x * dx, y_l + i_x * dy);
+        }
+    }
+}
+
+/*
+* compute the gradients of a template (stored row-major in i_template) along
+* the template grid axes u (columns) and v (rows), with central differences.
+*/
+template <typename FloatPrec>
+Common::ErrCode
+compute_template_gradients(
+        const typename DenseImageRegistrationTypes<FloatPrec>::VecN &
+                i_template,
+        const Common::ImDim<uint32_t> &
+                i_templdim,
+        typename DenseImageRegistrationTypes<FloatPrec>::VecN &
+                o_gradu,
+        typename DenseImageRegistrationTypes<FloatPrec>::VecN &
+                o_gradv)
+{
+    const int32_t width = i_templdim.width();
+    const int32_t height = i_templdim.height();
+    o_gradu.resize(i_template.size());
+    o_gradv.resize(i_template.size());
+    for (int32_t i_y = 0; i_y<height; ++i_y) {
+        const int32_t y_up = std::max(i_y-1, 0);
+        const int32_t y_dn = std::min(i_y+1, height-1);
+        for (int32_t i_x = 0; i_x<width; ++i_x) {
+            const int32_t x_lt = std::max(i_x-1, 0);
+            const int32_t x_rt = std::min(i_x+1, width-1);
+            o_gradu(i_y*width + i_x) = (i_template(i_y*width + x_rt)
+                    - i_template(i_y*width + x_lt)) / (FloatPrec)(x_rt - x_lt);
+            o_gradv(i_y*width + i_x) = (i_template(y_dn*width + i_x)
+                    - i_template(y_up*width + i_x)) / (FloatPrec)(y_dn - y_up);
+        }
+    }
+    return Common::NoError;
+}
+
+/*
+* Sample the template (w x h, row-major) at the image position (x, y) inside
+* the quad q (4 vertices, same coordinates as (x, y)): the template grid
+* position (s, t) in [0, 1]^2 is found by inverting the bilinear quad warp with
+* a few Newton iterations, positions outside the quad are clamped to the
+* template border (o_inside, if given, tells whether (x, y) is in the quad).
+*/
+template <typename FloatPrec>
+FloatPrec
+sample_template_in_quad(
+        const typename DenseImageRegistrationTypes<FloatPrec>::VecN &
+                i_template,
+        const Common::ImDim<uint32_t> &
+                i_templdim,
+        const FloatPrec *
+                i_quad,
+        FloatPrec
+                x,
+        FloatPrec
+                y,
+        bool *
+                o_inside = NULL)
+{
+    const FloatPrec xA = i_quad[0], yA = i_quad[1], xB = i_quad[2], yB = i_quad[3];
+    const FloatPrec xC = i_quad[4], yC = i_quad[5], xD = i_quad[6], yD = i_quad[7];
+    FloatPrec s = 0.5;
+    FloatPrec t = 0.5;
+    for (uint32_t i_it = 0; i_it<5; ++i_it) {
+        const FloatPrec fx = (1-s)*(1-t)*xA + s*(1-t)*xB + s*t*xC + (1-s)*t*xD - x;
+        const FloatPrec fy = (1-s)*(1-t)*yA + s*(1-t)*yB + s*t*yC + (1-s)*t*yD - y;
+        const FloatPrec j_xs = (1-t)*(xB - xA) + t*(xC - xD);
+        const FloatPrec j_ys = (1-t)*(yB - yA) + t*(yC - yD);
+        const FloatPrec j_xt = (1-s)*(xD - xA) + s*(xC - xB);
+        const FloatPrec j_yt = (1-s)*(yD - yA) + s*(yC - yB);
+        const FloatPrec det = j_xs * j_yt - j_xt * j_ys;
+        if (std::abs(det) < std::numeric_limits<FloatPrec>::epsilon()) {
+            break;
+        }
+        s -= (j_yt * fx - j_xt * fy) / det;
+        t -= (j_xs * fy - j_ys * fx) / det;
+    }
+    if (o_inside) {
+        *o_inside = (s >= 0.) && (s <= 1.) && (t >= 0.) && (t <= 1.);
+    }
+    const uint32_t width = i_templdim.width();
+    const uint32_t height = i_templdim.height();
+    const FloatPrec u = std::min(std::max(s, (FloatPrec)0.), (FloatPrec)1.) * (width - 1);
+    const FloatPrec v = std::min(std::max(t, (FloatPrec)0.), (FloatPrec)1.) * (height - 1);
+    const uint32_t u0 = std::min((uint32_t)u, width - 2);
+    const uint32_t v0 = std::min((uint32_t)v, height - 2);
+    const FloatPrec au = u - u0;
+    const FloatPrec av = v - v0;
+    const uint32_t ind = v0 * width + u0;
+    return (1-av) * ((1-au) * i_template(ind) + au * i_template(ind + 1))
+            + av * ((1-au) * i_template(ind + width) + au * i_template(ind + width + 1));
+}
+
+#endif /* _DENSE_IM_REG_CPU_COMMON_HPP *  * */
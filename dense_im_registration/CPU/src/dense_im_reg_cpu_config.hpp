@@ -0,0 +1,168 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _DENSE_IM_REG_CPU_CONFIG_HPP
+#define _DENSE_IM_REG_CPU_CONFIG_HPP
+
+#include <stdint.h>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+
+#include "errCodes.h"
+#include "im_processing_utils.hpp"
+
+
+/*
+* Solver configuration: everything that is tuned per deployment (see the
+* autotune_dense_im_reg_cpu tool), loadable by the solver
+* ('DenseImageRegistrationSolver::init(config)').
+* Config files are text files of 'key value' lines, lines starting with '#'
+* are ignored, missing keys keep their default value.
+*/
+template <typename FloatPrec>
+struct DenseImageRegistrationConfig
+{
+    uint32_t  m_template_width = 200;
+    uint32_t  m_template_height = 300;
+    uint32_t  m_nb_levels = 3;
+    FloatPrec m_lvl_resz_ratio = 0.5;
+    uint32_t  m_nb_iterations = 5;         // max nb of iterations per registration
+    FloatPrec m_convergence_threshold = 0.;
+    bool      m_esm_update = false;        // ESM or Gauss-Newton updates
+    bool      m_roi_mode = true;
+    FloatPrec m_roi_motion_margin = 32.;
+    uint32_t  m_nb_threads = 1;            // threads per registration
+};
+
+
+/*
+* Read an unsigned config value: the value is read as a signed integer first,
+* so that negative values are rejected instead of wrapping around
+*/
+inline
+bool
+read_config_uint(
+        std::istringstream & io_iss,
+        uint32_t &           o_value)
+{
+    int64_t value = 0;
+    if (!(io_iss >> value) || (value < 0) || (value > (int64_t)std::numeric_limits<uint32_t>::max())) {
+        return false;
+    }
+    o_value = (uint32_t)value;
+    return true;
+}
+
+
+/*
+* Load a solver configuration file. Malformed lines, unknown keys and out of
+* range values are rejected (ConfigFileParsingError).
+*/
+template <typename FloatPrec>
+Common::ErrCode
+load_dense_im_reg_config(
+        const std::string &                       i_filename,
+        DenseImageRegistrationConfig<FloatPrec> & o_config)
+{
+    std::ifstream config_file(i_filename.c_str());
+    if (!config_file.is_open()) {
+        return Common::IOCantOpenFile;
+    }
+    DenseImageRegistrationConfig<FloatPrec> config;
+    std::string line;
+    while (std::getline(config_file, line)) {
+        std::istringstream iss(line);
+        iss.imbue(std::locale("C")); // enforce C locale
+        std::string key;
+        if (!(iss >> key) || (key[0] == '#')) {
+            continue; // empty line or comment
+        }
+        std::string value;
+        bool is_valid = true;
+        if (key == "template_width") {
+            is_valid = read_config_uint(iss, config.m_template_width);
+        } else if (key == "template_height") {
+            is_valid = read_config_uint(iss, config.m_template_height);
+        } else if (key == "nb_levels") {
+            is_valid = read_config_uint(iss, config.m_nb_levels);
+        } else if (key == "lvl_resz_ratio") {
+            is_valid = !!(iss >> config.m_lvl_resz_ratio);
+        } else if (key == "nb_iterations") {
+            is_valid = read_config_uint(iss, config.m_nb_iterations);
+        } else if (key == "convergence_threshold") {
+            is_valid = !!(iss >> config.m_convergence_threshold);
+        } else if (key == "update_mode") {
+            is_valid = !!(iss >> value) && ((value == "esm") || (value == "gauss_newton"));
+            config.m_esm_update = (value == "esm");
+        } else if (key == "roi_mode") {
+            is_valid = !!(iss >> config.m_roi_mode);
+        } else if (key == "roi_motion_margin") {
+            is_valid = !!(iss >> config.m_roi_motion_margin);
+        } else if (key == "nb_threads") {
+            is_valid = read_config_uint(iss, config.m_nb_threads);
+        } else {
+            is_valid = false;
+        }
+        std::string extra;
+        if (!is_valid || (iss >> extra)) {
+            return Common::ConfigFileParsingError; // bad value or trailing tokens
+        }
+    }
+
+    // value ranges (the file may come from outside, e.g. the server)
+    const bool in_range =
+            (config.m_template_width >= 2)
+            && (config.m_template_width <= MAX_TEMPLATE_DIMENSION)
+            && (config.m_template_height >= 2)
+            && (config.m_template_height <= MAX_TEMPLATE_DIMENSION)
+            && (config.m_nb_levels >= 1)
+            && (config.m_lvl_resz_ratio > 0.) && (config.m_lvl_resz_ratio <= 1.)
+            && (config.m_roi_motion_margin >= 0.)
+            && (config.m_nb_threads >= 1);
+    if (!in_range) {
+        return Common::ConfigFileParsingError;
+    }
+    o_config = config;
+    return Common::NoError;
+}
+
+
+/*
+* Save a solver configuration file
+*/
+template <typename FloatPrec>
+Common::ErrCode
+save_dense_im_reg_config(
+        const std::string &                             i_filename,
+        const DenseImageRegistrationConfig<FloatPrec> & i_config,
+        const std::string &                             i_comment = "")
+{
+    std::ofstream config_file(i_filename.c_str());
+    if (!config_file.is_open()) {
+        return Common::IOCantOpenFile;
+    }
+    config_file.imbue(std::locale("C"));
+    config_file << "# dense image registration solver configuration\n";
+    if (!i_comment.empty()) {
+        config_file << "# " << i_comment << "\n";
+    }
+    config_file << "template_width " << i_config.m_template_width << "\n";
+    config_file << "template_height " << i_config.m_template_height << "\n";
+    config_file << "nb_levels " << i_config.m_nb_levels << "\n";
+    config_file << "lvl_resz_ratio " << i_config.m_lvl_resz_ratio << "\n";
+    config_file << "nb_iterations " << i_config.m_nb_iterations << "\n";
+    config_file << "convergence_threshold " << i_config.m_convergence_threshold << "\n";
+    config_file << "update_mode " << (i_config.m_esm_update ? "esm" : "gauss_newton") << "\n";
+    config_file << "roi_mode " << (i_config.m_roi_mode ? 1 : 0) << "\n";
+    config_file << "roi_motion_margin " << i_config.m_roi_motion_margin << "\n";
+    config_file << "nb_threads " << i_config.m_nb_threads << "\n";
+    return config_file.good() ? Common::NoError : Common::IOCantOpenFile;
+}
+
+#endif /* _DENSE_IM_REG_CPU_CONFIG_HPP *  * */
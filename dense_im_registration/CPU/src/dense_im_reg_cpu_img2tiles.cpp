@@ -0,0 +1,121 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Convert a (very large) image to a tiled pyramid file (see tiled_pyramid.hpp),
+* in which templates can then be registered out-of-core. The input is either
+* a raw frame file (first frame, memory-mapped: the image never has to be
+* resident) or any image format CImg can decode.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "im_processing_utils.hpp"
+#include "raw_frame_container.hpp"
+#include "tiled_pyramid.hpp"
+#include "timing_utils.hpp"
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./convert_to_tiled_pyramid "
+        "input.(raw|png|...) output.tiles "
+        "[--levels N] [--ratio r] [--tile-size px]"
+        << "\n";
+    std::cout << "the levels and ratio must match the registration solver settings."
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "tiled pyramid conversion ..." << "\n" ;
+
+    if (argc < 3) {
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    const std::string input_path(argv[1]);
+    const std::string output_path(argv[2]);
+    uint32_t nb_levels = 3;
+    float lvl_resz_ratio = 0.5;
+    uint32_t tile_size = 256;
+    for (int arg_ind = 3; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--levels") && has_value) {
+            nb_levels = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--ratio") && has_value) {
+            lvl_resz_ratio = Common::str2val<float>(argv[++arg_ind]);
+        } else if ((opt == "--tile-size") && has_value) {
+            tile_size = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    // input image: first frame of a raw frame file, or decoded image
+    Common::ErrCode errCode = Common::NoError;
+    Common::RawFrameReader frames;
+    cimg_library::CImg<unsigned char> im_gray;
+    Common::ImView<uint8_t> im_view;
+    const bool input_is_raw = (input_path.size() > 4)
+            && (input_path.compare(input_path.size() - 4, 4, ".raw") == 0);
+    if (input_is_raw) {
+        errCode = frames.open(input_path);
+        if ((errCode != Common::NoError) || (frames.nb_frames() == 0)
+                || (frames.format() != Common::RawFrameGray8)) {
+            std::cerr << "Error: " << input_path << " must be a grayscale raw frame file.\n";
+            exit(-1);
+        }
+        im_view = frames.frame_view(0);
+    } else {
+        cimg_library::CImg<unsigned char> im_asis;
+        try {
+            im_asis.assign(input_path.c_str());
+        } catch (...) {
+            std::cerr << "Error: can't read " << input_path << ".\n";
+            exit(-1);
+        }
+        errCode = Common::convert_to_gray(im_asis, im_gray);
+        if (errCode != Common::NoError) {
+            std::cerr << "Error converting " << input_path << " (error " << errCode << ").\n";
+            exit(-1);
+        }
+        im_view = Common::im_view_from_cimg(im_gray);
+    }
+
+    Common::Timer convert_timer;
+    errCode = Common::write_tiled_pyramid(
+            output_path, im_view, nb_levels, lvl_resz_ratio, tile_size);
+    if (errCode != Common::NoError) {
+        std::cerr << "Error writing " << output_path << " (error " << errCode << ").\n";
+        exit(-1);
+    }
+    std::cout << im_view.width() << "x" << im_view.height() << " image, "
+        << nb_levels << " levels of " << tile_size << "x" << tile_size
+        << " tiles written to " << output_path
+        << " in " << convert_timer.elapsed_s() << " s\n";
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
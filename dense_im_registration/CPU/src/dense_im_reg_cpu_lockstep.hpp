@@ -0,0 +1,95 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _DENSE_IM_REG_CPU_LOCKSTEP_HPP
+#define _DENSE_IM_REG_CPU_LOCKSTEP_HPP
+
+#include <vector>
+
+#include "batched_spd_solver.hpp"
+
+#include "dense_im_reg_cpu_workspace.hpp"
+
+
+/*
+* Register several targets together: target i_t is the template of the model
+* attached to io_workspaces[i_t] (workspaces may share a model), registered in
+* i_reg_images[i_t] from the quad io_reg_pts[i_t]. The targets iterate in
+* lockstep: each iteration assembles the normal equations of all the targets
+* still running, solves them in one batch (one system per SIMD lane, see
+* batched_spd_solver.hpp) and applies the steps. A target stops when it
+* converges (see 'set_convergence_threshold') or after i_nb_iterations
+* iterations, as in 'register_image'. io_normal_solver holds the batched
+* systems (8 quad coordinates per target), it can be kept across calls.
+* Per-target errors are returned in o_errCodes (the quad of a failed target
+* is left untouched). Jacobian reuse and the tracking loss check are not
+* supported: targets whose workspace enables them fail with
+* UnsupportedLockstepMode.
+*/
+template <typename FloatPrec>
+Common::ErrCode
+register_images_lockstep(
+        const std::vector<DenseImageRegistrationWorkspace<FloatPrec> *> & io_workspaces,
+        const std::vector<Common::ImView<unsigned char> > &                i_reg_images,
+        uint32_t                                                           i_nb_iterations,
+        std::vector<std::vector<FloatPrec> > &                             io_reg_pts,
+        Common::BatchedSpdSolver<FloatPrec, 8> &                           io_normal_solver,
+        std::vector<Common::ErrCode> &                                     o_errCodes)
+{
+    typedef typename DenseImageRegistrationWorkspace<FloatPrec>::VecN VecN;
+    const uint32_t nb_targets = io_workspaces.size();
+    if ((i_reg_images.size() != nb_targets) || (io_reg_pts.size() != nb_targets)) {
+        return Common::UnknownError;
+    }
+
+    o_errCodes.assign(nb_targets, Common::NoError);
+    std::vector<uint32_t> running_targets;
+    for (uint32_t i_t = 0; i_t<nb_targets; ++i_t) {
+        o_errCodes[i_t] = io_workspaces[i_t]->begin_lockstep(
+                i_reg_images[i_t], io_reg_pts[i_t]);
+        if (o_errCodes[i_t] == Common::NoError) {
+            running_targets.push_back(i_t);
+        }
+    }
+
+    VecN delta(8);
+    std::vector<uint32_t> next_running_targets;
+    for (uint32_t i_i = 0; (i_i<i_nb_iterations) && !running_targets.empty(); ++i_i) {
+        const uint32_t nb_running = running_targets.size();
+        io_normal_solver.resize(nb_running);
+        for (uint32_t i_r = 0; i_r<nb_running; ++i_r) {
+            DenseImageRegistrationWorkspace<FloatPrec> & workspace =
+                    *io_workspaces[running_targets[i_r]];
+            workspace.compute_normal_equations();
+            io_normal_solver.set_system(i_r,
+                    workspace.normal_matrix(), workspace.normal_rhs());
+        }
+        io_normal_solver.solve();
+
+        next_running_targets.clear();
+        for (uint32_t i_r = 0; i_r<nb_running; ++i_r) {
+            const uint32_t i_t = running_targets[i_r];
+            io_normal_solver.get_solution(i_r, delta);
+            delta = -delta;
+            bool converged = false;
+            o_errCodes[i_t] = io_workspaces[i_t]->apply_step(delta, converged);
+            if ((o_errCodes[i_t] == Common::NoError) && !converged) {
+                next_running_targets.push_back(i_t);
+            }
+        }
+        running_targets.swap(next_running_targets);
+    }
+
+    for (uint32_t i_t = 0; i_t<nb_targets; ++i_t) {
+        if (o_errCodes[i_t] == Common::NoError) {
+            io_workspaces[i_t]->end_lockstep(io_reg_pts[i_t]);
+        }
+    }
+    return Common::NoError;
+}
+
+#endif /* _DENSE_IM_REG_CPU_LOCKSTEP_HPP *  * */
@@ -0,0 +1,422 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Microbenchmarks of the building blocks of the dense image registration
+* solver (quad warping coefficients, quad warping, bilinear interpolation, grid
+* warping, Eigen conversions and products), timed separately across template
+* sizes, float/double precision and aligned/unaligned input buffers, and of
+* the 8x8 normal equation solves (one at a time, as in the Gauss-Newton step,
+* or batched, as in lockstep registration).
+* Throughputs (GB/s, GFLOP/s) are derived from analytic per-pixel byte and
+* flop counts of each kernel, not from hardware counters.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <limits>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "batched_spd_solver.hpp"
+#include "im_processing_utils.hpp"
+#include "synthetic_workload.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+
+// results of the benchmarked kernels are accumulated here so that the
+// compiler cannot optimize the calls away
+static volatile double g_checksum_sink = 0.;
+
+struct MicrobenchConfig
+{
+    uint32_t    m_nb_reps = 7;                // best-of repetitions
+    uint64_t    m_pixels_per_rep = 1 << 22;   // work per repetition
+    std::string m_csv_path;
+};
+
+struct MicrobenchResult
+{
+    std::string m_kernel;
+    std::string m_precision;
+    uint32_t    m_template_width;
+    uint32_t    m_template_height;
+    bool        m_aligned;
+    double      m_ns_per_pixel;
+    double      m_gb_per_s;
+    double      m_gflop_per_s;
+};
+
+/*
+* Buffer of n elements whose first element is either 64-byte aligned, or
+* deliberately misaligned by one element.
+*/
+template <typename FloatPrec>
+struct BenchBuffer
+{
+public:
+    void allocate(size_t n, bool i_aligned) {
+        const size_t pad = 64 / sizeof(FloatPrec) + 1;
+        m_storage.assign(n + pad, 0.);
+        uintptr_t addr = (uintptr_t)&(m_storage[0]);
+        addr = (addr + 63) & ~(uintptr_t)63;
+        m_ptr = (FloatPrec *)addr + (i_aligned ? 0 : 1);
+    }
+    inline FloatPrec * data() { return m_ptr; }
+    inline const FloatPrec * data() const { return m_ptr; }
+private:
+    std::vector<FloatPrec> m_storage;
+    FloatPrec *            m_ptr = nullptr;
+};
+
+/*
+* Time i_kernel (which processes i_nb_pixels per call) as the best, over
+* several repetitions, of the mean time per call, and fill in the throughputs.
+* Per-pixel memory traffic and flops are given by the caller.
+*/
+template <typename KernelFunc>
+void
+time_kernel(
+        const MicrobenchConfig & i_config,
+        uint32_t                 i_nb_pixels,
+        double                   i_bytes_per_pixel,
+        double                   i_flops_per_pixel,
+        KernelFunc               i_kernel,
+        MicrobenchResult &       io_result)
+{
+    const uint64_t nb_calls = std::max((uint64_t)1, i_config.m_pixels_per_rep / i_nb_pixels);
+    double checksum = i_kernel(); // warm-up (caches, page faults)
+    double best_call_s = std::numeric_limits<double>::max();
+    for (uint32_t i_rep = 0; i_rep<i_config.m_nb_reps; ++i_rep) {
+        Common::Timer timer;
+        for (uint64_t i_call = 0; i_call<nb_calls; ++i_call) {
+            checksum += i_kernel();
+        }
+        best_call_s = std::min(best_call_s, timer.elapsed_s() / nb_calls);
+    }
+    g_checksum_sink = g_checksum_sink + checksum;
+
+    io_result.m_ns_per_pixel = 1.e9 * best_call_s / i_nb_pixels;
+    io_result.m_gb_per_s = i_bytes_per_pixel * i_nb_pixels / best_call_s * 1.e-9;
+    io_result.m_gflop_per_s = i_flops_per_pixel * i_nb_pixels / best_call_s * 1.e-9;
+}
+
+/*
+* Benchmark all the kernels for one template size, precision and alignment
+*/
+template <typename FloatPrec>
+void
+benchmark_kernels(
+        const MicrobenchConfig &              i_config,
+        const std::string &                   i_precision_name,
+        const cimg_library::CImg<FloatPrec> & i_image,
+        uint32_t                              i_template_width,
+        uint32_t                              i_template_height,
+        bool                                  i_aligned,
+        std::vector<MicrobenchResult> &       io_results)
+{
+    typedef DenseImageRegistrationSolver<FloatPrec> Solver;
+    typedef typename Solver::MatrixN4 MatrixN4;
+    typedef typename Solver::MatrixN2 MatrixN2;
+    typedef typename Solver::Matrix42 Matrix42;
+    typedef typename Solver::VecN     VecN;
+    typedef Eigen::Map<const MatrixN4, Eigen::Unaligned> MatrixN4_UMap;
+    typedef Eigen::Map<const MatrixN4, Eigen::Aligned16> MatrixN4_AMap;
+    typedef Eigen::Map<const MatrixN2, Eigen::Unaligned> MatrixN2_UMap;
+    typedef Eigen::Map<const MatrixN2, Eigen::Aligned16> MatrixN2_AMap;
+
+    const uint32_t N = i_template_width * i_template_height;
+    const double fsz = sizeof(FloatPrec);
+
+    // quad well inside the image, so that unclamped interpolation is valid
+    const FloatPrec w = i_image.width();
+    const FloatPrec h = i_image.height();
+    const FloatPrec pts[] = {
+            0.20f*w, 0.15f*h, 0.80f*w, 0.20f*h, 0.75f*w, 0.85f*h, 0.25f*w, 0.80f*h};
+    Matrix42 P;
+    for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+        P(i_pt, 0) = pts[2*i_pt + 0];
+        P(i_pt, 1) = pts[2*i_pt + 1];
+    }
+
+    BenchBuffer<FloatPrec> W_buf;
+    BenchBuffer<FloatPrec> grid_buf;
+    BenchBuffer<FloatPrec> vals_buf;
+    W_buf.allocate((size_t)N * 4, i_aligned);
+    grid_buf.allocate((size_t)N * 2, i_aligned);
+    vals_buf.allocate(N, i_aligned);
+    FloatPrec * W = W_buf.data();
+    FloatPrec * grid = grid_buf.data();
+    FloatPrec * vals = vals_buf.data();
+    Common::generate_quad_warping_coeffs(i_template_width, i_template_height, W);
+    Common::apply_quad_warping(W, pts, N, grid);
+
+    MatrixN4 W_eigen(N, 4);
+    MatrixN2 grid_eigen(N, 2);
+    VecN vals_eigen(N);
+
+    MicrobenchResult result;
+    result.m_precision = i_precision_name;
+    result.m_template_width = i_template_width;
+    result.m_template_height = i_template_height;
+    result.m_aligned = i_aligned;
+
+    // W coefficients: 4 stores, 2 subs + 8 muls per pixel
+    result.m_kernel = "generate_quad_warping_coeffs";
+    time_kernel(i_config, N, 4*fsz, 10., [&]() {
+        Common::generate_quad_warping_coeffs(i_template_width, i_template_height, W);
+        return (double)W[N*4 - 1];
+    }, result);
+    io_results.push_back(result);
+
+    // quad warping: 4 loads, 2 stores, 8 muls + 6 adds per pixel
+    result.m_kernel = "apply_quad_warping";
+    time_kernel(i_config, N, 6*fsz, 14., [&]() {
+        Common::apply_quad_warping(W, pts, N, grid);
+        return (double)grid[N*2 - 1];
+    }, result);
+    io_results.push_back(result);
+
+    // bilinear interpolation: 2 coordinate loads, 4 pixel loads, 1 store,
+    // 4 subs + 8 muls + 3 adds per pixel
+    result.m_kernel = "bilinear_pix_interp";
+    time_kernel(i_config, N, 7*fsz, 15., [&]() {
+        for (uint32_t i_pix = 0; i_pix<N; ++i_pix) {
+            vals[i_pix] = Common::bilinear_pix_interp(
+                    i_image, grid[2*i_pix + 0], grid[2*i_pix + 1]);
+        }
+        return (double)vals[N - 1];
+    }, result);
+    io_results.push_back(result);
+
+    // clamped interpolation: same traffic, 4 min/max + 2 subs + 6 muls + 3 adds
+    result.m_kernel = "bilinear_pix_interp_clamped";
+    time_kernel(i_config, N, 7*fsz, 15., [&]() {
+        for (uint32_t i_pix = 0; i_pix<N; ++i_pix) {
+            vals[i_pix] = Common::bilinear_pix_interp_clamped(
+                    i_image, grid[2*i_pix + 0], grid[2*i_pix + 1]);
+        }
+        return (double)vals[N - 1];
+    }, result);
+    io_results.push_back(result);
+
+    // grid warping on an Eigen map of the grid buffer
+    result.m_kernel = "warp_grid";
+    time_kernel(i_config, N, 7*fsz, 15., [&]() {
+        if (i_aligned) {
+            warp_grid<FloatPrec>(i_image, MatrixN2_AMap(grid, N, 2), vals_eigen);
+        } else {
+            warp_grid<FloatPrec>(i_image, MatrixN2_UMap(grid, N, 2), vals_eigen);
+        }
+        return (double)vals_eigen(N - 1);
+    }, result);
+    io_results.push_back(result);
+
+    // conversion of the W coefficients to Eigen: 4 loads, 4 stores per pixel
+    result.m_kernel = "eigen_quad_warping_fromptr";
+    time_kernel(i_config, N, 8*fsz, 0., [&]() {
+        eigen_quad_warping_fromptr<FloatPrec>(W, N, W_eigen);
+        return (double)W_eigen(N - 1, 3);
+    }, result);
+    io_results.push_back(result);
+
+    // Eigen quad warping (N x 4 by 4 x 2 product): 4 loads, 2 stores,
+    // 8 muls + 6 adds per pixel
+    result.m_kernel = "eigen_warp_product";
+    time_kernel(i_config, N, 6*fsz, 14., [&]() {
+        if (i_aligned) {
+            grid_eigen.noalias() = MatrixN4_AMap(W, N, 4) * P;
+        } else {
+            grid_eigen.noalias() = MatrixN4_UMap(W, N, 4) * P;
+        }
+        return (double)grid_eigen(N - 1, 1);
+    }, result);
+    io_results.push_back(result);
+}
+
+/*
+* Benchmark the solve of i_nb_systems 8x8 normal equations, one at a time with
+* a dynamic-size LDLT (as 'gauss_newton_descent_step') and batched (see
+* batched_spd_solver.hpp). Results are given per system (reported as
+* i_nb_systems x 1 "pixels"): 44 loads + 8 stores, about 300 flops
+* (factorization n^3/3 + 2 n^2 for the substitutions).
+*/
+template <typename FloatPrec>
+void
+benchmark_normal_solvers(
+        const MicrobenchConfig &              i_config,
+        const std::string &                   i_precision_name,
+        uint32_t                              i_nb_systems,
+        std::vector<MicrobenchResult> &       io_results)
+{
+    typedef Eigen::Matrix<FloatPrec, Eigen::Dynamic, Eigen::Dynamic> MatrixNN;
+    typedef Eigen::Matrix<FloatPrec, 1, Eigen::Dynamic> VecN;
+    const double fsz = sizeof(FloatPrec);
+
+    // well-conditioned SPD systems: J^T J of random 64 x 8 jacobians
+    std::vector<MatrixNN> As(i_nb_systems);
+    std::vector<VecN> bs(i_nb_systems);
+    for (uint32_t i_sys = 0; i_sys<i_nb_systems; ++i_sys) {
+        const MatrixNN J = MatrixNN::Random(64, 8);
+        As[i_sys] = J.transpose() * J;
+        bs[i_sys] = VecN::Random(8);
+    }
+    VecN x(8);
+    Common::BatchedSpdSolver<FloatPrec, 8> batched_solver;
+    batched_solver.resize(i_nb_systems);
+
+    MicrobenchResult result;
+    result.m_precision = i_precision_name;
+    result.m_template_width = i_nb_systems;
+    result.m_template_height = 1;
+    result.m_aligned = false;
+
+    result.m_kernel = "normal_solve_8x8_ldlt";
+    time_kernel(i_config, i_nb_systems, 52*fsz, 300., [&]() {
+        double sum = 0.;
+        for (uint32_t i_sys = 0; i_sys<i_nb_systems; ++i_sys) {
+            x = (As[i_sys].ldlt().solve(bs[i_sys].transpose())).transpose();
+            sum += x(7);
+        }
+        return sum;
+    }, result);
+    io_results.push_back(result);
+
+    result.m_kernel = "normal_solve_8x8_batched";
+    time_kernel(i_config, i_nb_systems, 52*fsz, 300., [&]() {
+        for (uint32_t i_sys = 0; i_sys<i_nb_systems; ++i_sys) {
+            batched_solver.set_system(i_sys, As[i_sys], bs[i_sys]);
+        }
+        batched_solver.solve();
+        double sum = 0.;
+        for (uint32_t i_sys = 0; i_sys<i_nb_systems; ++i_sys) {
+            batched_solver.get_solution(i_sys, x);
+            sum += x(7);
+        }
+        return sum;
+    }, result);
+    io_results.push_back(result);
+}
+
+void
+print_results(
+        const std::vector<MicrobenchResult> & i_results)
+{
+    for (uint32_t i_r = 0; i_r<i_results.size(); ++i_r) {
+        const MicrobenchResult & res = i_results[i_r];
+        std::cout << res.m_kernel
+            << " | " << res.m_precision
+            << " | " << res.m_template_width << "x" << res.m_template_height
+            << " | " << (res.m_aligned ? "aligned" : "unaligned")
+            << " | " << res.m_ns_per_pixel << " ns/pixel"
+            << " | " << res.m_gb_per_s << " GB/s"
+            << " | " << res.m_gflop_per_s << " GFLOP/s"
+            << "\n";
+    }
+}
+
+Common::ErrCode
+write_results_csv(
+        const std::string &                   i_csv_path,
+        const std::vector<MicrobenchResult> & i_results)
+{
+    std::ofstream csv_file(i_csv_path.c_str());
+    if (!csv_file.is_open()) {
+        return Common::IOCantOpenFile;
+    }
+    csv_file << "kernel,precision,template_width,template_height,aligned,"
+        "ns_per_pixel,gb_per_s,gflop_per_s\n";
+    for (uint32_t i_r = 0; i_r<i_results.size(); ++i_r) {
+        const MicrobenchResult & res = i_results[i_r];
+        csv_file << res.m_kernel << "," << res.m_precision << ","
+            << res.m_template_width << "," << res.m_template_height << ","
+            << (res.m_aligned ? 1 : 0) << "," << res.m_ns_per_pixel << ","
+            << res.m_gb_per_s << "," << res.m_gflop_per_s << "\n";
+    }
+    return Common::NoError;
+}
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./microbench_dense_im_reg_cpu_kernels "
+        "[--reps N] [--pixels N] [--csv output.csv]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration kernels microbenchmark (CPU) ..." << "\n" ;
+
+    MicrobenchConfig config;
+    for (int arg_ind = 1; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--reps") && has_value) {
+            config.m_nb_reps = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--pixels") && has_value) {
+            config.m_pixels_per_rep = Common::str2val<uint64_t>(argv[++arg_ind]);
+        } else if ((opt == "--csv") && has_value) {
+            config.m_csv_path = argv[++arg_ind];
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    // interpolated image: synthetic texture, normalized as in the solver
+    cimg_library::CImg<unsigned char> texture;
+    Common::generate_synthetic_texture(640, 480, 0, texture);
+    cimg_library::CImg<float> image_f(texture);
+    image_f /= 255.f;
+    cimg_library::CImg<double> image_d(texture);
+    image_d /= 255.;
+
+    const uint32_t template_dims[][2] = {{64, 64}, {200, 300}, {512, 512}, {1024, 1024}};
+    const uint32_t nb_template_dims = sizeof(template_dims) / sizeof(template_dims[0]);
+    std::vector<MicrobenchResult> results;
+    for (uint32_t i_dim = 0; i_dim<nb_template_dims; ++i_dim) {
+        for (uint32_t i_align = 0; i_align<2; ++i_align) {
+            const bool aligned = (i_align == 0);
+            benchmark_kernels<float>(config, "float", image_f,
+                    template_dims[i_dim][0], template_dims[i_dim][1], aligned, results);
+            benchmark_kernels<double>(config, "double", image_d,
+                    template_dims[i_dim][0], template_dims[i_dim][1], aligned, results);
+        }
+    }
+    const uint32_t nb_systems[] = {8, 64};
+    for (uint32_t i_n = 0; i_n<sizeof(nb_systems) / sizeof(nb_systems[0]); ++i_n) {
+        benchmark_normal_solvers<float>(config, "float", nb_systems[i_n], results);
+        benchmark_normal_solvers<double>(config, "double", nb_systems[i_n], results);
+    }
+    print_results(results);
+
+    if (!config.m_csv_path.empty()) {
+        const Common::ErrCode errCode = write_results_csv(config.m_csv_path, results);
+        if (errCode != Common::NoError) {
+            std::cerr << "Error writing " << config.m_csv_path << " (error " << errCode << ").\n";
+            exit(-1);
+        }
+    }
+
+    std::cout << "checksum: " << g_checksum_sink << "\n";
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
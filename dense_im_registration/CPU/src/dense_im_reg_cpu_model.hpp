@@ -0,0 +1,169 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _DENSE_IM_REG_CPU_MODEL_HPP
+#define _DENSE_IM_REG_CPU_MODEL_HPP
+
+#include <memory>
+#include <vector>
+
+#include "dense_im_reg_cpu_common.hpp"
+
+
+/*
+* Template model of the dense image registration: the multi-resolution
+* template (level templates, their gradients, and the quad warping
+* coefficients of the level template grids).
+* A model is built once ('init', then 'set_template'), then shared read-only
+* (std::shared_ptr<const DenseImageRegistrationModel>) by any number of
+* solver workspaces (see dense_im_reg_cpu_workspace.hpp), possibly registering
+* images concurrently on several threads: all the const member functions are
+* thread safe.
+*/
+template <typename FloatPrec>
+struct DenseImageRegistrationModel
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+public: // public typedefs
+    typedef DenseImageRegistrationTypes<FloatPrec> Types;
+    typedef typename Types::MatrixN4       MatrixN4;
+    typedef typename Types::VecN           VecN;
+    typedef typename Types::Matrix42       Matrix42;
+    typedef typename Types::ImDim          ImDim;
+    typedef typename Types::LvlList_Images LvlList_Images;
+public:
+    DenseImageRegistrationModel() {}
+    ~DenseImageRegistrationModel() {}
+public:
+    /*
+    * initialize the model geometry: template dimensions and resolution
+    * pyramid. This precomputes the quad warping coefficients of each level.
+    */
+    Common::ErrCode
+    init(
+            const uint32_t  template_width,
+            const uint32_t  template_height,
+            const uint32_t  nb_levels,
+            const FloatPrec lvl_resz_ratio);
+
+    /*
+    * record the template to be registered in images
+    * i_normz_factor is a normalization factor to map image values to a favorable
+    * floating point range (typically [0., 1.]
+    * Only the bounding box of the annotated quad is converted and downsampled
+    * (successively, level by level) to build the reference pyramid, in which
+    * the level template grids are then sampled.
+    */
+    Common::ErrCode
+    set_template(
+            const Common::ImView<unsigned char> & i_ref_image,
+            const std::vector<FloatPrec> &        i_annot_pts,
+            FloatPrec                             i_normz_factor = 1./255.);
+
+    /*
+    * resample the level templates (and their gradients) inside the quad i_pts
+    * (full resolution coordinates) from an image pyramid built over i_roi
+    * with 'build_image_pyramid' (e.g. the pyramid of a registered image).
+    */
+    void
+    set_template_from_pyramid(
+            const LvlList_Images & i_pyr,
+            const Common::ImRoi &  i_roi,
+            const FloatPrec *      i_pts);
+
+    /*
+    * build a float image pyramid over the region i_roi of the input image,
+    * with the geometry and normalization of the model: level 0 is the
+    * normalized roi, each next level is downsampled from the previous one with
+    * a box prefilter. io_downsampler holds the caller's scratch buffers.
+    */
+    void
+    build_image_pyramid(
+            const Common::ImView<unsigned char> &   i_image,
+            const Common::ImRoi &                   i_roi,
+            Common::BoxDownsampler<FloatPrec> &     io_downsampler,
+            LvlList_Images &                        o_pyr) const;
+
+    /*
+    * same as above, from an RGB image (planar or interleaved): the roi is
+    * converted to luma straight into level 0 (see color_conversion_utils.hpp),
+    * and each level 0 row is pushed to the level 1 downsampling as soon as it
+    * is converted, in the same pass.
+    */
+    void
+    build_image_pyramid(
+            const Common::RgbImView &               i_image,
+            const Common::ImRoi &                   i_roi,
+            Common::BoxDownsampler<FloatPrec> &     io_downsampler,
+            LvlList_Images &                        o_pyr) const;
+
+    /*
+    * get the level templates as images (mainly for debug purposes)
+    */
+    Common::ErrCode
+    get_template_image(
+            std::vector<cimg_library::CImg<unsigned char> > & o_lvl_templims) const;
+
+public: // read-only accessors
+    inline bool is_init() const {return m_is_init;}
+    inline bool template_is_set() const {return m_template_is_set;}
+    inline uint32_t nb_levels() const {return m_nb_levels;}
+    inline FloatPrec lvl_resz_ratio() const {return m_lvl_resz_ratio;}
+    inline FloatPrec normz_factor() const {return m_normz_factor;}
+    inline FloatPrec lvl_abs_resz_ratio(uint32_t i_lvl) const {
+        return m_lvl_abs_resz_ratio[i_lvl];
+    }
+    inline const ImDim & lvl_templdim(uint32_t i_lvl) const {
+        return m_lvl_templdims[i_lvl];
+    }
+    inline const VecN & lvl_template(uint32_t i_lvl) const {
+        return m_lvl_templates[i_lvl];
+    }
+    inline const VecN & lvl_templ_gradu(uint32_t i_lvl) const {
+        return m_lvl_templ_gradu[i_lvl];
+    }
+    inline const VecN & lvl_templ_gradv(uint32_t i_lvl) const {
+        return m_lvl_templ_gradv[i_lvl];
+    }
+    inline const MatrixN4 & lvl_W(uint32_t i_lvl) const {
+        return m_lvl_Ws_eigen[i_lvl];
+    }
+    /*
+    * total number of template pixels over all the levels
+    */
+    inline uint32_t nb_mr_pixels() const {
+        uint32_t nb_pix = 0;
+        for (uint32_t i_lvl = 0; i_lvl<m_nb_levels; ++i_lvl) {
+            nb_pix += m_lvl_templdims[i_lvl].size();
+        }
+        return nb_pix;
+    }
+
+private: // private typedefs
+    typedef typename Types::LvlList_ImDim LvlList_ImDim;
+    typedef typename Types::LvlList_Ratio LvlList_Ratio;
+    typedef typename Types::LvlList_VecN  LvlList_VecN;
+    typedef typename Types::LvlList_MatN4 LvlList_MatN4;
+private:
+    bool           m_is_init = false;
+    bool           m_template_is_set = false;
+    uint32_t       m_nb_levels = 3;
+    FloatPrec      m_lvl_resz_ratio = 0.5;
+    FloatPrec      m_normz_factor = 1./255.;
+    ImDim          m_ref_imdim;
+    LvlList_Ratio  m_lvl_abs_resz_ratio;
+    LvlList_ImDim  m_lvl_templdims;
+    LvlList_VecN   m_lvl_templates;
+    LvlList_VecN   m_lvl_templ_gradu; // template gradients along the template
+    LvlList_VecN   m_lvl_templ_gradv; // grid axes (for ESM updates)
+    LvlList_MatN4  m_lvl_Ws_eigen;
+};
+
+#include "dense_im_reg_cpu_model.inl.hpp"
+
+#endif /* _DENSE_IM_REG_CPU_MODEL_HPP *  * */
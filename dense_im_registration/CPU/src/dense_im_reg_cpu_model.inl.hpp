@@ -0,0 +1,228 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Template member functions definition for dense_im_reg_cpu_model.hpp
+*/
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationModel<FloatPrec>::init(
+        const uint32_t  template_width,
+        const uint32_t  template_height,
+        const uint32_t  nb_levels,
+        const FloatPrec lvl_resz_ratio)
+{
+    Common::ErrCode errCode = Common::NoError;
+    if (nb_levels == 0) {
+        return Common::InvalidTemplateDimension;
+    }
+
+    // compute resolution pyramid templates resolutions
+    m_nb_levels = nb_levels;
+    m_lvl_resz_ratio = lvl_resz_ratio;
+    m_lvl_abs_resz_ratio.resize(nb_levels);
+    m_lvl_templdims.resize(nb_levels);
+    m_lvl_templates.resize(nb_levels);
+    m_lvl_templ_gradu.resize(nb_levels);
+    m_lvl_templ_gradv.resize(nb_levels);
+    m_lvl_Ws_eigen.resize(nb_levels);
+    std::vector<FloatPrec> lvl_W;
+
+    float this_lvl_ratio = 1.0;
+    for (uint32_t i_lvl = 0; i_lvl<nb_levels; ++i_lvl) {
+        // warning: silent floor() due to float->int casting
+        const uint32_t lvl_template_width = template_width * this_lvl_ratio;
+        const uint32_t lvl_template_height = template_height * this_lvl_ratio;
+
+        m_lvl_templates[i_lvl].resize(lvl_template_width * lvl_template_height);
+        m_lvl_templdims[i_lvl].set_dim(lvl_template_width, lvl_template_height);
+
+        errCode = Common::generate_quad_warping_coeffs(
+                lvl_template_width, lvl_template_height, lvl_W);
+        if (errCode != Common::NoError) { return errCode; }
+        errCode = eigen_quad_warping_fromstd<FloatPrec>(lvl_W, m_lvl_Ws_eigen[i_lvl]);
+        if (errCode != Common::NoError) { return errCode; }
+
+        m_lvl_abs_resz_ratio[i_lvl] = this_lvl_ratio;
+
+        // ratio for next level:
+        this_lvl_ratio *= lvl_resz_ratio;
+    }
+
+    m_template_is_set = false;
+    m_is_init = true;
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationModel<FloatPrec>::set_template(
+        const Common::ImView<unsigned char> &     i_ref_image,
+        const std::vector<FloatPrec> &            i_annot_pts,
+        FloatPrec                                 i_normz_factor)
+{
+    if (!m_is_init) {
+        return Common::SolverNotInitialized;
+    }
+    if ((i_ref_image.width() < 2) || (i_ref_image.height() < 2)) {
+        return Common::UnsupportedImageFormat;
+    }
+
+    m_normz_factor = i_normz_factor;
+    m_ref_imdim = ImDim(i_ref_image.width(), i_ref_image.height());
+
+    // the reference pyramid only has to cover the annotated quad, plus the
+    // footprint of the successive downsampling filters and of the final
+    // interpolation (in full resolution pixels).
+    FloatPrec margin = 1.;
+    for (uint32_t i_lvl = 1; i_lvl<m_nb_levels; ++i_lvl) {
+        const FloatPrec filter_radius =
+                0.5 * std::max((FloatPrec)1. / m_lvl_resz_ratio, (FloatPrec)1.) + 0.5;
+        margin += filter_radius / m_lvl_abs_resz_ratio[i_lvl - 1];
+    }
+    margin += 1. / m_lvl_abs_resz_ratio[m_nb_levels - 1];
+    const Common::ImRoi ref_roi = Common::quad_bounding_roi(
+            &(i_annot_pts[0]), margin, m_ref_imdim.width(), m_ref_imdim.height());
+
+    // the reference pyramid is only needed to sample the templates
+    LvlList_Images ref_im_pyr(m_nb_levels);
+    Common::BoxDownsampler<FloatPrec> downsampler;
+    build_image_pyramid(i_ref_image, ref_roi, downsampler, ref_im_pyr);
+    set_template_from_pyramid(ref_im_pyr, ref_roi, &(i_annot_pts[0]));
+
+    m_template_is_set = true;
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationModel<FloatPrec>::set_template_from_pyramid(
+        const LvlList_Images & i_pyr,
+        const Common::ImRoi &  i_roi,
+        const FloatPrec *      i_pts)
+{
+    typedef typename Eigen::Map<const Matrix42> Matrix42_CstMap;
+    Matrix42_CstMap pts_eigen(i_pts, 4, 2);
+    Matrix42 lvl_pts_eigen;
+    for (uint32_t i_lvl = 0; i_lvl<m_nb_levels; ++i_lvl)
+    {
+        // quad in level coordinates, relative to the level roi origin
+        const FloatPrec lvl_ratio = m_lvl_abs_resz_ratio[i_lvl];
+        lvl_pts_eigen = lvl_ratio * pts_eigen;
+        lvl_pts_eigen.col(0).array() -= lvl_ratio * (FloatPrec)i_roi.x0();
+        lvl_pts_eigen.col(1).array() -= lvl_ratio * (FloatPrec)i_roi.y0();
+
+        sample_quad_grid<FloatPrec>(
+                i_pyr[i_lvl],
+                lvl_pts_eigen,
+                m_lvl_templdims[i_lvl],
+                m_lvl_templates[i_lvl]);
+
+        // template gradients, needed by ESM updates
+        compute_template_gradients<FloatPrec>(
+                m_lvl_templates[i_lvl], m_lvl_templdims[i_lvl],
+                m_lvl_templ_gradu[i_lvl], m_lvl_templ_gradv[i_lvl]);
+    }
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationModel<FloatPrec>::get_template_image(
+        std::vector<cimg_library::CImg<unsigned char> > & o_lvl_templims) const
+{
+    if (!m_is_init) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_template_is_set) {
+        return Common::TemplateNotSet;
+    }
+
+    o_lvl_templims.resize(m_nb_levels);
+    cimg_library::CImg<FloatPrec> tmp_lvl_im;
+    for (uint32_t i_lvl = 0; i_lvl<m_nb_levels; ++i_lvl) {
+        const uint32_t lvl_templ_width = m_lvl_templdims[i_lvl].width();
+        const uint32_t lvl_templ_height = m_lvl_templdims[i_lvl].height();
+        const uint32_t nb_pix = lvl_templ_width * lvl_templ_height;
+        tmp_lvl_im.resize(lvl_templ_width, lvl_templ_height);
+        // CImg structure have no padding, so we can make a direct memory copy
+        // of the full image data from eigen to CImg
+        memcpy(tmp_lvl_im.data(),
+                &(m_lvl_templates[i_lvl](0)),
+                nb_pix*sizeof(FloatPrec));
+        tmp_lvl_im /= m_normz_factor;
+        o_lvl_templims[i_lvl] = tmp_lvl_im;
+    }
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationModel<FloatPrec>::build_image_pyramid(
+            const Common::ImView<unsigned char> & i_image,
+            const Common::ImRoi &                 i_roi,
+            Common::BoxDownsampler<FloatPrec> &   io_downsampler,
+            LvlList_Images &                      o_pyr) const
+{
+    // only the roi is converted to float: level 0 has an absolute resize ratio
+    // of 1, each coarser level is downsampled from the previous one so that a
+    // full resolution point p maps to ratio * (p - roi origin) in every level.
+    Common::crop_to_float(i_image, i_roi, m_normz_factor, o_pyr[0]);
+    for (uint32_t i_lvl = 1; i_lvl<m_nb_levels; ++i_lvl) {
+        const uint32_t lvl_roi_width = std::max(2u,
+                (uint32_t)(m_lvl_abs_resz_ratio[i_lvl] * i_roi.width()));
+        const uint32_t lvl_roi_height = std::max(2u,
+                (uint32_t)(m_lvl_abs_resz_ratio[i_lvl] * i_roi.height()));
+        io_downsampler.run(o_pyr[i_lvl - 1], m_lvl_resz_ratio,
+                lvl_roi_width, lvl_roi_height, o_pyr[i_lvl]);
+    }
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationModel<FloatPrec>::build_image_pyramid(
+            const Common::RgbImView &             i_image,
+            const Common::ImRoi &                 i_roi,
+            Common::BoxDownsampler<FloatPrec> &   io_downsampler,
+            LvlList_Images &                      o_pyr) const
+{
+    // same pyramid as from the luma image: level 0 rows are converted from
+    // RGB, and downsampled to level 1 while they are still in cache.
+    const uint32_t roi_width = i_roi.width();
+    const uint32_t roi_height = i_roi.height();
+    if ((o_pyr[0].width() != (int)roi_width) || (o_pyr[0].height() != (int)roi_height)) {
+        o_pyr[0].assign(roi_width, roi_height, 1, 1);
+    }
+    const bool fuse_lvl1 = (m_nb_levels > 1);
+    if (fuse_lvl1) {
+        io_downsampler.begin(roi_width, roi_height, m_lvl_resz_ratio,
+                std::max(2u, (uint32_t)(m_lvl_abs_resz_ratio[1] * roi_width)),
+                std::max(2u, (uint32_t)(m_lvl_abs_resz_ratio[1] * roi_height)),
+                o_pyr[1]);
+    }
+    for (uint32_t i_y = 0; i_y<roi_height; ++i_y) {
+        FloatPrec * lvl0_row = o_pyr[0].data() + (size_t)i_y * roi_width;
+        Common::rgb_row_to_luma(i_image, i_roi.y0() + i_y, i_roi.x0(), roi_width,
+                m_normz_factor, lvl0_row);
+        if (fuse_lvl1) {
+            io_downsampler.push_row(lvl0_row);
+        }
+    }
+    for (uint32_t i_lvl = 2; i_lvl<m_nb_levels; ++i_lvl) {
+        const uint32_t lvl_roi_width = std::max(2u,
+                (uint32_t)(m_lvl_abs_resz_ratio[i_lvl] * i_roi.width()));
+        const uint32_t lvl_roi_height = std::max(2u,
+                (uint32_t)(m_lvl_abs_resz_ratio[i_lvl] * i_roi.height()));
+        io_downsampler.run(o_pyr[i_lvl - 1], m_lvl_resz_ratio,
+                lvl_roi_width, lvl_roi_height, o_pyr[i_lvl]);
+    }
+}
@@ -0,0 +1,126 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Convert a sequence of images (PNG or any format CImg can decode) to a raw
+* frame file (see raw_frame_container.hpp), so that benchmarks and replays do
+* not pay for image decoding.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "im_processing_utils.hpp"
+#include "raw_frame_container.hpp"
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./convert_png_to_raw_frames "
+        "output.raw [--rgb] frame_0.png [frame_1.png ...]"
+        << "\n";
+    std::cout << "frames are stored as grayscale (luma), or as planar RGB with --rgb."
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "raw frame file conversion ..." << "\n" ;
+
+    if (argc < 3) {
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    const std::string output_path(argv[1]);
+    Common::RawFrameFormat format = Common::RawFrameGray8;
+    std::vector<std::string> frame_paths;
+    for (int arg_ind = 2; arg_ind<argc; ++arg_ind) {
+        const std::string arg(argv[arg_ind]);
+        if (arg == "--rgb") {
+            format = Common::RawFrameRGB8Planar;
+        } else {
+            frame_paths.push_back(arg);
+        }
+    }
+    if (frame_paths.empty()) {
+        std::cerr << "Error: no input frames.\n";
+        print_usage();
+        exit(-1);
+    }
+
+    Common::RawFrameWriter writer;
+    Common::ErrCode errCode = Common::NoError;
+    cimg_library::CImg<unsigned char> frame_im;
+    cimg_library::CImg<unsigned char> frame_im_conv;
+    for (uint32_t i_f = 0; i_f<frame_paths.size(); ++i_f) {
+        frame_im.assign(frame_paths[i_f].c_str());
+
+        // planes to store: luma only, or RGB (grayscale frames are replicated)
+        if (format == Common::RawFrameGray8) {
+            errCode = Common::convert_to_gray(frame_im, frame_im_conv);
+        } else if (frame_im.spectrum() == 3) {
+            frame_im_conv = frame_im;
+        } else if (frame_im.spectrum() == 1) {
+            frame_im_conv.assign(frame_im.width(), frame_im.height(), 1, 3);
+            frame_im_conv.draw_image(0, 0, 0, 0, frame_im);
+            frame_im_conv.draw_image(0, 0, 0, 1, frame_im);
+            frame_im_conv.draw_image(0, 0, 0, 2, frame_im);
+        } else {
+            errCode = Common::UnsupportedImageFormat;
+        }
+        if (errCode != Common::NoError) {
+            std::cerr << "Error converting " << frame_paths[i_f] << " (error " << errCode << ").\n";
+            exit(-1);
+        }
+
+        if (i_f == 0) {
+            errCode = writer.open(output_path,
+                    frame_im_conv.width(), frame_im_conv.height(), format);
+            if (errCode != Common::NoError) {
+                std::cerr << "Error creating " << output_path << " (error " << errCode << ").\n";
+                exit(-1);
+            }
+        }
+
+        // CImg stores channels as unpadded planes
+        Common::ImView<uint8_t> channels[3];
+        const size_t plane_size = (size_t)frame_im_conv.width() * frame_im_conv.height();
+        for (int32_t i_c = 0; i_c<frame_im_conv.spectrum(); ++i_c) {
+            channels[i_c] = Common::ImView<uint8_t>(frame_im_conv.data() + i_c * plane_size,
+                    frame_im_conv.width(), frame_im_conv.height(), frame_im_conv.width());
+        }
+        errCode = writer.write_frame(channels);
+        if (errCode != Common::NoError) {
+            std::cerr << "Error writing " << frame_paths[i_f]
+                << " (error " << errCode << "): all frames must have the same dimensions.\n";
+            exit(-1);
+        }
+    }
+
+    errCode = writer.close();
+    if (errCode != Common::NoError) {
+        std::cerr << "Error finalizing " << output_path << " (error " << errCode << ").\n";
+        exit(-1);
+    }
+    std::cout << frame_paths.size() << " frames written to " << output_path << "\n";
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
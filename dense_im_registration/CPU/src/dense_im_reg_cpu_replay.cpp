@@ -0,0 +1,371 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Replay a recorded frame sequence (raw frame file, see
+* raw_frame_container.hpp) through the registration solver: the template is
+* set on the first frame from its annotation, then the quad is tracked from
+* frame to frame. Frames are memory-mapped views, so only the registration
+* itself is timed (no decoding, no copies). RGB frames are converted to luma
+* by the solver while it builds its pyramid (over the registration roi only).
+* With --deadline-us, each frame is registered within a hard time slot
+* (deadline-bounded coarse to fine registration) and the number of frames
+* that converged, ran out of iterations or were cut short is reported.
+* With --jacobian-reuse (not with --deadline-us), the sequence is replayed
+* twice, computing the jacobian at every iteration and then reusing it
+* (quasi-Newton mode), to report the jacobian recompute rate, the wall time
+* saved and the deviation of the tracked quads.
+* With --loss-check, registrations whose coarse level alignment shows the
+* track is lost are aborted before the full resolution level (the quad is
+* kept for the next frame), and the number of lost frames and their cost are
+* reported.
+*/
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "raw_frame_container.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+
+#define FLOATPREC float
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./replay_dense_im_reg_cpu_raw "
+        "1_frames.raw "
+        "2_first_frame_annot_info "
+        "[--iterations N] [--no-roi] [--no-preload] [--deadline-us us] [--jacobian-reuse px] [--loss-check min_ncc] [--output reg_pts.txt]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* RGB view on a frame of an RGB (planar) raw frame file
+*/
+Common::RgbImView
+rgb_frame_view(
+        const Common::RawFrameReader & i_frames,
+        uint64_t                       i_frame)
+{
+    return Common::rgb_view_planar(
+            i_frames.frame_view(i_frame, 0).data(),
+            i_frames.frame_view(i_frame, 1).data(),
+            i_frames.frame_view(i_frame, 2).data(),
+            i_frames.width(), i_frames.height(), i_frames.stride());
+}
+
+
+typedef DenseImageRegistrationSolver<FLOATPREC> Solver;
+
+/*
+* Per-frame results of a replay
+*/
+struct ReplayResults
+{
+    std::vector<std::vector<FLOATPREC> > m_frame_pts;
+    std::vector<double>                  m_frame_times_us;
+    uint32_t                             m_nb_status_frames[3] = {0, 0, 0}; // per RegistrationStatus
+    uint32_t                             m_nb_full_res_frames = 0;
+    std::vector<uint64_t>                m_lost_frames;
+    double                               m_lost_time_us = 0.;
+};
+
+/*
+* Track the quad i_init_pts through frames 1 to N of the sequence
+* (i_deadline_us > 0: deadline-bounded registration)
+*/
+Common::ErrCode
+replay_sequence(
+        Solver &                       io_solver,
+        const Common::RawFrameReader & i_frames,
+        const std::vector<FLOATPREC> & i_init_pts,
+        uint32_t                       i_nb_iterations,
+        double                         i_deadline_us,
+        ReplayResults &                o_results)
+{
+    o_results = ReplayResults();
+    const bool rgb_frames = (i_frames.format() == Common::RawFrameRGB8Planar);
+    Common::ErrCode errCode = Common::NoError;
+    std::vector<FLOATPREC> reg_pts(i_init_pts);
+    for (uint64_t i_f = 1; i_f<i_frames.nb_frames(); ++i_f) {
+        const Common::ImView<uint8_t> frame = i_frames.frame_view(i_f);
+        const Common::RgbImView rgb_frame = rgb_frames ?
+                rgb_frame_view(i_frames, i_f) : Common::RgbImView();
+        Common::Timer reg_timer;
+        if (i_deadline_us > 0.) {
+            Solver::RegistrationStatus status;
+            errCode = rgb_frames ?
+                    io_solver.register_image_within(
+                        rgb_frame, i_deadline_us, i_nb_iterations, reg_pts, status) :
+                    io_solver.register_image_within(
+                        frame, i_deadline_us, i_nb_iterations, reg_pts, status);
+            if (errCode == Common::NoError) {
+                o_results.m_nb_status_frames[status]++;
+                o_results.m_nb_full_res_frames += (io_solver.last_finest_level() == 0) ? 1 : 0;
+            }
+        } else {
+            errCode = rgb_frames ?
+                    io_solver.register_image(rgb_frame, i_nb_iterations, reg_pts) :
+                    io_solver.register_image(frame, i_nb_iterations, reg_pts);
+        }
+        o_results.m_frame_times_us.push_back(reg_timer.elapsed_us());
+        if (errCode == Common::TrackingLost) {
+            // keep the last quad, the target may come back
+            o_results.m_lost_frames.push_back(i_f);
+            o_results.m_lost_time_us += o_results.m_frame_times_us.back();
+            errCode = Common::NoError;
+        }
+        if (errCode != Common::NoError) {
+            std::cerr << "Error in image registration of frame " << i_f
+                << " (error " << errCode << ").\n";
+            return errCode;
+        }
+        o_results.m_frame_pts.push_back(reg_pts);
+    }
+    return Common::NoError;
+}
+
+/*
+* print the frame time statistics of a replay, returns the total time
+*/
+double
+print_frame_times(
+        const std::vector<double> & i_frame_times_us)
+{
+    if (i_frame_times_us.empty()) {
+        return 0.;
+    }
+    std::vector<double> frame_times_us(i_frame_times_us);
+    double total_us = 0.;
+    for (uint32_t i_f = 0; i_f<frame_times_us.size(); ++i_f) {
+        total_us += frame_times_us[i_f];
+    }
+    std::sort(frame_times_us.begin(), frame_times_us.end());
+    std::cout << "registered frames: " << frame_times_us.size()
+        << " | mean: " << total_us / frame_times_us.size() << " us"
+        << " | median: " << frame_times_us[frame_times_us.size() / 2] << " us"
+        << " | min: " << frame_times_us.front() << " us"
+        << " | max: " << frame_times_us.back() << " us"
+        << " | throughput: " << 1.e6 * frame_times_us.size() / total_us << " frames/s"
+        << "\n";
+    return total_us;
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration replay (CPU) ..." << "\n" ;
+
+    //////////////////////////// ALGO PARAMETERS //////////////////////////////
+    const uint32_t template_width = 200;
+    const uint32_t template_height = 300;
+    const uint32_t nb_res_levels = 3;
+    const FLOATPREC lvl_resz_ratio = 0.5;
+    uint32_t register_nb_iterations = 5;
+    bool use_roi_mode = true;
+    const FLOATPREC roi_motion_margin = 32.;
+    ///////////////////////////////////////////////////////////////////////////
+
+    if (argc < 3) {
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    const std::string frames_path(argv[1]);
+    const std::string annot_info_path(argv[2]);
+    bool preload = true;
+    double deadline_us = 0.; // 0: no deadline
+    FLOATPREC jaco_reuse_dist = 0.; // 0: no jacobian reuse
+    FLOATPREC loss_min_ncc = -2.; // below -1: no tracking loss check
+    std::string output_path;
+    for (int arg_ind = 3; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--iterations") && has_value) {
+            register_nb_iterations = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if (opt == "--no-roi") {
+            use_roi_mode = false;
+        } else if (opt == "--no-preload") {
+            preload = false;
+        } else if ((opt == "--deadline-us") && has_value) {
+            deadline_us = Common::str2val<double>(argv[++arg_ind]);
+        } else if ((opt == "--jacobian-reuse") && has_value) {
+            jaco_reuse_dist = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--loss-check") && has_value) {
+            loss_min_ncc = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--output") && has_value) {
+            output_path = argv[++arg_ind];
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    if ((deadline_us > 0.) && (jaco_reuse_dist > 0.)) {
+        std::cerr << "Error: --deadline-us and --jacobian-reuse can't be combined.\n";
+        print_usage();
+        exit(-1);
+    }
+
+    Common::RawFrameReader frames;
+    Common::ErrCode curr_errCode = frames.open(frames_path);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error opening " << frames_path << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    if (frames.nb_frames() == 0) {
+        std::cerr << "Error: " << frames_path << " holds no frame.\n";
+        exit(-1);
+    }
+    const bool rgb_frames = (frames.format() == Common::RawFrameRGB8Planar);
+    std::cout << frames.nb_frames() << " " << (rgb_frames ? "RGB" : "grayscale")
+        << " frames of " << frames.width() << "x" << frames.height() << "\n";
+    if (preload) {
+        frames.preload();
+    }
+
+    std::vector<FLOATPREC> annot_pts;
+    curr_errCode = Common::parse_annot_info(annot_info_path, annot_pts);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error parsing annotation info (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+
+    Solver im_reg_solver;
+    curr_errCode = im_reg_solver.init(
+            template_width,
+            template_height,
+            nb_res_levels,
+            lvl_resz_ratio);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error in solver initialization (error " << curr_errCode << ")." << ".\n";
+        exit(-1);
+    }
+    im_reg_solver.set_roi_mode(use_roi_mode, roi_motion_margin);
+    if (loss_min_ncc >= -1.) {
+        im_reg_solver.set_tracking_loss_check(true, loss_min_ncc);
+    }
+
+    // the template is set (once, not timed) on the first frame
+    cimg_library::CImg<unsigned char> first_frame_luma;
+    Common::ImView<uint8_t> first_frame = frames.frame_view(0);
+    if (rgb_frames) {
+        Common::rgb_image_to_luma(rgb_frame_view(frames, 0), first_frame_luma);
+        first_frame = Common::im_view_from_cimg(first_frame_luma);
+    }
+    curr_errCode = im_reg_solver.set_template(first_frame, annot_pts);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error setting template (error " << curr_errCode << ")." << ".\n";
+        exit(-1);
+    }
+
+    // track the quad along the sequence (first with the jacobian computed at
+    // every iteration when comparing with jacobian reuse)
+    ReplayResults results;
+    curr_errCode = replay_sequence(im_reg_solver, frames, annot_pts,
+            register_nb_iterations, deadline_us, results);
+    if (curr_errCode != Common::NoError) {
+        exit(-1);
+    }
+    const double total_us = print_frame_times(results.m_frame_times_us);
+    if (deadline_us > 0.) {
+        std::cout << "deadline: " << deadline_us << " us"
+            << " | converged: " << results.m_nb_status_frames[0]
+            << " | iteration cap: " << results.m_nb_status_frames[1]
+            << " | cut short: " << results.m_nb_status_frames[2]
+            << " | solved at full resolution: " << results.m_nb_full_res_frames
+            << "\n";
+    }
+    if (loss_min_ncc >= -1.) {
+        const uint32_t nb_lost = results.m_lost_frames.size();
+        const uint32_t nb_tracked = results.m_frame_times_us.size() - nb_lost;
+        const double lost_mean_us = results.m_lost_time_us / std::max(1u, nb_lost);
+        const double tracked_mean_us = (total_us - results.m_lost_time_us)
+                / std::max(1u, nb_tracked);
+        std::cout << "tracking loss check (min NCC " << loss_min_ncc << "):"
+            << " lost frames: " << nb_lost
+            << " | mean time lost: " << lost_mean_us << " us"
+            << " | tracked: " << tracked_mean_us << " us";
+        if ((nb_lost > 0) && (nb_tracked > 0)) {
+            std::cout << " | estimated time saved: "
+                << nb_lost * (tracked_mean_us - lost_mean_us) << " us";
+        }
+        std::cout << "\n";
+        if (nb_lost > 0) {
+            std::cout << "lost:";
+            for (uint32_t i_l = 0; i_l<nb_lost; ++i_l) {
+                std::cout << " " << results.m_lost_frames[i_l];
+            }
+            std::cout << "\n";
+        }
+    }
+    if (jaco_reuse_dist > 0.) {
+        ReplayResults reuse_results;
+        im_reg_solver.set_jacobian_reuse(true, jaco_reuse_dist);
+        im_reg_solver.reset_jacobian_reuse_stats();
+        curr_errCode = replay_sequence(im_reg_solver, frames, annot_pts,
+                register_nb_iterations, deadline_us, reuse_results);
+        if (curr_errCode != Common::NoError) {
+            exit(-1);
+        }
+        std::cout << "jacobian reuse (max distance " << jaco_reuse_dist << " px):\n";
+        const double reuse_total_us = print_frame_times(reuse_results.m_frame_times_us);
+        const uint32_t nb_computations = im_reg_solver.nb_jacobian_computations();
+        const uint32_t nb_iterations = nb_computations + im_reg_solver.nb_jacobian_reuses();
+        double max_dev = 0.;
+        double mean_dev = 0.;
+        for (uint32_t i_f = 0; i_f<results.m_frame_pts.size(); ++i_f) {
+            for (uint32_t i_c = 0; i_c<8; ++i_c) {
+                const double dev = std::abs(reuse_results.m_frame_pts[i_f][i_c]
+                        - results.m_frame_pts[i_f][i_c]);
+                max_dev = std::max(max_dev, dev);
+                mean_dev += dev / (8. * results.m_frame_pts.size());
+            }
+        }
+        std::cout << "jacobian recompute rate: " << nb_computations << "/" << nb_iterations
+            << " (" << 100. * nb_computations / std::max(1u, nb_iterations) << " %)"
+            << " | rejected steps: " << im_reg_solver.nb_rejected_steps()
+            << " | wall time saved: " << total_us - reuse_total_us << " us ("
+            << 100. * (total_us - reuse_total_us) / std::max(total_us, 1.) << " %)"
+            << " | deviation from full recompute: " << mean_dev << " px (mean), "
+            << max_dev << " px (max)"
+            << "\n";
+        results = reuse_results;
+    }
+
+    if (!output_path.empty()) {
+        std::ofstream output_file(output_path.c_str());
+        for (uint32_t i_f = 0; i_f<results.m_frame_pts.size(); ++i_f) {
+            output_file << i_f + 1;
+            for (uint32_t i_c = 0; i_c<8; ++i_c) {
+                output_file << " " << results.m_frame_pts[i_f][i_c];
+            }
+            output_file << "\n";
+        }
+    }
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
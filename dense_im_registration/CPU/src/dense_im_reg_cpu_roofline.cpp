@@ -0,0 +1,658 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Scaling study of 'register_image' on a roofline: the template size (up to
+* MAX_TEMPLATE_DIMENSION), the number of levels, the level resize ratio, the
+* floating point type and the number of threads are swept, each stage of the
+* registration (registration pyramid build, pixel errors, jacobian, normal
+* equations, normal equation solve) is timed on a synthetic workload, and its
+* bytes moved and flops are counted analytically. The machine baselines are a
+* STREAM-like triad bandwidth and the peak flop rate of register-resident
+* multiply and add chains built with the same compiler flags, for each thread
+* count. Each stage is placed on the roofline of the threads it uses: its
+* arithmetic intensity (flops per byte accessed) gives the attainable flop
+* rate min(peak, intensity * bandwidth), and whether it is memory or compute
+* bound.
+* Byte counts are per access (every load and store of the kernel counted
+* once), an upper bound on the DRAM traffic: cache reuse (e.g. of the 4
+* neighbours of bilinear interpolations) makes the actual intensity higher.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "im_processing_utils.hpp"
+#include "synthetic_workload.hpp"
+#include "thread_utils.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+
+// results of the baseline kernels are accumulated here so that the compiler
+// cannot optimize them away
+static volatile double g_checksum_sink = 0.;
+
+struct RooflineConfig
+{
+    uint32_t               m_min_dim = 64;
+    uint32_t               m_max_dim = 1024; // square templates, doubling sizes
+    std::vector<uint32_t>  m_nb_levels = std::vector<uint32_t>({1, 3});
+    std::vector<double>    m_lvl_resz_ratios = std::vector<double>({0.5, 0.7});
+    uint32_t               m_max_nb_threads = 0; // 0: all hardware threads
+    uint32_t               m_nb_reps = 5;        // best-of repetitions
+    uint32_t               m_stream_mb = 64;     // size of each triad array
+    bool                   m_float = true;
+    bool                   m_double = true;
+    std::string            m_csv_path;
+};
+
+/*
+* Machine baselines for a thread count
+*/
+struct MachineBaseline
+{
+    uint32_t m_nb_threads = 1;
+    double   m_stream_gb_per_s = 0.;
+    double   m_peak_gflop_per_s[2] = {0., 0.}; // float, double
+};
+
+/*
+* Analytic cost of a registration stage, and the threads it runs on
+*/
+struct StageCost
+{
+    std::string m_stage;
+    double      m_bytes = 0.;
+    double      m_flops = 0.;
+    uint32_t    m_nb_threads = 1;
+};
+
+struct RooflineRow
+{
+    std::string m_precision;
+    uint32_t    m_template_width;
+    uint32_t    m_template_height;
+    uint32_t    m_nb_levels;
+    double      m_lvl_resz_ratio;
+    uint32_t    m_nb_threads;
+    StageCost   m_cost;
+    double      m_time_us;
+    double      m_stream_gb_per_s;
+    double      m_peak_gflop_per_s;
+};
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./roofline_dense_im_reg_cpu "
+        "[--min-dim N] [--max-dim N] [--levels 1,3] [--ratios 0.5,0.7] "
+        "[--max-threads N] [--precision float|double|both] [--reps N] "
+        "[--stream-mb N] [--csv output.csv]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* parse a comma separated list of values
+*/
+template <typename T>
+std::vector<T>
+parse_list(
+        const std::string & i_str)
+{
+    std::vector<T> vals;
+    std::istringstream iss(i_str);
+    for (std::string item; std::getline(iss, item, ',');) {
+        if (!item.empty()) {
+            vals.push_back(Common::str2val<T>(item));
+        }
+    }
+    return vals;
+}
+
+/*
+* STREAM-like triad (a = b + s * c, 24 bytes per element) over i_nb_elems
+* doubles split over i_nb_threads threads: best bandwidth over the repetitions
+*/
+double
+measure_stream_triad(
+        uint32_t i_nb_threads,
+        size_t   i_nb_elems,
+        uint32_t i_nb_reps)
+{
+    std::vector<double> a(i_nb_elems, 0.);
+    std::vector<double> b(i_nb_elems, 1.);
+    std::vector<double> c(i_nb_elems, 2.);
+    const double s = 3.;
+    const size_t chunk = (i_nb_elems + i_nb_threads - 1) / i_nb_threads;
+    double best_s = std::numeric_limits<double>::max();
+    for (uint32_t i_rep = 0; i_rep<i_nb_reps + 1; ++i_rep) {
+        Common::Timer timer;
+        std::vector<std::thread> workers;
+        for (uint32_t i_t = 0; i_t<i_nb_threads; ++i_t) {
+            const size_t begin = std::min(i_nb_elems, i_t * chunk);
+            const size_t end = std::min(i_nb_elems, begin + chunk);
+            workers.push_back(std::thread([&a, &b, &c, s, begin, end]() {
+                for (size_t i_e = begin; i_e<end; ++i_e) {
+                    a[i_e] = b[i_e] + s * c[i_e];
+                }
+            }));
+        }
+        for (uint32_t i_t = 0; i_t<workers.size(); ++i_t) {
+            workers[i_t].join();
+        }
+        if (i_rep > 0) { // first pass: page faults
+            best_s = std::min(best_s, timer.elapsed_s());
+        }
+    }
+    g_checksum_sink = g_checksum_sink + a[i_nb_elems / 2];
+    return 24. * i_nb_elems / best_s * 1.e-9;
+}
+
+/*
+* independent multiply and add chains held in registers (6 SIMD registers of
+* each), so that the multiply and add units are both kept busy without waiting
+* on latencies: 2 flops per accumulator pair and iteration. The factors are
+* read at run time (1 and 0, so that the values neither overflow nor become
+* denormal). Written with SSE2 intrinsics when available (compilers keep
+* accumulator arrays in memory), the scalar loop is the fallback.
+*/
+static volatile double g_peak_mul = 1.;
+static volatile double g_peak_add = 0.;
+static const uint32_t PEAK_NB_ACCS_BYTES = 96;
+
+template <typename FloatPrec>
+double
+peak_flops_kernel(
+        uint64_t i_nb_iterations)
+{
+    const uint32_t nb_accs = PEAK_NB_ACCS_BYTES / sizeof(FloatPrec);
+    FloatPrec mul_accs[nb_accs];
+    FloatPrec add_accs[nb_accs];
+    for (uint32_t i_a = 0; i_a<nb_accs; ++i_a) {
+        mul_accs[i_a] = 1. + 1.e-3 * i_a;
+        add_accs[i_a] = 1.e-3 * i_a;
+    }
+    const FloatPrec mul = g_peak_mul;
+    const FloatPrec add = g_peak_add;
+    for (uint64_t i_i = 0; i_i<i_nb_iterations; ++i_i) {
+        for (uint32_t i_a = 0; i_a<nb_accs; ++i_a) {
+            mul_accs[i_a] *= mul;
+            add_accs[i_a] += add;
+        }
+    }
+    double sum = 0.;
+    for (uint32_t i_a = 0; i_a<nb_accs; ++i_a) {
+        sum += mul_accs[i_a] + add_accs[i_a];
+    }
+    return sum;
+}
+
+#ifdef __SSE2__
+template <>
+double
+peak_flops_kernel<float>(
+        uint64_t i_nb_iterations)
+{
+    const __m128 mul = _mm_set1_ps((float)g_peak_mul);
+    const __m128 add = _mm_set1_ps((float)g_peak_add);
+    __m128 m0 = _mm_set1_ps(1.f), m1 = m0, m2 = m0, m3 = m0, m4 = m0, m5 = m0;
+    __m128 a0 = _mm_setzero_ps(), a1 = a0, a2 = a0, a3 = a0, a4 = a0, a5 = a0;
+    for (uint64_t i_i = 0; i_i<i_nb_iterations; ++i_i) {
+        m0 = _mm_mul_ps(m0, mul); a0 = _mm_add_ps(a0, add);
+        m1 = _mm_mul_ps(m1, mul); a1 = _mm_add_ps(a1, add);
+        m2 = _mm_mul_ps(m2, mul); a2 = _mm_add_ps(a2, add);
+        m3 = _mm_mul_ps(m3, mul); a3 = _mm_add_ps(a3, add);
+        m4 = _mm_mul_ps(m4, mul); a4 = _mm_add_ps(a4, add);
+        m5 = _mm_mul_ps(m5, mul); a5 = _mm_add_ps(a5, add);
+    }
+    const __m128 sum = _mm_add_ps(
+            _mm_add_ps(_mm_add_ps(m0, m1), _mm_add_ps(m2, m3)),
+            _mm_add_ps(_mm_add_ps(m4, m5), _mm_add_ps(
+                    _mm_add_ps(_mm_add_ps(a0, a1), _mm_add_ps(a2, a3)),
+                    _mm_add_ps(a4, a5))));
+    float sum_arr[4];
+    _mm_storeu_ps(sum_arr, sum);
+    return (double)sum_arr[0] + sum_arr[1] + sum_arr[2] + sum_arr[3];
+}
+
+template <>
+double
+peak_flops_kernel<double>(
+        uint64_t i_nb_iterations)
+{
+    const __m128d mul = _mm_set1_pd(g_peak_mul);
+    const __m128d add = _mm_set1_pd(g_peak_add);
+    __m128d m0 = _mm_set1_pd(1.), m1 = m0, m2 = m0, m3 = m0, m4 = m0, m5 = m0;
+    __m128d a0 = _mm_setzero_pd(), a1 = a0, a2 = a0, a3 = a0, a4 = a0, a5 = a0;
+    for (uint64_t i_i = 0; i_i<i_nb_iterations; ++i_i) {
+        m0 = _mm_mul_pd(m0, mul); a0 = _mm_add_pd(a0, add);
+        m1 = _mm_mul_pd(m1, mul); a1 = _mm_add_pd(a1, add);
+        m2 = _mm_mul_pd(m2, mul); a2 = _mm_add_pd(a2, add);
+        m3 = _mm_mul_pd(m3, mul); a3 = _mm_add_pd(a3, add);
+        m4 = _mm_mul_pd(m4, mul); a4 = _mm_add_pd(a4, add);
+        m5 = _mm_mul_pd(m5, mul); a5 = _mm_add_pd(a5, add);
+    }
+    const __m128d sum = _mm_add_pd(
+            _mm_add_pd(_mm_add_pd(m0, m1), _mm_add_pd(m2, m3)),
+            _mm_add_pd(_mm_add_pd(m4, m5), _mm_add_pd(
+                    _mm_add_pd(_mm_add_pd(a0, a1), _mm_add_pd(a2, a3)),
+                    _mm_add_pd(a4, a5))));
+    double sum_arr[2];
+    _mm_storeu_pd(sum_arr, sum);
+    return sum_arr[0] + sum_arr[1];
+}
+#endif
+
+/*
+* peak flop rate of i_nb_threads threads running the multiply-add kernel
+*/
+template <typename FloatPrec>
+double
+measure_peak_flops(
+        uint32_t i_nb_threads,
+        uint32_t i_nb_reps)
+{
+    const uint64_t nb_iterations = 1 << 22;
+    const double flops_per_thread =
+            2. * (PEAK_NB_ACCS_BYTES / sizeof(FloatPrec)) * nb_iterations;
+    double best_s = std::numeric_limits<double>::max();
+    std::vector<double> sums(i_nb_threads, 0.);
+    for (uint32_t i_rep = 0; i_rep<i_nb_reps; ++i_rep) {
+        Common::Timer timer;
+        std::vector<std::thread> workers;
+        for (uint32_t i_t = 0; i_t<i_nb_threads; ++i_t) {
+            workers.push_back(std::thread([&sums, i_t, nb_iterations]() {
+                sums[i_t] += peak_flops_kernel<FloatPrec>(nb_iterations);
+            }));
+        }
+        for (uint32_t i_t = 0; i_t<workers.size(); ++i_t) {
+            workers[i_t].join();
+        }
+        best_s = std::min(best_s, timer.elapsed_s());
+    }
+    for (uint32_t i_t = 0; i_t<i_nb_threads; ++i_t) {
+        g_checksum_sink = g_checksum_sink + sums[i_t];
+    }
+    return i_nb_threads * flops_per_thread / best_s * 1.e-9;
+}
+
+/*
+* Analytic bytes and flops of the stages of a registration, from the template
+* and registration pyramid level sizes. Per template pixel (N pixels over all
+* levels, fsz bytes per float):
+* - error: quad warping (4 W loads, 2 stores, 14 flops), clamped bilinear
+*   interpolation (2 coordinate loads, 4 pixel loads, 1 store, 15 flops),
+*   template subtraction (2 loads, 1 store, 1 flop), copy into the
+*   multi-resolution error (1 load, 1 store): 18 fsz, 30 flops.
+* - jacobian (Gauss-Newton): quad warping (6 fsz, 14 flops), 2 gradient
+*   interpolations (2 + 8 loads, 30 flops), gradient scaling (2 flops), 8
+*   jacobian entries (4 W loads, 8 stores, 8 flops), copy into the
+*   multi-resolution jacobian (8 loads, 8 stores): 44 fsz, 54 flops.
+* - normal equations: J^T J (full 8x8 product, 128 flops) and e J (16 flops),
+*   J and e read once: 9 fsz, 144 flops.
+* - solve: 8x8 LDLT and substitutions, about 300 flops on 72 values.
+* Registration pyramid, per level pixel: level 0 conversion (1 byte load,
+* 1 store, 1 flop), box downsampling of the finer level (its pixels loaded
+* with 2 flops each, 1 store), gradients (1 load, 2 stores, 4 flops).
+*/
+template <typename FloatPrec>
+std::vector<StageCost>
+analytic_stage_costs(
+        const DenseImageRegistrationModel<FloatPrec> & i_model,
+        const std::vector<cimg_library::CImg<FloatPrec> > & i_reg_pyr,
+        uint32_t                                        i_nb_threads)
+{
+    const double fsz = sizeof(FloatPrec);
+    const double N = i_model.nb_mr_pixels();
+    std::vector<StageCost> costs(5);
+
+    costs[0].m_stage = "pyramid";
+    for (uint32_t i_lvl = 0; i_lvl<i_reg_pyr.size(); ++i_lvl) {
+        const double lvl_pix = (double)i_reg_pyr[i_lvl].width() * i_reg_pyr[i_lvl].height();
+        if (i_lvl == 0) {
+            costs[0].m_bytes += lvl_pix * (1. + fsz);
+            costs[0].m_flops += lvl_pix;
+        } else {
+            const double finer_pix =
+                    (double)i_reg_pyr[i_lvl - 1].width() * i_reg_pyr[i_lvl - 1].height();
+            costs[0].m_bytes += (finer_pix + lvl_pix) * fsz;
+            costs[0].m_flops += 2. * finer_pix;
+        }
+        costs[0].m_bytes += 3. * lvl_pix * fsz;
+        costs[0].m_flops += 4. * lvl_pix;
+    }
+    costs[1].m_stage = "error";
+    costs[1].m_bytes = 18. * fsz * N;
+    costs[1].m_flops = 30. * N;
+    costs[2].m_stage = "jacobian";
+    costs[2].m_bytes = 44. * fsz * N;
+    costs[2].m_flops = 54. * N;
+    costs[2].m_nb_threads = i_nb_threads;
+    costs[3].m_stage = "normal_equations";
+    costs[3].m_bytes = 9. * fsz * N;
+    costs[3].m_flops = 144. * N;
+    costs[4].m_stage = "solve";
+    costs[4].m_bytes = 72. * fsz;
+    costs[4].m_flops = 300.;
+    return costs;
+}
+
+/*
+* Time the registration stages for one configuration and append the results
+*/
+template <typename FloatPrec>
+Common::ErrCode
+run_configuration(
+        const RooflineConfig &                    i_config,
+        const std::string &                       i_precision_name,
+        const cimg_library::CImg<unsigned char> & i_ref_image,
+        const cimg_library::CImg<unsigned char> & i_reg_image,
+        const std::vector<FloatPrec> &            i_annot_pts,
+        uint32_t                                  i_template_dim,
+        uint32_t                                  i_nb_levels,
+        FloatPrec                                 i_lvl_resz_ratio,
+        const std::vector<MachineBaseline> &      i_baselines,
+        std::vector<RooflineRow> &                io_rows)
+{
+    typedef DenseImageRegistrationSolver<FloatPrec> Solver;
+    typedef typename Solver::Workspace Workspace;
+    Solver solver;
+    Common::ErrCode errCode = solver.init(
+            i_template_dim, i_template_dim, i_nb_levels, i_lvl_resz_ratio);
+    if (errCode != Common::NoError) { return errCode; }
+    errCode = solver.set_template(Common::im_view_from_cimg(i_ref_image), i_annot_pts);
+    if (errCode != Common::NoError) { return errCode; }
+
+    const uint32_t precision_ind = (sizeof(FloatPrec) == sizeof(float)) ? 0 : 1;
+    const Common::ImView<unsigned char> reg_view = Common::im_view_from_cimg(i_reg_image);
+    for (uint32_t i_b = 0; i_b<i_baselines.size(); ++i_b) {
+        const uint32_t nb_threads = i_baselines[i_b].m_nb_threads;
+        std::unique_ptr<Workspace> workspace(new Workspace());
+        errCode = workspace->set_model(solver.model());
+        if (errCode != Common::NoError) { return errCode; }
+        workspace->set_nb_threads(nb_threads);
+
+        // best-of times: pyramid build, then the iteration stages
+        std::vector<double> times_us(5, std::numeric_limits<double>::max());
+        for (uint32_t i_rep = 0; i_rep<i_config.m_nb_reps; ++i_rep) {
+            Common::Timer pyr_timer;
+            errCode = workspace->begin_lockstep(reg_view, i_annot_pts);
+            if (errCode != Common::NoError) { return errCode; }
+            times_us[0] = std::min(times_us[0], pyr_timer.elapsed_us());
+            double stage_us[4];
+            workspace->time_iteration_stages(
+                    stage_us[0], stage_us[1], stage_us[2], stage_us[3]);
+            for (uint32_t i_s = 0; i_s<4; ++i_s) {
+                times_us[i_s + 1] = std::min(times_us[i_s + 1], stage_us[i_s]);
+            }
+        }
+
+        const std::vector<StageCost> costs = analytic_stage_costs(
+                *solver.model(), workspace->last_reg_pyramid(), nb_threads);
+        StageCost iteration_cost;
+        iteration_cost.m_stage = "iteration";
+        iteration_cost.m_nb_threads = nb_threads;
+        double iteration_us = 0.;
+        for (uint32_t i_s = 0; i_s<costs.size(); ++i_s) {
+            // roofline of the threads the stage actually runs on
+            uint32_t i_sb = 0;
+            while ((i_sb + 1 < i_baselines.size())
+                    && (i_baselines[i_sb].m_nb_threads < costs[i_s].m_nb_threads)) {
+                ++i_sb;
+            }
+            RooflineRow row;
+            row.m_precision = i_precision_name;
+            row.m_template_width = i_template_dim;
+            row.m_template_height = i_template_dim;
+            row.m_nb_levels = i_nb_levels;
+            row.m_lvl_resz_ratio = i_lvl_resz_ratio;
+            row.m_nb_threads = nb_threads;
+            row.m_cost = costs[i_s];
+            row.m_time_us = times_us[i_s];
+            row.m_stream_gb_per_s = i_baselines[i_sb].m_stream_gb_per_s;
+            row.m_peak_gflop_per_s = i_baselines[i_sb].m_peak_gflop_per_s[precision_ind];
+            io_rows.push_back(row);
+            if (i_s > 0) {
+                iteration_cost.m_bytes += costs[i_s].m_bytes;
+                iteration_cost.m_flops += costs[i_s].m_flops;
+                iteration_us += times_us[i_s];
+            }
+        }
+        // whole iteration, on the roofline of the configuration threads
+        RooflineRow row = io_rows.back();
+        row.m_cost = iteration_cost;
+        row.m_time_us = iteration_us;
+        row.m_stream_gb_per_s = i_baselines[i_b].m_stream_gb_per_s;
+        row.m_peak_gflop_per_s = i_baselines[i_b].m_peak_gflop_per_s[precision_ind];
+        io_rows.push_back(row);
+    }
+    return Common::NoError;
+}
+
+/*
+* derived roofline quantities of a row
+*/
+void
+roofline_metrics(
+        const RooflineRow & i_row,
+        double &            o_intensity,
+        double &            o_gb_per_s,
+        double &            o_gflop_per_s,
+        double &            o_roof_gflop_per_s,
+        bool &              o_memory_bound)
+{
+    o_intensity = i_row.m_cost.m_flops / std::max(i_row.m_cost.m_bytes, 1.);
+    const double time_s = std::max(i_row.m_time_us, 1.e-3) * 1.e-6;
+    o_gb_per_s = i_row.m_cost.m_bytes / time_s * 1.e-9;
+    o_gflop_per_s = i_row.m_cost.m_flops / time_s * 1.e-9;
+    const double memory_roof = o_intensity * i_row.m_stream_gb_per_s;
+    o_memory_bound = memory_roof < i_row.m_peak_gflop_per_s;
+    o_roof_gflop_per_s = o_memory_bound ? memory_roof : i_row.m_peak_gflop_per_s;
+}
+
+void
+print_rows(
+        const std::vector<RooflineRow> & i_rows)
+{
+    for (uint32_t i_r = 0; i_r<i_rows.size(); ++i_r) {
+        const RooflineRow & row = i_rows[i_r];
+        double intensity, gb_per_s, gflop_per_s, roof_gflop_per_s;
+        bool memory_bound;
+        roofline_metrics(row, intensity, gb_per_s, gflop_per_s, roof_gflop_per_s, memory_bound);
+        std::cout << row.m_precision
+            << " | " << row.m_template_width << "x" << row.m_template_height
+            << " | levels: " << row.m_nb_levels
+            << " | ratio: " << row.m_lvl_resz_ratio
+            << " | threads: " << row.m_nb_threads
+            << " | " << row.m_cost.m_stage
+            << " | " << row.m_time_us << " us"
+            << " | " << intensity << " flop/byte"
+            << " | " << gb_per_s << " GB/s"
+            << " | " << gflop_per_s << " GFLOP/s"
+            << " | " << (memory_bound ? "memory" : "compute") << " bound, "
+            << 100. * gflop_per_s / roof_gflop_per_s << " % of roof"
+            << "\n";
+    }
+}
+
+Common::ErrCode
+write_rows_csv(
+        const std::string &              i_csv_path,
+        const std::vector<RooflineRow> & i_rows)
+{
+    std::ofstream csv_file(i_csv_path.c_str());
+    if (!csv_file.is_open()) {
+        return Common::IOCantOpenFile;
+    }
+    csv_file << "precision,template_width,template_height,nb_levels,lvl_resz_ratio,"
+        "threads,stage,stage_threads,time_us,bytes,flops,flop_per_byte,gb_per_s,"
+        "gflop_per_s,stream_gb_per_s,peak_gflop_per_s,roof_gflop_per_s,bound,"
+        "roof_fraction\n";
+    for (uint32_t i_r = 0; i_r<i_rows.size(); ++i_r) {
+        const RooflineRow & row = i_rows[i_r];
+        double intensity, gb_per_s, gflop_per_s, roof_gflop_per_s;
+        bool memory_bound;
+        roofline_metrics(row, intensity, gb_per_s, gflop_per_s, roof_gflop_per_s, memory_bound);
+        csv_file << row.m_precision << "," << row.m_template_width << ","
+            << row.m_template_height << "," << row.m_nb_levels << ","
+            << row.m_lvl_resz_ratio << "," << row.m_nb_threads << ","
+            << row.m_cost.m_stage << "," << row.m_cost.m_nb_threads << ","
+            << row.m_time_us << "," << row.m_cost.m_bytes << ","
+            << row.m_cost.m_flops << "," << intensity << "," << gb_per_s << ","
+            << gflop_per_s << "," << row.m_stream_gb_per_s << ","
+            << row.m_peak_gflop_per_s << "," << roof_gflop_per_s << ","
+            << (memory_bound ? "memory" : "compute") << ","
+            << gflop_per_s / roof_gflop_per_s << "\n";
+    }
+    return Common::NoError;
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration roofline study (CPU) ..." << "\n" ;
+
+    RooflineConfig config;
+    for (int arg_ind = 1; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--min-dim") && has_value) {
+            config.m_min_dim = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--max-dim") && has_value) {
+            config.m_max_dim = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--levels") && has_value) {
+            config.m_nb_levels = parse_list<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--ratios") && has_value) {
+            config.m_lvl_resz_ratios = parse_list<double>(argv[++arg_ind]);
+        } else if ((opt == "--max-threads") && has_value) {
+            config.m_max_nb_threads = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--precision") && has_value) {
+            const std::string precision(argv[++arg_ind]);
+            config.m_float = (precision == "float") || (precision == "both");
+            config.m_double = (precision == "double") || (precision == "both");
+        } else if ((opt == "--reps") && has_value) {
+            config.m_nb_reps = std::max(1u, Common::str2val<uint32_t>(argv[++arg_ind]));
+        } else if ((opt == "--stream-mb") && has_value) {
+            config.m_stream_mb = std::max(1u, Common::str2val<uint32_t>(argv[++arg_ind]));
+        } else if ((opt == "--csv") && has_value) {
+            config.m_csv_path = argv[++arg_ind];
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+    config.m_max_dim = std::min(config.m_max_dim, (uint32_t)MAX_TEMPLATE_DIMENSION);
+    config.m_min_dim = std::max(2u, std::min(config.m_min_dim, config.m_max_dim));
+    const uint32_t max_nb_threads = (config.m_max_nb_threads > 0) ?
+            config.m_max_nb_threads : Common::nb_hardware_threads();
+
+    // machine baselines for 1, 2, 4, ... threads
+    std::vector<MachineBaseline> baselines;
+    for (uint32_t nb_t = 1; ; nb_t = std::min(2 * nb_t, max_nb_threads)) {
+        MachineBaseline baseline;
+        baseline.m_nb_threads = nb_t;
+        baseline.m_stream_gb_per_s = measure_stream_triad(nb_t,
+                ((size_t)config.m_stream_mb << 20) / sizeof(double), config.m_nb_reps);
+        baseline.m_peak_gflop_per_s[0] = measure_peak_flops<float>(nb_t, config.m_nb_reps);
+        baseline.m_peak_gflop_per_s[1] = measure_peak_flops<double>(nb_t, config.m_nb_reps);
+        std::cout << "baseline | threads: " << nb_t
+            << " | stream triad: " << baseline.m_stream_gb_per_s << " GB/s"
+            << " | peak float: " << baseline.m_peak_gflop_per_s[0] << " GFLOP/s"
+            << " | peak double: " << baseline.m_peak_gflop_per_s[1] << " GFLOP/s"
+            << "\n";
+        baselines.push_back(baseline);
+        if (nb_t == max_nb_threads) {
+            break;
+        }
+    }
+
+    std::vector<RooflineRow> rows;
+    std::mt19937 rng(1);
+    Common::SyntheticMotion<double> motion;
+    motion.m_max_translation = 2.;
+    motion.m_max_rotation = 0.01;
+    motion.m_max_scale_change = 0.01;
+    for (uint32_t dim = config.m_min_dim; dim<=config.m_max_dim; dim *= 2) {
+        // synthetic workload: template quad of the template size in the
+        // middle of a texture, registration image slightly moved
+        const uint32_t im_width = dim + dim / 2 + 64;
+        const uint32_t im_height = im_width;
+        cimg_library::CImg<unsigned char> ref_image;
+        Common::generate_synthetic_texture(im_width, im_height, dim, ref_image);
+        const double x0 = 0.5 * (im_width - dim);
+        const double y0 = 0.5 * (im_height - dim);
+        const double annot_arr[] = {x0, y0, x0 + dim, y0, x0 + dim, y0 + dim, x0, y0 + dim};
+        const std::vector<double> annot_pts(annot_arr, annot_arr + 8);
+        Common::SyntheticRegistrationSample<double> sample;
+        Common::generate_synthetic_sample(ref_image, annot_pts, motion, rng, sample);
+
+        for (uint32_t i_l = 0; i_l<config.m_nb_levels.size(); ++i_l) {
+            for (uint32_t i_r = 0; i_r<config.m_lvl_resz_ratios.size(); ++i_r) {
+                const uint32_t nb_levels = config.m_nb_levels[i_l];
+                const double ratio = config.m_lvl_resz_ratios[i_r];
+                if ((nb_levels == 1) && (i_r > 0)) {
+                    continue; // the ratio is irrelevant with a single level
+                }
+                Common::ErrCode errCode = Common::NoError;
+                if (config.m_float) {
+                    errCode = run_configuration<float>(config, "float", ref_image,
+                            sample.m_reg_image,
+                            std::vector<float>(annot_pts.begin(), annot_pts.end()),
+                            dim, nb_levels, ratio, baselines, rows);
+                }
+                if ((errCode == Common::NoError) && config.m_double) {
+                    errCode = run_configuration<double>(config, "double", ref_image,
+                            sample.m_reg_image, annot_pts,
+                            dim, nb_levels, ratio, baselines, rows);
+                }
+                if (errCode != Common::NoError) {
+                    std::cerr << "Skipping template " << dim << "x" << dim
+                        << ", " << nb_levels << " levels, ratio " << ratio
+                        << " (error " << errCode << ").\n";
+                }
+            }
+        }
+        if (dim > config.m_max_dim / 2) {
+            break;
+        }
+    }
+    print_rows(rows);
+
+    if (!config.m_csv_path.empty()) {
+        const Common::ErrCode errCode = write_rows_csv(config.m_csv_path, rows);
+        if (errCode != Common::NoError) {
+            std::cerr << "Error writing " << config.m_csv_path << " (error " << errCode << ").\n";
+            exit(-1);
+        }
+    }
+
+    std::cout << "checksum: " << g_checksum_sink << "\n";
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
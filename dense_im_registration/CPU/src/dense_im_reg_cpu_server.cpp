@@ -0,0 +1,435 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Local registration service: a long-running process keeping the solver
+* templates resident, so that clients do not pay process startup, image
+* decoding, solver initialization and template setup on every registration.
+* Clients connect on a Unix-domain socket and hand frames over through a
+* shared memory frame ring (protocol in dense_im_reg_cpu_service.hpp, test
+* client in dense_im_reg_cpu_client.cpp). Each connection is served by its own
+* thread, with one warm solver workspace per template it registers; templates
+* are shared by all the connections. Every reply carries the solver and
+* service times of its request, and the server keeps latency statistics over
+* its last requests.
+*/
+
+#include <iostream>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#endif
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "color_conversion_utils.hpp"
+#include "local_socket_utils.hpp"
+#include "raw_frame_container.hpp"
+#include "shm_frame_ring.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+#include "dense_im_reg_cpu_service.hpp"
+
+#define FLOATPREC float
+
+typedef DenseImageRegistrationSolver<FLOATPREC> Solver;
+typedef Solver::Model                           Model;
+typedef Solver::Workspace                       Workspace;
+
+// latency statistics are computed over this many last requests
+static const uint32_t SERVER_STATS_WINDOW = 1 << 16;
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./server_dense_im_reg_cpu "
+        "1_socket_path "
+        "[--config solver.cfg]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* Latencies of the last SERVER_STATS_WINDOW requests
+*/
+struct LatencyWindow
+{
+    std::vector<double> m_latencies_us;
+    uint64_t            m_nb_requests = 0;
+
+    void
+    add(
+            double i_latency_us)
+    {
+        if (m_latencies_us.size() < SERVER_STATS_WINDOW) {
+            m_latencies_us.push_back(i_latency_us);
+        } else {
+            m_latencies_us[m_nb_requests % SERVER_STATS_WINDOW] = i_latency_us;
+        }
+        m_nb_requests++;
+    }
+};
+
+/*
+* State shared by all the connections
+*/
+struct ServerState
+{
+    DenseImageRegistrationConfig<FLOATPREC>         m_config;
+    std::mutex                                      m_mutex;
+    std::map<uint32_t, std::shared_ptr<const Model> > m_templates;
+    uint32_t                                        m_next_template_id = 1;
+    LatencyWindow                                   m_solve_latencies;
+    LatencyWindow                                   m_service_latencies;
+    std::vector<int>                                m_client_fds; // open connections
+    std::condition_variable                         m_sessions_done;
+    int                                             m_listen_fd = -1;
+    std::atomic<bool>                               m_stop;
+};
+
+/*
+* Per-connection state: the client frame ring and a warm workspace per
+* registered template
+*/
+struct ServiceSession
+{
+    ServerState &                                   m_server;
+    int                                             m_fd;
+    Common::ShmFrameRing                            m_ring;
+    std::map<uint32_t, std::unique_ptr<Workspace> > m_workspaces;
+
+    ServiceSession(ServerState & io_server, int i_fd) :
+        m_server(io_server), m_fd(i_fd)
+    {}
+
+    /*
+    * view of the (gray or luma converted) frame of a request, checked against
+    * the ring
+    */
+    Common::ErrCode
+    frame_views(
+            const ServiceRequest &    i_request,
+            Common::ImView<uint8_t> & o_gray_frame,
+            Common::RgbImView &       o_rgb_frame) const
+    {
+        if ((i_request.m_format != Common::RawFrameGray8)
+                && (i_request.m_format != Common::RawFrameRGB8Planar)) {
+            return Common::UnsupportedImageFormat;
+        }
+        const uint32_t nb_channels = Common::raw_frame_nb_channels(i_request.m_format);
+        if (!m_ring.frame_fits(i_request.m_slot, i_request.m_width, i_request.m_height,
+                    nb_channels)) {
+            return Common::InvalidServiceRequest;
+        }
+        o_gray_frame = m_ring.slot_view(i_request.m_slot, i_request.m_width, i_request.m_height);
+        if (nb_channels == 3) {
+            o_rgb_frame = Common::rgb_view_planar(
+                    m_ring.slot_plane(i_request.m_slot, i_request.m_height, 0),
+                    m_ring.slot_plane(i_request.m_slot, i_request.m_height, 1),
+                    m_ring.slot_plane(i_request.m_slot, i_request.m_height, 2),
+                    i_request.m_width, i_request.m_height, m_ring.stride());
+        }
+        return Common::NoError;
+    }
+
+    Common::ErrCode
+    set_template(
+            const ServiceRequest & i_request,
+            ServiceReply &         o_reply)
+    {
+        Common::ImView<uint8_t> frame;
+        Common::RgbImView rgb_frame;
+        Common::ErrCode errCode = frame_views(i_request, frame, rgb_frame);
+        if (errCode != Common::NoError) { return errCode; }
+        cimg_library::CImg<unsigned char> frame_luma;
+        if (i_request.m_format == Common::RawFrameRGB8Planar) {
+            Common::rgb_image_to_luma(rgb_frame, frame_luma);
+            frame = Common::im_view_from_cimg(frame_luma);
+        }
+        Solver solver;
+        errCode = solver.init(m_server.m_config);
+        if (errCode != Common::NoError) { return errCode; }
+        const std::vector<FLOATPREC> annot_pts(i_request.m_pts, i_request.m_pts + 8);
+        errCode = solver.set_template(frame, annot_pts);
+        if (errCode != Common::NoError) { return errCode; }
+
+        std::lock_guard<std::mutex> lock(m_server.m_mutex);
+        o_reply.m_template_id = m_server.m_next_template_id++;
+        m_server.m_templates[o_reply.m_template_id] = solver.model();
+        return Common::NoError;
+    }
+
+    /*
+    * workspace of the connection for a template (created on first use)
+    */
+    Common::ErrCode
+    template_workspace(
+            uint32_t     i_template_id,
+            Workspace *& o_workspace)
+    {
+        std::shared_ptr<const Model> model;
+        {
+            std::lock_guard<std::mutex> lock(m_server.m_mutex);
+            std::map<uint32_t, std::shared_ptr<const Model> >::const_iterator it =
+                    m_server.m_templates.find(i_template_id);
+            if (it != m_server.m_templates.end()) {
+                model = it->second;
+            }
+        }
+        if (!model) {
+            m_workspaces.erase(i_template_id); // released by another connection
+            return Common::InvalidServiceRequest;
+        }
+        std::unique_ptr<Workspace> & workspace = m_workspaces[i_template_id];
+        if (!workspace) {
+            workspace.reset(new Workspace());
+            const Common::ErrCode errCode = workspace->set_model(model);
+            if (errCode != Common::NoError) {
+                m_workspaces.erase(i_template_id);
+                return errCode;
+            }
+            workspace->set_config(m_server.m_config);
+        }
+        o_workspace = workspace.get();
+        return Common::NoError;
+    }
+
+    Common::ErrCode
+    register_frame(
+            const ServiceRequest & i_request,
+            ServiceReply &         o_reply)
+    {
+        Common::ImView<uint8_t> frame;
+        Common::RgbImView rgb_frame;
+        Common::ErrCode errCode = frame_views(i_request, frame, rgb_frame);
+        if (errCode != Common::NoError) { return errCode; }
+        Workspace * workspace = NULL;
+        errCode = template_workspace(i_request.m_template_id, workspace);
+        if (errCode != Common::NoError) { return errCode; }
+
+        const uint32_t nb_iterations = (i_request.m_nb_iterations > 0) ?
+                i_request.m_nb_iterations : m_server.m_config.m_nb_iterations;
+        std::vector<FLOATPREC> reg_pts(i_request.m_pts, i_request.m_pts + 8);
+        errCode = (i_request.m_format == Common::RawFrameRGB8Planar) ?
+                workspace->register_image(rgb_frame, nb_iterations, reg_pts) :
+                workspace->register_image(frame, nb_iterations, reg_pts);
+        if (errCode == Common::NoError) {
+            for (uint32_t i_c = 0; i_c<8; ++i_c) {
+                o_reply.m_pts[i_c] = reg_pts[i_c];
+            }
+        }
+        return errCode;
+    }
+
+    Common::ErrCode
+    handle(
+            const ServiceRequest & i_request,
+            ServiceReply &         o_reply)
+    {
+        switch (i_request.m_type) {
+        case ServiceAttachRing:
+        {
+            char ring_name[SERVICE_RING_NAME_SIZE + 1];
+            std::memcpy(ring_name, i_request.m_ring_name, SERVICE_RING_NAME_SIZE);
+            ring_name[SERVICE_RING_NAME_SIZE] = '\0';
+            return m_ring.attach(ring_name);
+        }
+        case ServiceSetTemplate:
+        {
+            Common::Timer solve_timer;
+            const Common::ErrCode errCode = set_template(i_request, o_reply);
+            o_reply.m_solve_us = solve_timer.elapsed_us();
+            return errCode;
+        }
+        case ServiceRegister:
+        {
+            Common::Timer solve_timer;
+            const Common::ErrCode errCode = register_frame(i_request, o_reply);
+            o_reply.m_solve_us = solve_timer.elapsed_us();
+            std::lock_guard<std::mutex> lock(m_server.m_mutex);
+            m_server.m_solve_latencies.add(o_reply.m_solve_us);
+            return errCode;
+        }
+        case ServiceReleaseTemplate:
+        {
+            m_workspaces.erase(i_request.m_template_id);
+            std::lock_guard<std::mutex> lock(m_server.m_mutex);
+            return (m_server.m_templates.erase(i_request.m_template_id) > 0) ?
+                    Common::NoError : Common::InvalidServiceRequest;
+        }
+        case ServiceGetStats:
+        {
+            std::lock_guard<std::mutex> lock(m_server.m_mutex);
+            o_reply.m_solve_stats = compute_service_latency_stats(
+                    m_server.m_solve_latencies.m_latencies_us);
+            o_reply.m_solve_stats.m_nb_requests = m_server.m_solve_latencies.m_nb_requests;
+            o_reply.m_service_stats = compute_service_latency_stats(
+                    m_server.m_service_latencies.m_latencies_us);
+            o_reply.m_service_stats.m_nb_requests = m_server.m_service_latencies.m_nb_requests;
+            return Common::NoError;
+        }
+        case ServiceShutdown:
+        {
+            m_server.m_stop = true;
+#ifdef LOCAL_SOCKETS_SUPPORTED
+            shutdown(m_server.m_listen_fd, SHUT_RDWR); // wakes up 'accept'
+#endif
+            return Common::NoError;
+        }
+        default:
+            return Common::InvalidServiceRequest;
+        }
+    }
+
+    /*
+    * serve the requests of the connection until it is closed
+    */
+    void
+    run()
+    {
+        ServiceRequest request;
+        while (Common::local_socket_recv(m_fd, &request, sizeof(request)) == Common::NoError) {
+            Common::Timer service_timer;
+            ServiceReply reply;
+            std::memset(&reply, 0, sizeof(reply));
+            reply.m_request_id = request.m_request_id;
+            reply.m_err_code = handle(request, reply);
+            reply.m_service_us = service_timer.elapsed_us();
+            if (request.m_type == ServiceRegister) {
+                std::lock_guard<std::mutex> lock(m_server.m_mutex);
+                m_server.m_service_latencies.add(reply.m_service_us);
+            }
+            if (Common::local_socket_send(m_fd, &reply, sizeof(reply)) != Common::NoError) {
+                break;
+            }
+        }
+    }
+};
+
+void
+serve_connection(
+        ServerState & io_server,
+        int           i_fd)
+{
+    {
+        ServiceSession session(io_server, i_fd);
+        session.run();
+    }
+    std::lock_guard<std::mutex> lock(io_server.m_mutex);
+    for (uint32_t i_c = 0; i_c<io_server.m_client_fds.size(); ++i_c) {
+        if (io_server.m_client_fds[i_c] == i_fd) {
+            io_server.m_client_fds.erase(io_server.m_client_fds.begin() + i_c);
+            break;
+        }
+    }
+    Common::local_socket_close(i_fd);
+    io_server.m_sessions_done.notify_all();
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration server (CPU) ..." << "\n" ;
+
+    if (argc < 2) {
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    const std::string socket_path(argv[1]);
+    ServerState server;
+    server.m_stop = false;
+    for (int arg_ind = 2; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--config") && has_value) {
+            const std::string config_path(argv[++arg_ind]);
+            const Common::ErrCode errCode =
+                    load_dense_im_reg_config(config_path, server.m_config);
+            if (errCode != Common::NoError) {
+                std::cerr << "Error loading " << config_path << " (error " << errCode << ").\n";
+                exit(-1);
+            }
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    Common::ErrCode curr_errCode = Common::local_socket_listen(socket_path, server.m_listen_fd);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error listening on " << socket_path << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    std::cout << "listening on " << socket_path << "\n";
+
+    while (!server.m_stop) {
+#ifdef LOCAL_SOCKETS_SUPPORTED
+        const int client_fd = accept(server.m_listen_fd, NULL, NULL);
+#else
+        const int client_fd = -1;
+#endif
+        if (client_fd < 0) {
+            if (server.m_stop || (errno != EINTR)) {
+                break;
+            }
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(server.m_mutex);
+            server.m_client_fds.push_back(client_fd);
+        }
+        std::thread(serve_connection, std::ref(server), client_fd).detach();
+    }
+
+    // close the remaining connections, and wait for their sessions to end
+    {
+        std::unique_lock<std::mutex> lock(server.m_mutex);
+#ifdef LOCAL_SOCKETS_SUPPORTED
+        for (uint32_t i_c = 0; i_c<server.m_client_fds.size(); ++i_c) {
+            shutdown(server.m_client_fds[i_c], SHUT_RDWR);
+        }
+#endif
+        while (!server.m_client_fds.empty()) {
+            server.m_sessions_done.wait(lock);
+        }
+    }
+    Common::local_socket_close(server.m_listen_fd);
+    std::remove(socket_path.c_str());
+
+    const ServiceLatencyStats stats = compute_service_latency_stats(
+            server.m_service_latencies.m_latencies_us);
+    std::cout << "served registrations: " << server.m_service_latencies.m_nb_requests
+        << " | mean: " << stats.m_mean_us << " us"
+        << " | median: " << stats.m_median_us << " us"
+        << " | p99: " << stats.m_p99_us << " us"
+        << "\n";
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _DENSE_IM_REG_CPU_SERVICE_HPP
+#define _DENSE_IM_REG_CPU_SERVICE_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "errCodes.h"
+#include "local_socket_utils.hpp"
+
+
+/*
+* Protocol of the local registration service (server_dense_im_reg_cpu):
+* clients send fixed-size requests on a Unix-domain socket and get one reply
+* per request, in order. Frames are not sent on the socket: the client writes
+* them in the slots of a shared memory frame ring (see shm_frame_ring.hpp)
+* that it attaches first, and requests only name the slot and the frame
+* geometry. The templates set by clients stay resident in the server (shared
+* by all the connections) until released, and each connection keeps a warm
+* solver workspace per template it registers.
+*/
+typedef enum ServiceRequestType_t
+{
+    ServiceAttachRing       = 0, // attach the client frame ring m_ring_name
+    ServiceSetTemplate      = 1, // new template: frame in m_slot, annotated quad m_pts
+    ServiceRegister         = 2, // register template m_template_id in the frame
+                                 // in m_slot, from the quad m_pts
+    ServiceReleaseTemplate  = 3, // drop template m_template_id
+    ServiceGetStats         = 4, // server latency statistics
+    ServiceShutdown         = 5, // stop the server
+} ServiceRequestType;
+
+static const uint32_t SERVICE_RING_NAME_SIZE = 64;
+
+struct ServiceRequest
+{
+    uint32_t m_type;           // ServiceRequestType
+    uint32_t m_request_id;     // returned in the reply
+    uint32_t m_template_id;
+    uint32_t m_slot;           // frame ring slot
+    uint32_t m_width;          // frame geometry
+    uint32_t m_height;
+    uint32_t m_format;         // RawFrameFormat (gray or planar RGB)
+    uint32_t m_nb_iterations;  // 0: server configuration
+    double   m_pts[8];
+    char     m_ring_name[SERVICE_RING_NAME_SIZE];
+};
+
+/*
+* Latency statistics over the last requests (in us)
+*/
+struct ServiceLatencyStats
+{
+    uint64_t m_nb_requests;
+    double   m_mean_us;
+    double   m_median_us;
+    double   m_p90_us;
+    double   m_p99_us;
+    double   m_max_us;
+};
+
+struct ServiceReply
+{
+    uint32_t            m_request_id;
+    uint32_t            m_err_code;     // Common::ErrCode
+    uint32_t            m_template_id;  // ServiceSetTemplate
+    uint32_t            m_padding;
+    double              m_pts[8];       // registered quad (ServiceRegister)
+    double              m_solve_us;     // time spent in the solver
+    double              m_service_us;   // from the request reception to the reply
+    ServiceLatencyStats m_solve_stats;  // ServiceGetStats
+    ServiceLatencyStats m_service_stats;
+};
+
+
+/*
+* latency statistics of a set of request latencies
+*/
+inline
+ServiceLatencyStats
+compute_service_latency_stats(
+        const std::vector<double> & i_latencies_us)
+{
+    ServiceLatencyStats stats = ServiceLatencyStats();
+    stats.m_nb_requests = i_latencies_us.size();
+    if (i_latencies_us.empty()) {
+        return stats;
+    }
+    std::vector<double> latencies_us(i_latencies_us);
+    std::sort(latencies_us.begin(), latencies_us.end());
+    const size_t nb = latencies_us.size();
+    double total_us = 0.;
+    for (size_t i_l = 0; i_l<nb; ++i_l) {
+        total_us += latencies_us[i_l];
+    }
+    stats.m_mean_us = total_us / nb;
+    stats.m_median_us = latencies_us[nb / 2];
+    stats.m_p90_us = latencies_us[std::min(nb - 1, (size_t)(0.9 * nb))];
+    stats.m_p99_us = latencies_us[std::min(nb - 1, (size_t)(0.99 * nb))];
+    stats.m_max_us = latencies_us.back();
+    return stats;
+}
+
+/*
+* send a request and wait for its reply
+*/
+inline
+Common::ErrCode
+service_call(
+        int                    i_fd,
+        const ServiceRequest & i_request,
+        ServiceReply &         o_reply)
+{
+    Common::ErrCode errCode = Common::local_socket_send(i_fd, &i_request, sizeof(i_request));
+    if (errCode != Common::NoError) { return errCode; }
+    errCode = Common::local_socket_recv(i_fd, &o_reply, sizeof(o_reply));
+    if (errCode != Common::NoError) { return errCode; }
+    if (o_reply.m_request_id != i_request.m_request_id) {
+        return Common::ServiceConnectionError;
+    }
+    return (Common::ErrCode)o_reply.m_err_code;
+}
+
+#endif /* _DENSE_IM_REG_CPU_SERVICE_HPP *  * */
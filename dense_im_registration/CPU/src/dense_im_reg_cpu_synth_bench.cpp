@@ -0,0 +1,390 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Dense image registration benchmark on a synthetic workload: a random texture
+* is registered against copies of itself moved by random affine motions (exact
+* ground truth), to compare solver configurations in terms of iterations,
+* wall time and accuracy.
+* With --lockstep K, the samples are also registered K at a time in lockstep,
+* their normal equations being solved in one SIMD batch (see
+* dense_im_reg_cpu_lockstep.hpp), and compared to one at a time registration.
+*/
+
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "synthetic_workload.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+#include "dense_im_reg_cpu_lockstep.hpp"
+
+#define FLOATPREC float
+
+typedef DenseImageRegistrationSolver<FLOATPREC> Solver;
+typedef Solver::Workspace Workspace;
+
+struct SynthBenchConfig
+{
+    uint32_t  m_image_width = 640;
+    uint32_t  m_image_height = 480;
+    uint32_t  m_template_width = 200;
+    uint32_t  m_template_height = 300;
+    uint32_t  m_nb_res_levels = 3;
+    FLOATPREC m_lvl_resz_ratio = 0.5;
+    uint32_t  m_max_nb_iterations = 30;
+    FLOATPREC m_convergence_threshold = 0.01;
+    FLOATPREC m_success_threshold = 1.; // max mean corner error, in pixels
+    uint32_t  m_nb_samples = 50;
+    uint32_t  m_seed = 0;
+    bool      m_coarse_search = false;
+    uint32_t  m_nb_streams = 0; // workspaces sharing the template model
+    uint32_t  m_nb_lockstep = 0; // samples registered together
+    Common::SyntheticMotion<FLOATPREC> m_motion;
+};
+
+struct SynthBenchStats
+{
+    double   m_mean_nb_iterations = 0.;
+    double   m_mean_time_us = 0.;
+    double   m_mean_corner_err = 0.;
+    uint32_t m_nb_success = 0;
+};
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./bench_dense_im_reg_cpu_synth "
+        "[--samples N] [--iterations N] [--threshold px] "
+        "[--translation px] [--rotation rad] [--scale ratio] [--seed N] "
+        "[--coarse-search] [--streams N] [--lockstep K]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+/*
+* Register all the samples with a given solver configuration
+* (RegSolver: solver or workspace)
+*/
+template <typename RegSolver>
+Common::ErrCode
+run_samples(
+        RegSolver &                                                   io_solver,
+        const SynthBenchConfig &                                      i_config,
+        const std::vector<Common::SyntheticRegistrationSample<FLOATPREC> > & i_samples,
+        SynthBenchStats &                                             o_stats)
+{
+    o_stats = SynthBenchStats();
+    Common::ErrCode errCode = Common::NoError;
+    for (uint32_t i_s = 0; i_s<i_samples.size(); ++i_s) {
+        std::vector<FLOATPREC> reg_pts(i_samples[i_s].m_init_pts);
+        Common::Timer reg_timer;
+        errCode = io_solver.register_image(
+                i_samples[i_s].m_reg_image, i_config.m_max_nb_iterations, reg_pts);
+        const double reg_time_us = reg_timer.elapsed_us();
+        if (errCode != Common::NoError) { return errCode; }
+
+        const FLOATPREC corner_err = Common::mean_corner_error(
+                reg_pts, i_samples[i_s].m_gt_pts);
+        o_stats.m_mean_nb_iterations += io_solver.last_nb_iterations();
+        o_stats.m_mean_time_us += reg_time_us;
+        o_stats.m_mean_corner_err += corner_err;
+        if (corner_err < i_config.m_success_threshold) {
+            o_stats.m_nb_success++;
+        }
+    }
+    const double inv_nb_samples = 1. / std::max((size_t)1, i_samples.size());
+    o_stats.m_mean_nb_iterations *= inv_nb_samples;
+    o_stats.m_mean_time_us *= inv_nb_samples;
+    o_stats.m_mean_corner_err *= inv_nb_samples;
+    return Common::NoError;
+}
+
+/*
+* Register all the samples, io_workspaces.size() at a time in lockstep
+* (o_nb_fallbacks: normal equations solved by the batched solver fallback)
+*/
+Common::ErrCode
+run_samples_lockstep(
+        const std::vector<Workspace *> &                              io_workspaces,
+        const SynthBenchConfig &                                      i_config,
+        const std::vector<Common::SyntheticRegistrationSample<FLOATPREC> > & i_samples,
+        SynthBenchStats &                                             o_stats,
+        uint32_t &                                                    o_nb_fallbacks)
+{
+    o_stats = SynthBenchStats();
+    o_nb_fallbacks = 0;
+    Common::BatchedSpdSolver<FLOATPREC, 8> normal_solver;
+    std::vector<Workspace *> workspaces;
+    std::vector<Common::ImView<unsigned char> > reg_images;
+    std::vector<std::vector<FLOATPREC> > reg_pts;
+    std::vector<Common::ErrCode> errCodes;
+    for (uint32_t i_s0 = 0; i_s0<i_samples.size(); i_s0 += io_workspaces.size()) {
+        const uint32_t nb_targets = std::min(
+                io_workspaces.size(), i_samples.size() - i_s0);
+        workspaces.assign(io_workspaces.begin(), io_workspaces.begin() + nb_targets);
+        reg_images.clear();
+        reg_pts.clear();
+        for (uint32_t i_t = 0; i_t<nb_targets; ++i_t) {
+            reg_images.push_back(Common::im_view_from_cimg(i_samples[i_s0 + i_t].m_reg_image));
+            reg_pts.push_back(i_samples[i_s0 + i_t].m_init_pts);
+        }
+        Common::Timer reg_timer;
+        Common::ErrCode errCode = register_images_lockstep(workspaces, reg_images,
+                i_config.m_max_nb_iterations, reg_pts, normal_solver, errCodes);
+        const double reg_time_us = reg_timer.elapsed_us();
+        if (errCode != Common::NoError) { return errCode; }
+
+        for (uint32_t i_t = 0; i_t<nb_targets; ++i_t) {
+            if (errCodes[i_t] != Common::NoError) { return errCodes[i_t]; }
+            const FLOATPREC corner_err = Common::mean_corner_error(
+                    reg_pts[i_t], i_samples[i_s0 + i_t].m_gt_pts);
+            o_stats.m_mean_nb_iterations += workspaces[i_t]->last_nb_iterations();
+            o_stats.m_mean_time_us += reg_time_us / nb_targets;
+            o_stats.m_mean_corner_err += corner_err;
+            if (corner_err < i_config.m_success_threshold) {
+                o_stats.m_nb_success++;
+            }
+        }
+        o_nb_fallbacks += normal_solver.nb_fallbacks();
+    }
+    const double inv_nb_samples = 1. / std::max((size_t)1, i_samples.size());
+    o_stats.m_mean_nb_iterations *= inv_nb_samples;
+    o_stats.m_mean_time_us *= inv_nb_samples;
+    o_stats.m_mean_corner_err *= inv_nb_samples;
+    return Common::NoError;
+}
+
+/*
+* Register all the samples in one stream (worker thread body)
+*/
+void
+run_stream(
+        Workspace &                                                   io_workspace,
+        const SynthBenchConfig &                                      i_config,
+        const std::vector<Common::SyntheticRegistrationSample<FLOATPREC> > & i_samples,
+        SynthBenchStats &                                             o_stats,
+        Common::ErrCode &                                             o_errCode)
+{
+    o_errCode = run_samples(io_workspace, i_config, i_samples, o_stats);
+}
+
+void
+print_stats(
+        const std::string &     i_name,
+        const SynthBenchStats & i_stats,
+        uint32_t                i_nb_samples)
+{
+    std::cout << i_name
+        << " | iterations: " << i_stats.m_mean_nb_iterations
+        << " | time: " << i_stats.m_mean_time_us << " us"
+        << " | time/iteration: " << i_stats.m_mean_time_us /
+                std::max(i_stats.m_mean_nb_iterations, 1.) << " us"
+        << " | corner error: " << i_stats.m_mean_corner_err << " px"
+        << " | success: " << i_stats.m_nb_success << "/" << i_nb_samples
+        << "\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration synthetic benchmark (CPU) ..." << "\n" ;
+
+    SynthBenchConfig config;
+    for (int arg_ind = 1; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--samples") && has_value) {
+            config.m_nb_samples = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--iterations") && has_value) {
+            config.m_max_nb_iterations = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--threshold") && has_value) {
+            config.m_convergence_threshold = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--translation") && has_value) {
+            config.m_motion.m_max_translation = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--rotation") && has_value) {
+            config.m_motion.m_max_rotation = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--scale") && has_value) {
+            config.m_motion.m_max_scale_change = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--seed") && has_value) {
+            config.m_seed = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if (opt == "--coarse-search") {
+            config.m_coarse_search = true;
+        } else if ((opt == "--streams") && has_value) {
+            config.m_nb_streams = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--lockstep") && has_value) {
+            config.m_nb_lockstep = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    // synthetic workload: one reference texture, registered against randomly
+    // moved copies of itself.
+    cimg_library::CImg<unsigned char> ref_im;
+    Common::generate_synthetic_texture(
+            config.m_image_width, config.m_image_height, config.m_seed, ref_im);
+    const FLOATPREC cx = 0.5 * config.m_image_width;
+    const FLOATPREC cy = 0.5 * config.m_image_height;
+    const FLOATPREC half_w = 0.25 * config.m_image_width;
+    const FLOATPREC half_h = 0.3 * config.m_image_height;
+    const FLOATPREC annot_pts_arr[] = {
+            cx - half_w, cy - half_h, cx + half_w, cy - half_h,
+            cx + half_w, cy + half_h, cx - half_w, cy + half_h};
+    std::vector<FLOATPREC> annot_pts(annot_pts_arr, annot_pts_arr + 8);
+
+    std::mt19937 rng(config.m_seed + 1);
+    std::vector<Common::SyntheticRegistrationSample<FLOATPREC> > samples(
+            config.m_nb_samples);
+    for (uint32_t i_s = 0; i_s<config.m_nb_samples; ++i_s) {
+        Common::generate_synthetic_sample(
+                ref_im, annot_pts, config.m_motion, rng, samples[i_s]);
+    }
+
+    Solver im_reg_solver;
+    Common::ErrCode curr_errCode = im_reg_solver.init(
+            config.m_template_width,
+            config.m_template_height,
+            config.m_nb_res_levels,
+            config.m_lvl_resz_ratio);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error in solver initialization (error " << curr_errCode << ")." << ".\n";
+        exit(-1);
+    }
+    curr_errCode = im_reg_solver.set_template(ref_im, annot_pts);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error setting template (error " << curr_errCode << ")." << ".\n";
+        exit(-1);
+    }
+    im_reg_solver.set_convergence_threshold(config.m_convergence_threshold);
+
+    // Gauss-Newton vs ESM updates, with and without coarse search
+    // initialization (search radius covering the max translation)
+    Solver::CoarseSearchParams coarse_search;
+    coarse_search.m_search_radius = 1 + (uint32_t)std::ceil(
+            config.m_motion.m_max_translation *
+            std::pow(config.m_lvl_resz_ratio, (FLOATPREC)(config.m_nb_res_levels - 1)));
+    const Solver::UpdateMode update_modes[] = {
+            Solver::GaussNewtonUpdate, Solver::ESMUpdate};
+    const char * update_mode_names[] = {"Gauss-Newton", "ESM         "};
+    const uint32_t nb_search_modes = config.m_coarse_search ? 2 : 1;
+    for (uint32_t i_cs = 0; i_cs<nb_search_modes; ++i_cs) {
+        coarse_search.m_enabled = (i_cs == 1);
+        im_reg_solver.set_coarse_search(coarse_search);
+        for (uint32_t i_m = 0; i_m<2; ++i_m) {
+            im_reg_solver.set_update_mode(update_modes[i_m]);
+            SynthBenchStats stats;
+            curr_errCode = run_samples(im_reg_solver, config, samples, stats);
+            if (curr_errCode != Common::NoError) {
+                std::cerr << "Error in image registration (error " << curr_errCode << ")." << ".\n";
+                exit(-1);
+            }
+            print_stats(std::string(update_mode_names[i_m]) +
+                    (coarse_search.m_enabled ? " + coarse search" : ""),
+                    stats, config.m_nb_samples);
+        }
+    }
+
+    // multi-stream tracking: one workspace per thread, all registering
+    // against the (read-only) template model of the solver
+    if (config.m_nb_streams > 0) {
+        const uint32_t nb_streams = config.m_nb_streams;
+        std::vector<std::unique_ptr<Workspace> > workspaces(nb_streams);
+        for (uint32_t i_st = 0; i_st<nb_streams; ++i_st) {
+            workspaces[i_st].reset(new Workspace());
+            curr_errCode = workspaces[i_st]->set_model(im_reg_solver.model());
+            if (curr_errCode != Common::NoError) {
+                std::cerr << "Error in workspace initialization (error " << curr_errCode << ")." << ".\n";
+                exit(-1);
+            }
+            workspaces[i_st]->set_convergence_threshold(config.m_convergence_threshold);
+        }
+        std::vector<SynthBenchStats> stream_stats(nb_streams);
+        std::vector<Common::ErrCode> stream_errCodes(nb_streams, Common::NoError);
+        std::vector<std::thread> streams;
+        Common::Timer streams_timer;
+        for (uint32_t i_st = 0; i_st<nb_streams; ++i_st) {
+            streams.push_back(std::thread(run_stream,
+                    std::ref(*workspaces[i_st]), std::cref(config), std::cref(samples),
+                    std::ref(stream_stats[i_st]), std::ref(stream_errCodes[i_st])));
+        }
+        for (uint32_t i_st = 0; i_st<nb_streams; ++i_st) {
+            streams[i_st].join();
+        }
+        const double elapsed_s = streams_timer.elapsed_s();
+
+        uint32_t nb_success = 0;
+        for (uint32_t i_st = 0; i_st<nb_streams; ++i_st) {
+            if (stream_errCodes[i_st] != Common::NoError) {
+                std::cerr << "Error in image registration (error " << stream_errCodes[i_st] << ")." << ".\n";
+                exit(-1);
+            }
+            nb_success += stream_stats[i_st].m_nb_success;
+        }
+        const uint32_t nb_registrations = nb_streams * config.m_nb_samples;
+        std::cout << "Shared model | streams: " << nb_streams
+            << " | registrations: " << nb_registrations
+            << " | wall time: " << elapsed_s << " s"
+            << " | throughput: " << nb_registrations / std::max(elapsed_s, 1.e-9) << " registrations/s"
+            << " | success: " << nb_success << "/" << nb_registrations
+            << "\n";
+    }
+
+    // lockstep registration: the samples are registered K at a time, one
+    // workspace per sample sharing the template model, with batched normal
+    // equation solves. Gauss-Newton updates, compared to one at a time.
+    if (config.m_nb_lockstep > 0) {
+        const uint32_t nb_lockstep = config.m_nb_lockstep;
+        std::vector<std::unique_ptr<Workspace> > workspace_storage(nb_lockstep);
+        std::vector<Workspace *> workspaces(nb_lockstep);
+        for (uint32_t i_t = 0; i_t<nb_lockstep; ++i_t) {
+            workspace_storage[i_t].reset(new Workspace());
+            workspaces[i_t] = workspace_storage[i_t].get();
+            curr_errCode = workspaces[i_t]->set_model(im_reg_solver.model());
+            if (curr_errCode != Common::NoError) {
+                std::cerr << "Error in workspace initialization (error " << curr_errCode << ")." << ".\n";
+                exit(-1);
+            }
+            workspaces[i_t]->set_convergence_threshold(config.m_convergence_threshold);
+        }
+        SynthBenchStats stats;
+        curr_errCode = run_samples(*workspaces[0], config, samples, stats);
+        if (curr_errCode != Common::NoError) {
+            std::cerr << "Error in image registration (error " << curr_errCode << ")." << ".\n";
+            exit(-1);
+        }
+        print_stats("Gauss-Newton, one at a time", stats, config.m_nb_samples);
+        uint32_t nb_fallbacks = 0;
+        curr_errCode = run_samples_lockstep(workspaces, config, samples, stats, nb_fallbacks);
+        if (curr_errCode != Common::NoError) {
+            std::cerr << "Error in image registration (error " << curr_errCode << ")." << ".\n";
+            exit(-1);
+        }
+        print_stats("Gauss-Newton, lockstep x" + std::to_string(nb_lockstep), stats,
+                config.m_nb_samples);
+        std::cout << "batched solver fallbacks: " << nb_fallbacks << "\n";
+    }
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
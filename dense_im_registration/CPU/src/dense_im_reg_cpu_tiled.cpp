@@ -0,0 +1,197 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Register a template in a very large image stored as a tiled pyramid file
+* (see tiled_pyramid.hpp): only the tiles under the quad footprint are read,
+* through a bounded tile cache. Reports the registered quad, the registration
+* time and the cache statistics (hit rate, bytes read) to help sizing the
+* cache.
+*/
+
+#include <iostream>
+#include <cstdlib>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "annot_info_handling.hpp"
+#include "raw_frame_container.hpp"
+#include "tiled_pyramid.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu.hpp"
+
+#define FLOATPREC float
+
+void
+print_usage()
+{
+    std::cout << "=========================================================\n";
+    std::cout << "Usage:\n";
+    std::cout << "---------------------------------------------------------\n";
+    std::cout << "./register_dense_im_reg_cpu_tiled "
+        "1_ref_image.(raw|png|...) "
+        "2_ref_image_annot_info "
+        "3_reg_image.tiles "
+        "4_reg_image_init_info "
+        "[--cache-mb N] [--iterations N] [--margin px] [--repeat N]"
+        << "\n";
+    std::cout << "=========================================================\n";
+}
+
+
+int main(int argc, char ** argv)
+{
+    std::cout << "dense image registration in tiled pyramid (CPU) ..." << "\n" ;
+
+    //////////////////////////// ALGO PARAMETERS //////////////////////////////
+    const uint32_t template_width = 200;
+    const uint32_t template_height = 300;
+    const uint32_t nb_res_levels = 3;
+    const FLOATPREC lvl_resz_ratio = 0.5;
+    uint32_t register_nb_iterations = 5;
+    FLOATPREC roi_motion_margin = 32.;
+    ///////////////////////////////////////////////////////////////////////////
+
+    if (argc < 5) {
+        print_usage();
+        exit(-1);
+    }
+
+    // parse input arguments
+    const std::string ref_im_path(argv[1]);
+    const std::string ref_im_annot_info_path(argv[2]);
+    const std::string reg_tiles_path(argv[3]);
+    const std::string reg_im_init_info_path(argv[4]);
+    uint64_t cache_mb = 64;
+    uint32_t nb_repeats = 1;
+    for (int arg_ind = 5; arg_ind<argc; ++arg_ind) {
+        const std::string opt(argv[arg_ind]);
+        const bool has_value = (arg_ind + 1) < argc;
+        if ((opt == "--cache-mb") && has_value) {
+            cache_mb = Common::str2val<uint64_t>(argv[++arg_ind]);
+        } else if ((opt == "--iterations") && has_value) {
+            register_nb_iterations = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else if ((opt == "--margin") && has_value) {
+            roi_motion_margin = Common::str2val<FLOATPREC>(argv[++arg_ind]);
+        } else if ((opt == "--repeat") && has_value) {
+            nb_repeats = Common::str2val<uint32_t>(argv[++arg_ind]);
+        } else {
+            std::cerr << "Error: unknown option " << opt << ".\n";
+            print_usage();
+            exit(-1);
+        }
+    }
+
+    // reference image: first frame of a raw frame file, or decoded image
+    Common::ErrCode curr_errCode = Common::NoError;
+    Common::RawFrameReader ref_frames;
+    cimg_library::CImg<unsigned char> ref_im_gray;
+    Common::ImView<uint8_t> ref_im_view;
+    const bool ref_is_raw = (ref_im_path.size() > 4)
+            && (ref_im_path.compare(ref_im_path.size() - 4, 4, ".raw") == 0);
+    if (ref_is_raw) {
+        curr_errCode = ref_frames.open(ref_im_path);
+        if ((curr_errCode != Common::NoError) || (ref_frames.nb_frames() == 0)
+                || (ref_frames.format() != Common::RawFrameGray8)) {
+            std::cerr << "Error: " << ref_im_path << " must be a grayscale raw frame file.\n";
+            exit(-1);
+        }
+        ref_im_view = ref_frames.frame_view(0);
+    } else {
+        cimg_library::CImg<unsigned char> ref_im_asis;
+        try {
+            ref_im_asis.assign(ref_im_path.c_str());
+        } catch (...) {
+            std::cerr << "Error: can't read " << ref_im_path << ".\n";
+            exit(-1);
+        }
+        curr_errCode = Common::convert_to_gray(ref_im_asis, ref_im_gray);
+        if (curr_errCode != Common::NoError) {
+            std::cerr << "Error converting " << ref_im_path << " (error " << curr_errCode << ").\n";
+            exit(-1);
+        }
+        ref_im_view = Common::im_view_from_cimg(ref_im_gray);
+    }
+
+    std::vector<FLOATPREC> annot_pts;
+    std::vector<FLOATPREC> init_pts;
+    curr_errCode = Common::parse_annot_info(ref_im_annot_info_path, annot_pts);
+    if (curr_errCode == Common::NoError) {
+        curr_errCode = Common::parse_annot_info(reg_im_init_info_path, init_pts);
+    }
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error parsing annotation info (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+
+    Common::TiledPyramidReader reg_tiles;
+    curr_errCode = reg_tiles.open(reg_tiles_path, cache_mb << 20);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error opening " << reg_tiles_path << " (error " << curr_errCode << ").\n";
+        exit(-1);
+    }
+    std::cout << reg_tiles.width() << "x" << reg_tiles.height() << " image, "
+        << reg_tiles.nb_levels() << " levels, " << reg_tiles.tile_size() << "x"
+        << reg_tiles.tile_size() << " tiles, cache: "
+        << reg_tiles.cache_capacity_bytes() / (1 << 20) << " MB\n";
+
+    DenseImageRegistrationSolver<FLOATPREC> im_reg_solver;
+    curr_errCode = im_reg_solver.init(
+            template_width,
+            template_height,
+            nb_res_levels,
+            lvl_resz_ratio);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error in solver initialization (error " << curr_errCode << ")." << ".\n";
+        exit(-1);
+    }
+    curr_errCode = im_reg_solver.set_template(ref_im_view, annot_pts);
+    if (curr_errCode != Common::NoError) {
+        std::cerr << "Error setting template (error " << curr_errCode << ")." << ".\n";
+        exit(-1);
+    }
+
+    // the registration state only: no copy of the template model
+    DenseImageRegistrationWorkspace<FLOATPREC> reg_workspace;
+    reg_workspace.set_model(im_reg_solver.model());
+    reg_workspace.set_roi_mode(true, roi_motion_margin);
+
+    std::vector<FLOATPREC> reg_pts;
+    for (uint32_t i_r = 0; i_r<nb_repeats; ++i_r) {
+        reg_pts = init_pts;
+        reg_tiles.reset_cache_stats();
+        Common::Timer reg_timer;
+        curr_errCode = reg_workspace.register_image(
+                reg_tiles, register_nb_iterations, reg_pts);
+        const double reg_time_us = reg_timer.elapsed_us();
+        if (curr_errCode != Common::NoError) {
+            std::cerr << "Error in image registration (error " << curr_errCode << ")." << ".\n";
+            exit(-1);
+        }
+        std::cout << "run " << i_r
+            << " | time: " << reg_time_us << " us"
+            << " | tile requests: " << reg_tiles.nb_tile_requests()
+            << " | cache hit rate: " << 100. * reg_tiles.cache_hit_rate() << " %"
+            << " | bytes read: " << reg_tiles.nb_bytes_read()
+            << " | cache resident: " << reg_tiles.cache_resident_bytes() << " bytes"
+            << "\n";
+    }
+
+    std::cout << "registered points:";
+    for (uint32_t i_c = 0; i_c<reg_pts.size(); ++i_c) {
+        std::cout << " " << reg_pts[i_c];
+    }
+    std::cout << "\n";
+
+    std::cout << "over and out." << "\n" ;
+    return 0;
+}
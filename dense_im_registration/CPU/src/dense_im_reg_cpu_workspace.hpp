@@ -0,0 +1,654 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _DENSE_IM_REG_CPU_WORKSPACE_HPP
+#define _DENSE_IM_REG_CPU_WORKSPACE_HPP
+
+#include <memory>
+#include <vector>
+
+#include "tiled_pyramid.hpp"
+#include "timing_utils.hpp"
+
+#include "dense_im_reg_cpu_common.hpp"
+#include "dense_im_reg_cpu_config.hpp"
+#include "dense_im_reg_cpu_model.hpp"
+
+
+/*
+* Per-solve state of the dense image registration: registration image
+* pyramid, solver containers and registration settings.
+* A workspace registers images against a template model it only reads
+* (std::shared_ptr<const DenseImageRegistrationModel>): any number of
+* workspaces can share one model and register images concurrently, one
+* workspace per thread, without any lock.
+*/
+template <typename FloatPrec>
+struct DenseImageRegistrationWorkspace
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+public: // public enums
+    enum UpdateMode
+    {
+        GaussNewtonUpdate = 0,
+        ESMUpdate         = 1,
+    };
+    /*
+    * outcome of a deadline-bounded registration (see 'register_image_within')
+    */
+    enum RegistrationStatus
+    {
+        RegConverged       = 0, // converged at full resolution
+        RegIterationsDone  = 1, // iteration cap reached at full resolution
+        RegDeadlineReached = 2, // cut short by the time budget
+    };
+    /*
+    * Parameters of the optional exhaustive search run at the coarsest pyramid
+    * level to initialize the Gauss-Newton loop (see 'set_coarse_search').
+    */
+    struct CoarseSearchParams
+    {
+        bool                   m_enabled = false;
+        Common::MatchCriterion m_criterion = Common::NCCMatch;
+        uint32_t               m_search_radius = 8; // in coarsest level pixels
+        std::vector<FloatPrec> m_scales = std::vector<FloatPrec>(1, 1.);
+        std::vector<FloatPrec> m_rotations = std::vector<FloatPrec>(1, 0.); // rad
+    };
+public: // public typedefs
+    typedef DenseImageRegistrationModel<FloatPrec> Model;
+    typedef DenseImageRegistrationTypes<FloatPrec> Types;
+    typedef typename Types::MatrixNN       MatrixNN;
+    typedef typename Types::MatrixN2       MatrixN2;
+    typedef typename Types::MatrixN4       MatrixN4;
+    typedef typename Types::VecN           VecN;
+    typedef typename Types::Matrix42       Matrix42;
+    typedef typename Types::ImDim          ImDim;
+    typedef typename Types::LvlList_Images LvlList_Images;
+public:
+    DenseImageRegistrationWorkspace() {}
+    ~DenseImageRegistrationWorkspace() {}
+public:
+    /*
+    * attach the template model to register against. This preallocates the
+    * solver containers for the model geometry; attaching another model with
+    * the same geometry keeps the last registration pyramid usable (see
+    * 'has_registered_image'). Must be called again after the attached model
+    * is changed in place (new template): the jacobian kept for reuse is
+    * invalidated.
+    */
+    Common::ErrCode
+    set_model(
+            const std::shared_ptr<const Model> & i_model);
+
+    /*
+    * detach the template model (the workspace buffers are kept)
+    */
+    inline void release_model() {m_model.reset();}
+
+    /*
+    * attached template model (may be null)
+    */
+    inline const std::shared_ptr<const Model> & model() const {return m_model;}
+
+    /*
+    * register the template of the attached model in the input image.
+    * Color images (3 channels) are converted to luma on the fly, only over
+    * the region the registration pyramid is built on (see the RgbImView
+    * overload).
+    */
+    Common::ErrCode
+    register_image(
+            const cimg_library::CImg<unsigned char> & i_reg_image,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts);
+
+    /*
+    * same as above, on a single channel 8-bit image view (e.g. a frame of a
+    * memory-mapped raw frame file, see raw_frame_container.hpp), without any
+    * copy of the input image.
+    */
+    Common::ErrCode
+    register_image(
+            const Common::ImView<unsigned char> &     i_reg_image,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts);
+
+    /*
+    * same as above, on an RGB image view (planar or interleaved 8-bit data,
+    * see color_conversion_utils.hpp): the luma is computed straight into the
+    * first pyramid level, without any intermediate grayscale image.
+    */
+    Common::ErrCode
+    register_image(
+            const Common::RgbImView &                 i_reg_image,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts);
+
+    /*
+    * same as above, in a very large image stored as a tiled pyramid file
+    * (see tiled_pyramid.hpp) with the model level ratio. Only the tiles under
+    * the footprint of the quad at each level (quad bounding box plus motion
+    * margin, see 'set_roi_mode') are loaded, through the reader tile cache:
+    * registration always runs in roi mode.
+    */
+    Common::ErrCode
+    register_image(
+            Common::TiledPyramidReader &              io_reg_source,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts);
+
+    /*
+    * deadline-bounded (anytime) registration: same as 'register_image', but
+    * returns within about i_time_budget_us microseconds (from the call).
+    * The levels are solved coarse to fine, the cheapest first: the first stage
+    * only uses the coarsest level, each next stage adds the next finer level,
+    * and the last stage is the full multi-resolution problem solved by
+    * 'register_image'. Each stage runs up to i_nb_iterations iterations (or
+    * until convergence, see 'set_convergence_threshold') from the best quad of
+    * the previous stage. The clock is checked between iterations and stages:
+    * an iteration is only started if its predicted duration (from the previous
+    * ones) fits in the remaining time. The pyramid build and the first
+    * iteration of the coarsest stage always run: a budget shorter than them
+    * is overrun. Jacobian reuse is not supported: returns
+    * UnsupportedDeadlineMode when it is enabled (see 'set_jacobian_reuse').
+    * io_reg_pts receives the quad of lowest cost found in the finest stage
+    * reached, and o_status tells whether the registration converged, ran out
+    * of iterations, or was cut short by the deadline (the full resolution
+    * level may then not have been used, see 'last_finest_level').
+    */
+    Common::ErrCode
+    register_image_within(
+            const cimg_library::CImg<unsigned char> & i_reg_image,
+            double                                    i_time_budget_us,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts,
+            RegistrationStatus &                      o_status);
+
+    /*
+    * same as above, on a single channel 8-bit image view
+    */
+    Common::ErrCode
+    register_image_within(
+            const Common::ImView<unsigned char> &     i_reg_image,
+            double                                    i_time_budget_us,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts,
+            RegistrationStatus &                      o_status);
+
+    /*
+    * same as above, on an RGB image view
+    */
+    Common::ErrCode
+    register_image_within(
+            const Common::RgbImView &                 i_reg_image,
+            double                                    i_time_budget_us,
+            uint32_t                                  i_nb_iterations,
+            std::vector<FloatPrec> &                  io_reg_pts,
+            RegistrationStatus &                      o_status);
+
+    /*
+    * lockstep registration: the iterations of several workspaces are run
+    * together, so that their normal equations can be solved in one batch
+    * (see dense_im_reg_cpu_lockstep.hpp). 'begin_lockstep' builds the
+    * registration pyramid around i_reg_pts, as 'register_image' does (the
+    * image must outlive the lockstep registration). Each iteration then
+    * calls 'compute_normal_equations', which assembles the Gauss-Newton
+    * normal equations (J^T J) dx = -J^T e at the current quad
+    * ('normal_matrix' is J^T J, 'normal_rhs' is J^T e), and 'apply_step'
+    * with the solved dx, which tells whether the iterations converged (see
+    * 'set_convergence_threshold'). 'end_lockstep' returns the registered quad.
+    * The lockstep iterations are plain Gauss-Newton steps: 'begin_lockstep'
+    * returns UnsupportedLockstepMode if jacobian reuse or the tracking loss
+    * check is enabled, and the reference jacobian kept for reuse in
+    * 'register_image' is invalidated.
+    */
+    Common::ErrCode
+    begin_lockstep(
+            const Common::ImView<unsigned char> &     i_reg_image,
+            const std::vector<FloatPrec> &            i_reg_pts);
+
+    void
+    compute_normal_equations();
+
+    inline const MatrixNN & normal_matrix() const {return m_mr_jTj;}
+    inline const VecN & normal_rhs() const {return m_mr_jTb;}
+
+    Common::ErrCode
+    apply_step(
+            const VecN &                              i_delta,
+            bool &                                    o_converged);
+
+    void
+    end_lockstep(
+            std::vector<FloatPrec> &                  o_reg_pts) const;
+
+    /*
+    * run the stages of one Gauss-Newton iteration at the current quad of a
+    * lockstep registration one after the other, and time them (in us): pixel
+    * errors, jacobian, normal equations and their solve (scaling studies, see
+    * dense_im_reg_cpu_roofline.cpp). The quad is not updated.
+    */
+    void
+    time_iteration_stages(
+            double &                                  o_error_us,
+            double &                                  o_jacobian_us,
+            double &                                  o_normal_eq_us,
+            double &                                  o_solve_us);
+
+    /*
+    * enable/disable the region of interest (ROI) mode.
+    * In ROI mode, the registration pyramid (float conversion, resampled levels
+    * and gradients) is only built over the bounding box of the initial quad
+    * enlarged by i_motion_margin pixels (full resolution), instead of over the
+    * full input image. The ROI automatically grows if the solution drifts
+    * closer than half the margin to its border.
+    */
+    inline void set_roi_mode(bool i_enable, FloatPrec i_motion_margin = 32.) {
+        m_roi_mode = i_enable;
+        m_roi_motion_margin = i_motion_margin;
+    }
+
+    /*
+    * region of the last registration image the pyramid was built on (full
+    * resolution coordinates), and number of times it had to be grown.
+    */
+    inline const Common::ImRoi & last_reg_roi() const {return m_reg_roi;}
+    inline uint32_t last_nb_roi_grows() const {return m_nb_roi_grows;}
+
+    /*
+    * select the parameter update scheme used in 'register_image':
+    * - GaussNewtonUpdate: forward additive Gauss-Newton, the jacobian uses the
+    *   warped image gradients only.
+    * - ESMUpdate: efficient second-order minimization, the jacobian uses the
+    *   average of the warped image gradients and of the template gradients
+    *   (precomputed in the model), which gives close to second-order
+    *   convergence for the cost of a Gauss-Newton iteration.
+    */
+    inline void set_update_mode(UpdateMode i_update_mode) {
+        m_update_mode = i_update_mode;
+        m_jref_is_valid = false;
+    }
+
+    /*
+    * enable/disable jacobian reuse in 'register_image' (quasi-Newton mode).
+    * The jacobian J (and the Gauss-Newton Hessian approximation J^T J) is
+    * only computed when the quad is further than i_max_dist pixels (largest
+    * vertex coordinate change) from the quad it was last computed at, in the
+    * same or in a previous registration (frame). In between, the gradient
+    * uses that reference jacobian, and the Hessian approximation gets a BFGS
+    * correction after each step. A step taken with a reused jacobian that
+    * does not decrease the cost is rejected, and the jacobian is recomputed
+    * at the previous quad.
+    */
+    inline void set_jacobian_reuse(bool i_enable, FloatPrec i_max_dist = 1.) {
+        m_jaco_reuse = i_enable;
+        m_jaco_reuse_max_dist = i_max_dist;
+        m_jref_is_valid = false;
+    }
+
+    /*
+    * enable/disable the tracking loss check. When enabled, 'register_image'
+    * first aligns the quad on the coarse levels only (all levels but the full
+    * resolution one, at most i_nb_coarse_iterations iterations), then checks
+    * the alignment: the mean normalized cross-correlation (NCC) between the
+    * coarse level templates and the warped image patches must be at least
+    * i_min_ncc, and the quad must stay convex with the same orientation and an
+    * area within a factor 4 of the initial quad. Otherwise the registration
+    * is aborted before any full resolution computation: it returns
+    * TrackingLost, io_reg_pts is left untouched and no registered image is
+    * kept (see 'has_registered_image'). The full registration then starts
+    * from the coarse alignment: the coarse iterations come on top of the
+    * i_nb_iterations of 'register_image'.
+    * 'register_image_within' runs the same check before its full resolution
+    * stage. Needs at least 2 levels.
+    */
+    inline void set_tracking_loss_check(
+            bool      i_enable,
+            FloatPrec i_min_ncc = 0.5,
+            uint32_t  i_nb_coarse_iterations = 3) {
+        m_loss_check = i_enable;
+        m_loss_min_ncc = i_min_ncc;
+        m_loss_nb_coarse_iterations = i_nb_coarse_iterations;
+    }
+
+    /*
+    * confidence (mean coarse level NCC) computed by the last tracking loss
+    * check
+    */
+    inline FloatPrec last_confidence() const {return m_last_confidence;}
+
+    /*
+    * jacobian reuse statistics, accumulated over the registrations since the
+    * last reset: number of jacobian computations, of iterations that reused
+    * the reference jacobian, and of rejected steps.
+    */
+    inline uint32_t nb_jacobian_computations() const {return m_nb_jaco_computations;}
+    inline uint32_t nb_jacobian_reuses() const {return m_nb_jaco_reuses;}
+    inline uint32_t nb_rejected_steps() const {return m_nb_rejected_steps;}
+    inline void reset_jacobian_reuse_stats() {
+        m_nb_jaco_computations = 0;
+        m_nb_jaco_reuses = 0;
+        m_nb_rejected_steps = 0;
+    }
+
+    /*
+    * stop iterating once the largest vertex coordinate update (in full
+    * resolution pixels) falls below i_threshold (0: always run all iterations)
+    */
+    inline void set_convergence_threshold(FloatPrec i_threshold) {
+        m_convergence_threshold = i_threshold;
+    }
+
+    /*
+    * enable/configure the coarse exhaustive search initializer.
+    * When enabled, 'register_image' first renders the template at the
+    * coarsest level for each candidate scale and rotation of the initial quad
+    * (around its center), searches the best SAD/SSD/NCC match over all the
+    * translations within the search radius, and starts the Gauss-Newton loop
+    * from the best candidate. In roi mode, the motion margin should cover the
+    * search radius (radius / coarsest level ratio full resolution pixels).
+    */
+    inline void set_coarse_search(const CoarseSearchParams & i_params) {
+        m_coarse_search = i_params;
+    }
+
+    /*
+    * number of threads computing the jacobian pixels of a registration
+    * (OpenMP builds only, 1: single threaded)
+    */
+    inline void set_nb_threads(uint32_t i_nb_threads) {
+        m_nb_threads = std::max(1u, i_nb_threads);
+    }
+
+    /*
+    * apply the registration settings of a solver configuration (roi mode,
+    * update mode, convergence threshold and threads; the template geometry
+    * is the model's)
+    */
+    void
+    set_config(
+            const DenseImageRegistrationConfig<FloatPrec> & i_config);
+
+    /*
+    * number of iterations run in the last call to 'register_image'
+    */
+    inline uint32_t last_nb_iterations() const {return m_last_nb_iterations;}
+
+    /*
+    * deadline-bounded registration statistics: finest level used by the
+    * returned quad (0: full resolution) and its cost (mean squared pixel
+    * error over the levels of that stage).
+    */
+    inline uint32_t last_finest_level() const {return m_last_finest_lvl;}
+    inline FloatPrec last_cost() const {return m_last_cost;}
+
+    /*
+    * state of the last registration: whether its pyramid is still available
+    * (not after a TrackingLost registration), the pyramid itself (built over
+    * 'last_reg_roi') and the registered quad.
+    */
+    inline bool has_registered_image() const {return m_reg_pyr_is_valid;}
+    inline const LvlList_Images & last_reg_pyramid() const {return m_reg_im_pyr;}
+    inline const VecN & last_reg_pts() const {return m_curr_pts;}
+
+private: // private typedefs
+    typedef typename Types::LvlList_VecN  LvlList_VecN;
+    typedef typename Types::LvlList_MatN2 LvlList_MatN2;
+    typedef typename Types::LvlList_MatNN LvlList_MatNN;
+private:
+    std::shared_ptr<const Model> m_model;
+    uint32_t       m_model_nb_levels = 0; // model geometry at the last 'set_model'
+    FloatPrec      m_model_lvl_resz_ratio = 0.;
+    FloatPrec      m_model_normz_factor = 0.;
+    LvlList_MatN2  m_lvl_gridpts_eigen;
+    Common::BoxDownsampler<FloatPrec> m_downsampler;
+    LvlList_Images m_reg_im_pyr; // registration image resolution pyramid
+    LvlList_Images m_reg_im_gradx_pyr;
+    LvlList_Images m_reg_im_grady_pyr;
+    bool           m_roi_mode = false;
+    FloatPrec      m_roi_motion_margin = 32.;
+    ImDim          m_reg_imdim;
+    Common::ImRoi  m_reg_roi; // area of the reg. image covered by the pyramid
+    uint32_t       m_nb_roi_grows = 0;
+    bool           m_reg_pyr_is_valid = false; // set by 'register_image'
+    UpdateMode     m_update_mode = GaussNewtonUpdate;
+    FloatPrec      m_convergence_threshold = 0.;
+    uint32_t       m_nb_threads = 1;
+    uint32_t       m_last_nb_iterations = 0;
+    uint32_t       m_last_finest_lvl = 0;
+    FloatPrec      m_last_cost = 0.;
+    // jacobian reuse (quasi-Newton mode): m_mr_jaco is the reference
+    // jacobian computed at m_jref_pts, m_mr_jTj the Hessian approximation
+    bool           m_jaco_reuse = false;
+    FloatPrec      m_jaco_reuse_max_dist = 1.;
+    bool           m_jref_is_valid = false;
+    VecN           m_jref_pts;
+    VecN           m_prev_pts;
+    VecN           m_prev_errs;
+    VecN           m_prev_jTb;
+    VecN           m_bfgs_s;
+    VecN           m_bfgs_y;
+    VecN           m_bfgs_Hs;
+    uint32_t       m_nb_jaco_computations = 0;
+    uint32_t       m_nb_jaco_reuses = 0;
+    uint32_t       m_nb_rejected_steps = 0;
+    // tracking loss check
+    bool           m_loss_check = false;
+    FloatPrec      m_loss_min_ncc = 0.5;
+    uint32_t       m_loss_nb_coarse_iterations = 3;
+    FloatPrec      m_last_confidence = 0.;
+    VecN           m_loss_init_pts;
+    // lockstep registration image
+    Common::ImView<unsigned char> m_lockstep_image;
+    // coarse search initializer
+    CoarseSearchParams     m_coarse_search;
+    std::vector<uint8_t>   m_coarse_im_u8;
+    std::vector<uint8_t>   m_coarse_patch_u8;
+    std::vector<uint8_t>   m_coarse_mask_u8;
+    Common::IntegralImages m_coarse_integral;
+    // solver containers
+    VecN           m_delta_vars;
+    LvlList_VecN   m_lvl_errs;
+    LvlList_MatNN  m_lvl_jacos;
+    LvlList_MatNN  m_lvl_jTj;
+    LvlList_VecN   m_lvl_jTb;
+    VecN           m_mr_errs; // mr: multi resolution
+    MatrixNN       m_mr_jaco;
+    MatrixNN       m_mr_jTj;
+    VecN           m_mr_jTb;
+    VecN           m_curr_pts;
+    VecN           m_best_pts; // lowest cost quad (deadline-bounded registration)
+private:
+    // The following makes the copy contructor and the assignment operator
+    // private to emulate a "non-copyable" class.
+    DenseImageRegistrationWorkspace(DenseImageRegistrationWorkspace const &);
+    DenseImageRegistrationWorkspace & operator = (DenseImageRegistrationWorkspace const &);
+private:
+    /*
+    * registration loop, for any registration image source (image view or
+    * tiled pyramid file). i_roi_mode overrides the workspace roi mode.
+    */
+    template <typename RegSource>
+    Common::ErrCode
+    register_image_from(
+            RegSource &              io_reg_source,
+            bool                     i_roi_mode,
+            uint32_t                 i_nb_iterations,
+            std::vector<FloatPrec> & io_reg_pts);
+
+    /*
+    * Gauss-Newton iterations from m_curr_pts, reusing the reference jacobian
+    * while the quad stays close to it (see 'set_jacobian_reuse')
+    */
+    template <typename RegSource>
+    Common::ErrCode
+    run_jacobian_reuse_iterations(
+            RegSource &              io_reg_source,
+            bool                     i_roi_mode,
+            uint32_t                 i_nb_iterations);
+
+    /*
+    * Gauss-Newton iterations from m_curr_pts on the levels from i_first_lvl
+    * on only (the rows of the other levels are left untouched)
+    */
+    template <typename RegSource>
+    Common::ErrCode
+    run_stage_iterations(
+            RegSource &              io_reg_source,
+            bool                     i_roi_mode,
+            uint32_t                 i_first_lvl,
+            uint32_t                 i_nb_iterations);
+
+    /*
+    * tracking loss check of the quad i_pts on the coarse levels (see
+    * 'set_tracking_loss_check'), i_init_pts is the initial quad
+    */
+    bool
+    track_is_lost(
+            const VecN & i_pts,
+            const VecN & i_init_pts);
+
+    /*
+    * coarse to fine, deadline-bounded registration loop (see
+    * 'register_image_within')
+    */
+    template <typename RegSource>
+    Common::ErrCode
+    register_image_within_from(
+            RegSource &              io_reg_source,
+            bool                     i_roi_mode,
+            double                   i_time_budget_us,
+            uint32_t                 i_nb_iterations,
+            std::vector<FloatPrec> & io_reg_pts,
+            RegistrationStatus &     o_status);
+
+    /*
+    * build the registration pyramid of a new registration image around the
+    * initial quad m_curr_pts (roi mode) or over the full image, and run the
+    * coarse search initializer if enabled.
+    */
+    template <typename RegSource>
+    Common::ErrCode
+    prepare_reg_pyramid(
+            RegSource &              io_reg_source,
+            bool                     i_roi_mode);
+
+    /*
+    * build the registration image pyramid (float levels and gradients) over
+    * the region i_roi of the input image.
+    */
+    Common::ErrCode
+    build_reg_pyramid(
+            const Common::ImView<unsigned char> & i_reg_image,
+            const Common::ImRoi &                 i_roi);
+
+    /*
+    * same as above, from an RGB image (luma conversion fused with the
+    * pyramid build)
+    */
+    Common::ErrCode
+    build_reg_pyramid(
+            const Common::RgbImView &             i_reg_image,
+            const Common::ImRoi &                 i_roi);
+
+    /*
+    * same as above, reading the levels from a tiled pyramid file. The roi
+    * origin is aligned down on whole coarsest level pixels.
+    */
+    Common::ErrCode
+    build_reg_pyramid(
+            Common::TiledPyramidReader & io_reg_source,
+            const Common::ImRoi &        i_roi);
+
+    /*
+    * compute the gradients of the registration pyramid levels
+    */
+    void
+    compute_reg_pyramid_gradients();
+
+    /*
+    * check whether the quad defined by i_pts stays far enough from the border
+    * of the current pyramid roi (roi mode only).
+    */
+    bool
+    quad_is_inside_roi(
+            const VecN & i_pts) const;
+
+    /*
+    * in roi mode, grow the roi (and rebuild the pyramid) if the quad defined
+    * by i_pts drifted toward its border
+    */
+    template <typename RegSource>
+    Common::ErrCode
+    grow_roi_if_needed(
+            RegSource &    io_reg_source,
+            bool           i_roi_mode,
+            const VecN &   i_pts);
+
+    /*
+    * exhaustive translation (and optionally scale/rotation) search of the
+    * template at the coarsest pyramid level, around the quad io_pts.
+    */
+    void
+    coarse_init_search(
+            VecN & io_pts);
+
+    /*
+    * compute the sampling coordinates of the level template grid in the
+    * level pyramid image for a given configuration of points
+    */
+    void
+    compute_lvl_grid_coords(
+            const VecN & i_pts,
+            uint32_t     i_lvl);
+
+    /*
+    * compute multi-resolution pixel error vector for a given configuration of
+    * points. Only the levels from i_first_lvl on are computed (coarse to fine
+    * stages), in their usual rows.
+    */
+    void
+    compute_multires_pix_error(
+            const VecN & i_pts,
+            VecN &       o_mr_pix_err,
+            uint32_t     i_first_lvl = 0);
+
+    /*
+    * compute pixel error vector for a given configuration of
+    * points for a given resoltion level
+    */
+    void
+    compute_lvl_pix_error(
+            const VecN & i_pts,
+            uint32_t     i_lvl,
+            VecN &       o_lvl_pix_err);
+
+    /*
+    * compute multi-resolution pixel jacobian matrix for a given configuration of
+    * points (levels from i_first_lvl on, see 'compute_multires_pix_error')
+    */
+    void
+    compute_multires_pix_jacobian(
+            const VecN & i_pts,
+            MatrixNN &   o_mr_pix_jaco,
+            uint32_t     i_first_lvl = 0);
+
+    /*
+    * compute pixel jacobian matrix for a given configuration of
+    * points for a given resoltion level
+    */
+    void
+    compute_lvl_pix_jacobian(
+            const VecN & i_pts,
+            uint32_t     i_lvl,
+            MatrixNN &   o_lvl_pix_jaco);
+};
+
+#include "dense_im_reg_cpu_workspace.inl.hpp"
+
+#endif /* _DENSE_IM_REG_CPU_WORKSPACE_HPP *  * */
@@ -0,0 +1,1136 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+/*
+* Template member functions definition for dense_im_reg_cpu_workspace.hpp
+*/
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::set_model(
+        const std::shared_ptr<const Model> & i_model)
+{
+    if (!i_model || !i_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+
+    // the last registration pyramid stays usable if it was built with the
+    // same level geometry and normalization. The geometry is compared to the
+    // one recorded at the last call, as the model may have been changed in
+    // place since (solver facade with an unshared model).
+    const bool same_geometry = m_model
+            && (m_model_nb_levels == i_model->nb_levels())
+            && (m_model_lvl_resz_ratio == i_model->lvl_resz_ratio())
+            && (m_model_normz_factor == i_model->normz_factor());
+    m_reg_pyr_is_valid = m_reg_pyr_is_valid && same_geometry;
+    m_jref_is_valid = false; // the templates may have changed
+    m_model = i_model;
+    m_model_nb_levels = m_model->nb_levels();
+    m_model_lvl_resz_ratio = m_model->lvl_resz_ratio();
+    m_model_normz_factor = m_model->normz_factor();
+
+    // initialize container member variables
+    const uint32_t nb_levels = m_model->nb_levels();
+    const uint32_t nb_vars = 4 * 2; // 4 corner points of 2 coordinates each
+    uint32_t nb_mr_err_comp = 0;
+    m_lvl_gridpts_eigen.resize(nb_levels);
+    m_reg_im_pyr.resize(nb_levels);
+    m_reg_im_gradx_pyr.resize(nb_levels);
+    m_reg_im_grady_pyr.resize(nb_levels);
+    m_curr_pts.resize(nb_vars);
+    m_best_pts.resize(nb_vars);
+    m_lvl_errs.resize(nb_levels);
+    m_lvl_jacos.resize(nb_levels);
+    m_lvl_jTj.resize(nb_levels);
+    m_lvl_jTb.resize(nb_levels);
+    for (uint32_t i_lvl = 0; i_lvl<nb_levels; ++i_lvl)
+    {
+        const uint32_t nb_lvl_err_comp = m_model->lvl_templdim(i_lvl).size();
+        m_lvl_gridpts_eigen[i_lvl].resize(nb_lvl_err_comp, 2);
+        m_lvl_errs[i_lvl].resize(nb_lvl_err_comp);
+        m_lvl_jacos[i_lvl].resize(nb_lvl_err_comp, nb_vars);
+        m_lvl_jTj[i_lvl].resize(nb_vars, nb_vars);
+        m_lvl_jTb[i_lvl].resize(nb_vars);
+        nb_mr_err_comp += nb_lvl_err_comp;
+    }
+    m_mr_errs.resize(nb_mr_err_comp);
+    m_mr_jaco.resize(nb_mr_err_comp, nb_vars);
+    m_mr_jTj.resize(nb_vars, nb_vars);
+    m_mr_jTb.resize(nb_vars);
+    m_delta_vars.resize(nb_vars);
+    m_jref_pts.resize(nb_vars);
+    m_prev_pts.resize(nb_vars);
+    m_prev_errs.resize(nb_mr_err_comp);
+    m_prev_jTb.resize(nb_vars);
+    m_bfgs_s.resize(nb_vars);
+    m_bfgs_y.resize(nb_vars);
+    m_bfgs_Hs.resize(nb_vars);
+
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::set_config(
+        const DenseImageRegistrationConfig<FloatPrec> & i_config)
+{
+    set_roi_mode(i_config.m_roi_mode, i_config.m_roi_motion_margin);
+    set_update_mode(i_config.m_esm_update ? ESMUpdate : GaussNewtonUpdate);
+    set_convergence_threshold(i_config.m_convergence_threshold);
+    set_nb_threads(i_config.m_nb_threads);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image(
+        const cimg_library::CImg<unsigned char> & i_reg_image,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts)
+{
+    if (i_reg_image.spectrum() == 3) {
+        return register_image(Common::rgb_view_from_cimg(i_reg_image),
+                i_nb_iterations, io_reg_pts);
+    }
+    return register_image(Common::im_view_from_cimg(i_reg_image),
+            i_nb_iterations, io_reg_pts);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image(
+        const Common::ImView<unsigned char> &     i_reg_image,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts)
+{
+    if (!m_model || !m_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_model->template_is_set()) {
+        return Common::TemplateNotSet;
+    }
+    if ((i_reg_image.width() < 2) || (i_reg_image.height() < 2)) {
+        return Common::UnsupportedImageFormat;
+    }
+    return register_image_from(i_reg_image, m_roi_mode, i_nb_iterations, io_reg_pts);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image(
+        const Common::RgbImView &                 i_reg_image,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts)
+{
+    if (!m_model || !m_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_model->template_is_set()) {
+        return Common::TemplateNotSet;
+    }
+    if ((i_reg_image.width() < 2) || (i_reg_image.height() < 2)) {
+        return Common::UnsupportedImageFormat;
+    }
+    return register_image_from(i_reg_image, m_roi_mode, i_nb_iterations, io_reg_pts);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image(
+        Common::TiledPyramidReader &              io_reg_source,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts)
+{
+    if (!m_model || !m_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_model->template_is_set()) {
+        return Common::TemplateNotSet;
+    }
+    // the file levels must be the registration pyramid levels, and the level
+    // regions must start on whole pixels of every level (see
+    // 'build_reg_pyramid'), i.e. 1 / (coarsest level ratio) must be an integer
+    const uint32_t coarsest_lvl = m_model->nb_levels() - 1;
+    const FloatPrec inv_coarsest_ratio = 1. / m_model->lvl_abs_resz_ratio(coarsest_lvl);
+    if (!io_reg_source.is_open()
+            || (io_reg_source.nb_levels() < m_model->nb_levels())
+            || (std::abs(io_reg_source.lvl_resz_ratio() - m_model->lvl_resz_ratio()) > 1.e-6)
+            || (std::abs(inv_coarsest_ratio - std::floor(inv_coarsest_ratio + 0.5)) > 1.e-3)) {
+        return Common::UnsupportedImageFormat;
+    }
+    // only the quad footprint is ever loaded: always in roi mode
+    return register_image_from(io_reg_source, true, i_nb_iterations, io_reg_pts);
+}
+
+
+template <typename FloatPrec>
+template <typename RegSource>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image_from(
+        RegSource &                               io_reg_source,
+        bool                                      i_roi_mode,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts)
+{
+    Common::ErrCode errCode = Common::NoError;
+    typedef typename Eigen::Map<VecN> VecN_Map;
+    VecN_Map io_reg_pts_eigen(&(io_reg_pts[0]), m_delta_vars.size());
+    m_curr_pts = io_reg_pts_eigen;
+
+    errCode = prepare_reg_pyramid(io_reg_source, i_roi_mode);
+    if (errCode != Common::NoError) { return errCode; }
+
+    m_last_nb_iterations = 0;
+    if (m_loss_check && (m_model->nb_levels() > 1)) {
+        // align on the coarse levels, and give up before the full resolution
+        // level if the track is lost
+        m_loss_init_pts = m_curr_pts;
+        errCode = run_stage_iterations(io_reg_source, i_roi_mode, 1,
+                std::min(i_nb_iterations, m_loss_nb_coarse_iterations));
+        if (errCode != Common::NoError) { return errCode; }
+        if (track_is_lost(m_curr_pts, m_loss_init_pts)) {
+            // nothing was registered: no template refresh from the lost quad
+            m_curr_pts = m_loss_init_pts;
+            m_reg_pyr_is_valid = false;
+            return Common::TrackingLost;
+        }
+    }
+    if (m_jaco_reuse) {
+        errCode = run_jacobian_reuse_iterations(
+                io_reg_source, i_roi_mode, i_nb_iterations);
+        if (errCode != Common::NoError) { return errCode; }
+        io_reg_pts_eigen = m_curr_pts;
+        return Common::NoError;
+    }
+    for (uint32_t i_i = 0; i_i< i_nb_iterations; ++i_i)
+    {
+        // compute error
+        compute_multires_pix_error(m_curr_pts, m_mr_errs);
+
+        // compute error jacobian
+        compute_multires_pix_jacobian(m_curr_pts, m_mr_jaco);
+
+        // optimization step
+        Common::gauss_newton_descent_step(
+                    m_mr_errs, m_mr_jaco,
+                    m_mr_jTj, m_mr_jTb,
+                    m_delta_vars);
+
+        m_curr_pts += m_delta_vars;
+        m_last_nb_iterations++;
+
+        if (m_delta_vars.cwiseAbs().maxCoeff() < m_convergence_threshold) {
+            break;
+        }
+
+        errCode = grow_roi_if_needed(io_reg_source, i_roi_mode, m_curr_pts);
+        if (errCode != Common::NoError) { return errCode; }
+    }
+
+    io_reg_pts_eigen = m_curr_pts;
+
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+template <typename RegSource>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::run_jacobian_reuse_iterations(
+        RegSource &                               io_reg_source,
+        bool                                      i_roi_mode,
+        uint32_t                                  i_nb_iterations)
+{
+    Common::ErrCode errCode = Common::NoError;
+    bool has_prev = false; // m_prev_* hold the previous iterate
+    bool prev_step_reused = false;
+    bool force_computation = false;
+    FloatPrec prev_cost = 0.;
+    for (uint32_t i_i = 0; i_i< i_nb_iterations; ++i_i)
+    {
+        compute_multires_pix_error(m_curr_pts, m_mr_errs);
+        FloatPrec cost = m_mr_errs.squaredNorm();
+
+        // cost-decrease test of the last step, if it reused the jacobian: if
+        // the cost increased, reject it and linearize again at the previous
+        // iterate
+        if (has_prev && prev_step_reused && (cost > prev_cost)) {
+            m_curr_pts = m_prev_pts;
+            m_mr_errs.swap(m_prev_errs);
+            cost = prev_cost;
+            has_prev = false;
+            force_computation = true;
+            m_nb_rejected_steps++;
+        }
+
+        const bool reuse = !force_computation && m_jref_is_valid
+                && ((m_curr_pts - m_jref_pts).cwiseAbs().maxCoeff() < m_jaco_reuse_max_dist);
+        if (reuse) {
+            // gradient with the reference jacobian, and BFGS correction of
+            // the Hessian approximation H with the last step s and gradient
+            // change y: H += y^T y / (s.y) - (s H)^T (s H) / (s H s^T)
+            m_mr_jTb.noalias() = m_mr_errs * m_mr_jaco;
+            if (has_prev) {
+                m_bfgs_s = m_curr_pts - m_prev_pts;
+                m_bfgs_y = m_mr_jTb - m_prev_jTb;
+                m_bfgs_Hs.noalias() = m_bfgs_s * m_mr_jTj;
+                const FloatPrec sy = m_bfgs_s.dot(m_bfgs_y);
+                const FloatPrec sHs = m_bfgs_Hs.dot(m_bfgs_s);
+                const FloatPrec eps = std::numeric_limits<FloatPrec>::epsilon();
+                // curvature condition, keeps H positive definite
+                if ((sy > eps * m_bfgs_s.squaredNorm()) && (sHs > eps)) {
+                    m_mr_jTj.noalias() += (1. / sy) * (m_bfgs_y.transpose() * m_bfgs_y);
+                    m_mr_jTj.noalias() -= (1. / sHs) * (m_bfgs_Hs.transpose() * m_bfgs_Hs);
+                }
+            }
+            m_nb_jaco_reuses++;
+        } else {
+            compute_multires_pix_jacobian(m_curr_pts, m_mr_jaco);
+            m_mr_jTj.noalias() = m_mr_jaco.transpose() * m_mr_jaco;
+            m_mr_jTb.noalias() = m_mr_errs * m_mr_jaco;
+            m_jref_pts = m_curr_pts;
+            m_jref_is_valid = true;
+            force_computation = false;
+            m_nb_jaco_computations++;
+        }
+        m_delta_vars = -(m_mr_jTj.ldlt().solve(m_mr_jTb.transpose())).transpose();
+
+        m_prev_pts = m_curr_pts;
+        m_prev_errs = m_mr_errs;
+        m_prev_jTb = m_mr_jTb;
+        prev_cost = cost;
+        has_prev = true;
+        prev_step_reused = reuse;
+
+        m_curr_pts += m_delta_vars;
+        m_last_nb_iterations++;
+
+        errCode = grow_roi_if_needed(io_reg_source, i_roi_mode, m_curr_pts);
+        if (errCode != Common::NoError) { return errCode; }
+
+        if (m_delta_vars.cwiseAbs().maxCoeff() < m_convergence_threshold) {
+            break;
+        }
+    }
+
+    // the last step has not been evaluated: check it if it reused the jacobian
+    if (has_prev && prev_step_reused) {
+        compute_multires_pix_error(m_curr_pts, m_mr_errs);
+        if (m_mr_errs.squaredNorm() > prev_cost) {
+            m_curr_pts = m_prev_pts;
+            m_nb_rejected_steps++;
+        }
+    }
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::begin_lockstep(
+        const Common::ImView<unsigned char> &     i_reg_image,
+        const std::vector<FloatPrec> &            i_reg_pts)
+{
+    if (!m_model || !m_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_model->template_is_set()) {
+        return Common::TemplateNotSet;
+    }
+    if ((i_reg_image.width() < 2) || (i_reg_image.height() < 2)) {
+        return Common::UnsupportedImageFormat;
+    }
+    if (m_jaco_reuse || m_loss_check) {
+        return Common::UnsupportedLockstepMode;
+    }
+    m_lockstep_image = i_reg_image;
+    m_curr_pts = Eigen::Map<const VecN>(&(i_reg_pts[0]), m_delta_vars.size());
+    m_last_nb_iterations = 0;
+    return prepare_reg_pyramid(m_lockstep_image, m_roi_mode);
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_normal_equations()
+{
+    m_jref_is_valid = false; // the jacobian is overwritten
+    compute_multires_pix_error(m_curr_pts, m_mr_errs);
+    compute_multires_pix_jacobian(m_curr_pts, m_mr_jaco);
+    m_mr_jTj.noalias() = m_mr_jaco.transpose() * m_mr_jaco;
+    m_mr_jTb.noalias() = m_mr_errs * m_mr_jaco;
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::apply_step(
+        const VecN &                              i_delta,
+        bool &                                    o_converged)
+{
+    m_delta_vars = i_delta;
+    m_curr_pts += m_delta_vars;
+    m_last_nb_iterations++;
+
+    o_converged = (m_delta_vars.cwiseAbs().maxCoeff() < m_convergence_threshold);
+    if (o_converged) {
+        return Common::NoError;
+    }
+    return grow_roi_if_needed(m_lockstep_image, m_roi_mode, m_curr_pts);
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::end_lockstep(
+        std::vector<FloatPrec> &                  o_reg_pts) const
+{
+    o_reg_pts.resize(m_curr_pts.size());
+    for (uint32_t i_c = 0; i_c<o_reg_pts.size(); ++i_c) {
+        o_reg_pts[i_c] = m_curr_pts(i_c);
+    }
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::time_iteration_stages(
+        double &                                  o_error_us,
+        double &                                  o_jacobian_us,
+        double &                                  o_normal_eq_us,
+        double &                                  o_solve_us)
+{
+    m_jref_is_valid = false; // the jacobian is overwritten
+    Common::Timer stage_timer;
+    compute_multires_pix_error(m_curr_pts, m_mr_errs);
+    o_error_us = stage_timer.elapsed_us();
+    stage_timer.reset();
+    compute_multires_pix_jacobian(m_curr_pts, m_mr_jaco);
+    o_jacobian_us = stage_timer.elapsed_us();
+    stage_timer.reset();
+    m_mr_jTj.noalias() = m_mr_jaco.transpose() * m_mr_jaco;
+    m_mr_jTb.noalias() = m_mr_errs * m_mr_jaco;
+    o_normal_eq_us = stage_timer.elapsed_us();
+    stage_timer.reset();
+    m_delta_vars = -(m_mr_jTj.ldlt().solve(m_mr_jTb.transpose())).transpose();
+    o_solve_us = stage_timer.elapsed_us();
+}
+
+
+template <typename FloatPrec>
+template <typename RegSource>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::run_stage_iterations(
+        RegSource &                               io_reg_source,
+        bool                                      i_roi_mode,
+        uint32_t                                  i_first_lvl,
+        uint32_t                                  i_nb_iterations)
+{
+    const uint32_t nb_mr_rows = m_mr_errs.size();
+    uint32_t stage_first_row = 0;
+    for (uint32_t i_lvl = 0; i_lvl<i_first_lvl; ++i_lvl) {
+        stage_first_row += m_model->lvl_templdim(i_lvl).size();
+    }
+    const uint32_t nb_stage_rows = nb_mr_rows - stage_first_row;
+    m_jref_is_valid = false; // part of the jacobian is overwritten
+    for (uint32_t i_i = 0; i_i<i_nb_iterations; ++i_i) {
+        compute_multires_pix_error(m_curr_pts, m_mr_errs, i_first_lvl);
+        compute_multires_pix_jacobian(m_curr_pts, m_mr_jaco, i_first_lvl);
+        Common::gauss_newton_descent_step(
+                    m_mr_errs.tail(nb_stage_rows),
+                    m_mr_jaco.bottomRows(nb_stage_rows),
+                    m_mr_jTj, m_mr_jTb,
+                    m_delta_vars);
+        m_curr_pts += m_delta_vars;
+        m_last_nb_iterations++;
+
+        const Common::ErrCode errCode = grow_roi_if_needed(
+                io_reg_source, i_roi_mode, m_curr_pts);
+        if (errCode != Common::NoError) { return errCode; }
+
+        if (m_delta_vars.cwiseAbs().maxCoeff() < m_convergence_threshold) {
+            break;
+        }
+    }
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+bool
+DenseImageRegistrationWorkspace<FloatPrec>::track_is_lost(
+        const VecN & i_pts,
+        const VecN & i_init_pts)
+{
+    // quad degeneracy: the quad must stay convex, with the orientation and
+    // roughly the area of the initial quad
+    FloatPrec area = 0.;
+    FloatPrec init_area = 0.;
+    bool is_convex = true;
+    for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+        const uint32_t i_next = (i_pt + 1) % 4;
+        const uint32_t i_next2 = (i_pt + 2) % 4;
+        area += 0.5 * (i_pts(2*i_pt) * i_pts(2*i_next + 1)
+                - i_pts(2*i_next) * i_pts(2*i_pt + 1));
+        init_area += 0.5 * (i_init_pts(2*i_pt) * i_init_pts(2*i_next + 1)
+                - i_init_pts(2*i_next) * i_init_pts(2*i_pt + 1));
+        const FloatPrec turn =
+                (i_pts(2*i_next) - i_pts(2*i_pt)) * (i_pts(2*i_next2 + 1) - i_pts(2*i_next + 1))
+                - (i_pts(2*i_next + 1) - i_pts(2*i_pt + 1)) * (i_pts(2*i_next2) - i_pts(2*i_next));
+        const FloatPrec init_turn =
+                (i_init_pts(2*i_next) - i_init_pts(2*i_pt))
+                * (i_init_pts(2*i_next2 + 1) - i_init_pts(2*i_next + 1))
+                - (i_init_pts(2*i_next + 1) - i_init_pts(2*i_pt + 1))
+                * (i_init_pts(2*i_next2) - i_init_pts(2*i_next));
+        is_convex = is_convex && (turn * init_turn > 0);
+    }
+    const FloatPrec area_ratio = area / init_area;
+    m_last_confidence = 0.;
+    if (!is_convex || !(area_ratio > 0.25) || !(area_ratio < 4.)) {
+        return true;
+    }
+
+    // mean NCC between the coarse level templates and the warped patches
+    const uint32_t nb_levels = m_model->nb_levels();
+    compute_multires_pix_error(i_pts, m_mr_errs, 1);
+    for (uint32_t i_lvl = 1; i_lvl<nb_levels; ++i_lvl) {
+        const VecN & templ = m_model->lvl_template(i_lvl);
+        const uint32_t nb_pix = templ.size();
+        const FloatPrec templ_mean = templ.mean();
+        // warped patch = error + template
+        const FloatPrec patch_mean = m_lvl_errs[i_lvl].mean() + templ_mean;
+        FloatPrec cov = 0.;
+        FloatPrec templ_var = 0.;
+        FloatPrec patch_var = 0.;
+        for (uint32_t i_pix = 0; i_pix<nb_pix; ++i_pix) {
+            const FloatPrec t = templ(i_pix) - templ_mean;
+            const FloatPrec p = m_lvl_errs[i_lvl](i_pix) + templ(i_pix) - patch_mean;
+            cov += t * p;
+            templ_var += t * t;
+            patch_var += p * p;
+        }
+        const FloatPrec denom = std::sqrt(templ_var * patch_var);
+        const FloatPrec ncc = (denom > std::numeric_limits<FloatPrec>::epsilon()) ?
+                cov / denom : (FloatPrec)0.;
+        m_last_confidence += ncc / (nb_levels - 1);
+    }
+    return !(m_last_confidence >= m_loss_min_ncc);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image_within(
+        const cimg_library::CImg<unsigned char> & i_reg_image,
+        double                                    i_time_budget_us,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts,
+        RegistrationStatus &                      o_status)
+{
+    if (i_reg_image.spectrum() == 3) {
+        return register_image_within(Common::rgb_view_from_cimg(i_reg_image),
+                i_time_budget_us, i_nb_iterations, io_reg_pts, o_status);
+    }
+    return register_image_within(Common::im_view_from_cimg(i_reg_image),
+            i_time_budget_us, i_nb_iterations, io_reg_pts, o_status);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image_within(
+        const Common::ImView<unsigned char> &     i_reg_image,
+        double                                    i_time_budget_us,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts,
+        RegistrationStatus &                      o_status)
+{
+    if (!m_model || !m_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_model->template_is_set()) {
+        return Common::TemplateNotSet;
+    }
+    if ((i_reg_image.width() < 2) || (i_reg_image.height() < 2)) {
+        return Common::UnsupportedImageFormat;
+    }
+    return register_image_within_from(i_reg_image, m_roi_mode,
+            i_time_budget_us, i_nb_iterations, io_reg_pts, o_status);
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image_within(
+        const Common::RgbImView &                 i_reg_image,
+        double                                    i_time_budget_us,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts,
+        RegistrationStatus &                      o_status)
+{
+    if (!m_model || !m_model->is_init()) {
+        return Common::SolverNotInitialized;
+    }
+    if (!m_model->template_is_set()) {
+        return Common::TemplateNotSet;
+    }
+    if ((i_reg_image.width() < 2) || (i_reg_image.height() < 2)) {
+        return Common::UnsupportedImageFormat;
+    }
+    return register_image_within_from(i_reg_image, m_roi_mode,
+            i_time_budget_us, i_nb_iterations, io_reg_pts, o_status);
+}
+
+
+template <typename FloatPrec>
+template <typename RegSource>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::register_image_within_from(
+        RegSource &                               io_reg_source,
+        bool                                      i_roi_mode,
+        double                                    i_time_budget_us,
+        uint32_t                                  i_nb_iterations,
+        std::vector<FloatPrec> &                  io_reg_pts,
+        RegistrationStatus &                      o_status)
+{
+    const Common::Timer deadline_timer;
+    if (m_jaco_reuse) {
+        return Common::UnsupportedDeadlineMode;
+    }
+    Common::ErrCode errCode = Common::NoError;
+    typedef typename Eigen::Map<VecN> VecN_Map;
+    VecN_Map io_reg_pts_eigen(&(io_reg_pts[0]), m_delta_vars.size());
+    m_curr_pts = io_reg_pts_eigen;
+
+    errCode = prepare_reg_pyramid(io_reg_source, i_roi_mode);
+    if (errCode != Common::NoError) { return errCode; }
+    m_jref_is_valid = false; // the stages overwrite part of the jacobian
+
+    const uint32_t nb_levels = m_model->nb_levels();
+    const uint32_t nb_mr_rows = m_mr_errs.size();
+    o_status = RegDeadlineReached;
+    m_last_nb_iterations = 0;
+    m_best_pts = m_curr_pts;
+    m_last_finest_lvl = nb_levels - 1;
+    m_last_cost = std::numeric_limits<FloatPrec>::max();
+    // measured duration of an iteration per template pixel, to predict
+    // whether the next one fits in the remaining time
+    double iter_us_per_pixel = 0.;
+
+    // stages: levels [stage_lvl, nb_levels), from the coarsest level alone to
+    // the full multi-resolution problem. The rows of the levels of a stage are
+    // the last rows of the multi-resolution error and jacobian.
+    uint32_t stage_first_row = nb_mr_rows;
+    for (uint32_t i_st = 0; i_st<nb_levels; ++i_st) {
+        const uint32_t stage_lvl = nb_levels - 1 - i_st;
+        stage_first_row -= m_model->lvl_templdim(stage_lvl).size();
+        const uint32_t nb_stage_rows = nb_mr_rows - stage_first_row;
+        if ((i_st > 0) && (deadline_timer.elapsed_us()
+                + iter_us_per_pixel * nb_stage_rows > i_time_budget_us)) {
+            break; // no time left to improve on the previous stage
+        }
+        if ((stage_lvl == 0) && (nb_levels > 1) && m_loss_check
+                && track_is_lost(m_best_pts, io_reg_pts_eigen)) {
+            m_curr_pts = io_reg_pts_eigen;
+            m_reg_pyr_is_valid = false;
+            return Common::TrackingLost;
+        }
+
+        // stage starting point: the best quad of the previous stage
+        m_curr_pts = m_best_pts;
+        compute_multires_pix_error(m_curr_pts, m_mr_errs, stage_lvl);
+        m_last_cost = m_mr_errs.tail(nb_stage_rows).squaredNorm() / nb_stage_rows;
+        m_last_finest_lvl = stage_lvl;
+
+        bool stage_converged = false;
+        bool deadline_reached = false;
+        for (uint32_t i_i = 0; i_i<i_nb_iterations; ++i_i) {
+            // the first coarse iteration always runs, so that the returned
+            // quad is at least aligned on the coarsest level
+            if (((i_st > 0) || (i_i > 0)) && (deadline_timer.elapsed_us()
+                    + iter_us_per_pixel * nb_stage_rows > i_time_budget_us)) {
+                deadline_reached = true;
+                break;
+            }
+            const Common::Timer iter_timer;
+
+            compute_multires_pix_jacobian(m_curr_pts, m_mr_jaco, stage_lvl);
+            Common::gauss_newton_descent_step(
+                        m_mr_errs.tail(nb_stage_rows),
+                        m_mr_jaco.bottomRows(nb_stage_rows),
+                        m_mr_jTj, m_mr_jTb,
+                        m_delta_vars);
+            m_curr_pts += m_delta_vars;
+            m_last_nb_iterations++;
+
+            errCode = grow_roi_if_needed(io_reg_source, i_roi_mode, m_curr_pts);
+            if (errCode != Common::NoError) { return errCode; }
+
+            // cost of the new quad (also the error of the next iteration)
+            compute_multires_pix_error(m_curr_pts, m_mr_errs, stage_lvl);
+            const FloatPrec cost =
+                    m_mr_errs.tail(nb_stage_rows).squaredNorm() / nb_stage_rows;
+            if (cost < m_last_cost) {
+                m_last_cost = cost;
+                m_best_pts = m_curr_pts;
+            }
+            iter_us_per_pixel = iter_timer.elapsed_us() / nb_stage_rows;
+
+            if (m_delta_vars.cwiseAbs().maxCoeff() < m_convergence_threshold) {
+                stage_converged = true;
+                break;
+            }
+        }
+        if (deadline_reached) {
+            break;
+        }
+        if (stage_lvl == 0) {
+            o_status = stage_converged ? RegConverged : RegIterationsDone;
+        }
+    }
+
+    m_curr_pts = m_best_pts;
+    io_reg_pts_eigen = m_best_pts;
+
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+template <typename RegSource>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::prepare_reg_pyramid(
+        RegSource &                               io_reg_source,
+        bool                                      i_roi_mode)
+{
+    // build the registration pyramid, on the full image or only around the
+    // initial quad in roi mode.
+    m_reg_imdim = ImDim(io_reg_source.width(), io_reg_source.height());
+    m_nb_roi_grows = 0;
+    Common::ImRoi reg_roi(0, 0, m_reg_imdim.width(), m_reg_imdim.height());
+    if (i_roi_mode) {
+        reg_roi = Common::quad_bounding_roi(&(m_curr_pts(0)),
+                m_roi_motion_margin, m_reg_imdim.width(), m_reg_imdim.height());
+    }
+    Common::ErrCode errCode = build_reg_pyramid(io_reg_source, reg_roi);
+    if (errCode != Common::NoError) { return errCode; }
+
+    if (m_coarse_search.m_enabled) {
+        coarse_init_search(m_curr_pts);
+        errCode = grow_roi_if_needed(io_reg_source, i_roi_mode, m_curr_pts);
+    }
+    return errCode;
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::build_reg_pyramid(
+            const Common::ImView<unsigned char> & i_reg_image,
+            const Common::ImRoi &                 i_roi)
+{
+    m_reg_roi = i_roi;
+    m_model->build_image_pyramid(i_reg_image, i_roi, m_downsampler, m_reg_im_pyr);
+    m_reg_pyr_is_valid = true;
+    compute_reg_pyramid_gradients();
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::build_reg_pyramid(
+            const Common::RgbImView &             i_reg_image,
+            const Common::ImRoi &                 i_roi)
+{
+    m_reg_roi = i_roi;
+    m_model->build_image_pyramid(i_reg_image, i_roi, m_downsampler, m_reg_im_pyr);
+    m_reg_pyr_is_valid = true;
+    compute_reg_pyramid_gradients();
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::build_reg_pyramid(
+            Common::TiledPyramidReader & io_reg_source,
+            const Common::ImRoi &        i_roi)
+{
+    // the level regions are cut out of the precomputed file levels: the roi
+    // origin is aligned so that it falls on a whole pixel of every level,
+    // then pixel x of a level region maps to ratio * (p - roi origin) as in
+    // the pyramids built from images.
+    const uint32_t nb_levels = m_model->nb_levels();
+    const uint32_t coarsest_lvl = nb_levels - 1;
+    const FloatPrec coarsest_ratio = m_model->lvl_abs_resz_ratio(coarsest_lvl);
+    const uint32_t align = (uint32_t)(1. / coarsest_ratio + 0.5);
+    uint32_t x0 = (i_roi.x0() / align) * align;
+    uint32_t y0 = (i_roi.y0() / align) * align;
+    // coarsest level region at least 2x2 pixels, if the image allows it
+    while ((x0 >= align) && ((uint32_t)(coarsest_ratio * x0) + 2
+            > io_reg_source.lvl_width(coarsest_lvl))) {
+        x0 -= align;
+    }
+    while ((y0 >= align) && ((uint32_t)(coarsest_ratio * y0) + 2
+            > io_reg_source.lvl_height(coarsest_lvl))) {
+        y0 -= align;
+    }
+    m_reg_roi = Common::ImRoi(x0, y0, i_roi.x1(), i_roi.y1());
+    m_reg_pyr_is_valid = false;
+
+    for (uint32_t i_lvl = 0; i_lvl<nb_levels; ++i_lvl) {
+        const FloatPrec lvl_ratio = m_model->lvl_abs_resz_ratio(i_lvl);
+        const uint32_t lvl_x0 = (uint32_t)(lvl_ratio * x0 + 0.5);
+        const uint32_t lvl_y0 = (uint32_t)(lvl_ratio * y0 + 0.5);
+        const uint32_t lvl_width = std::min(
+                std::max(2u, (uint32_t)(lvl_ratio * m_reg_roi.width())),
+                io_reg_source.lvl_width(i_lvl) - lvl_x0);
+        const uint32_t lvl_height = std::min(
+                std::max(2u, (uint32_t)(lvl_ratio * m_reg_roi.height())),
+                io_reg_source.lvl_height(i_lvl) - lvl_y0);
+        const Common::ErrCode errCode = io_reg_source.read_region(i_lvl,
+                Common::ImRoi(lvl_x0, lvl_y0, lvl_x0 + lvl_width, lvl_y0 + lvl_height),
+                m_model->normz_factor(), m_reg_im_pyr[i_lvl]);
+        if (errCode != Common::NoError) { return errCode; }
+    }
+    m_reg_pyr_is_valid = true;
+    compute_reg_pyramid_gradients();
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_reg_pyramid_gradients()
+{
+    for (uint32_t i_lvl = 0; i_lvl<m_model->nb_levels(); ++i_lvl) {
+        Common::compute_image_gradients(m_reg_im_pyr[i_lvl],
+                m_reg_im_gradx_pyr[i_lvl], m_reg_im_grady_pyr[i_lvl]);
+    }
+}
+
+
+template <typename FloatPrec>
+bool
+DenseImageRegistrationWorkspace<FloatPrec>::quad_is_inside_roi(
+            const VecN & i_pts) const
+{
+    // the guard area is clipped to the image, so a roi touching the image
+    // border is never considered as too small on that side.
+    const Common::ImRoi guard_roi = Common::quad_bounding_roi(
+            &(i_pts(0)), (FloatPrec)0.5 * m_roi_motion_margin,
+            m_reg_imdim.width(), m_reg_imdim.height());
+    return (guard_roi.x0() >= m_reg_roi.x0()) && (guard_roi.x1() <= m_reg_roi.x1())
+            && (guard_roi.y0() >= m_reg_roi.y0()) && (guard_roi.y1() <= m_reg_roi.y1());
+}
+
+
+template <typename FloatPrec>
+template <typename RegSource>
+Common::ErrCode
+DenseImageRegistrationWorkspace<FloatPrec>::grow_roi_if_needed(
+            RegSource &    io_reg_source,
+            bool           i_roi_mode,
+            const VecN &   i_pts)
+{
+    if (i_roi_mode && !quad_is_inside_roi(i_pts)) {
+        // the solution drifted toward the roi border: grow the roi around
+        // the new quad position and rebuild the pyramid.
+        const Common::ImRoi quad_roi = Common::quad_bounding_roi(
+                &(i_pts(0)), m_roi_motion_margin,
+                m_reg_imdim.width(), m_reg_imdim.height());
+        m_nb_roi_grows++;
+        return build_reg_pyramid(io_reg_source, m_reg_roi.get_union(quad_roi));
+    }
+    return Common::NoError;
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::coarse_init_search(
+            VecN & io_pts)
+{
+    const uint32_t lvl = m_model->nb_levels() - 1;
+    const FloatPrec lvl_ratio = m_model->lvl_abs_resz_ratio(lvl);
+    const FloatPrec inv_normz = 1. / m_model->normz_factor();
+    const cimg_library::CImg<FloatPrec> & lvl_im = m_reg_im_pyr[lvl];
+    const uint32_t im_width = lvl_im.width();
+    const uint32_t im_height = lvl_im.height();
+
+    // coarsest level image as uint8 (+ integral images for NCC)
+    m_coarse_im_u8.resize((size_t)im_width * im_height);
+    for (size_t i_pix = 0; i_pix<m_coarse_im_u8.size(); ++i_pix) {
+        const FloatPrec val = inv_normz * lvl_im.data()[i_pix] + 0.5;
+        m_coarse_im_u8[i_pix] = (uint8_t)std::min(std::max(val, (FloatPrec)0.), (FloatPrec)255.);
+    }
+    const Common::ImView<uint8_t> im_view(
+            &(m_coarse_im_u8[0]), im_width, im_height, im_width);
+    if (m_coarse_search.m_criterion == Common::NCCMatch) {
+        m_coarse_integral.compute(im_view);
+    }
+
+    FloatPrec cx = 0.;
+    FloatPrec cy = 0.;
+    for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+        cx += 0.25 * io_pts(2*i_pt + 0);
+        cy += 0.25 * io_pts(2*i_pt + 1);
+    }
+
+    const int32_t radius = m_coarse_search.m_search_radius;
+    bool has_best = false;
+    double best_score = 0.;
+    FloatPrec best_pts[8];
+    for (uint32_t i_sc = 0; i_sc<m_coarse_search.m_scales.size(); ++i_sc) {
+        for (uint32_t i_rot = 0; i_rot<m_coarse_search.m_rotations.size(); ++i_rot) {
+            // candidate quad (similarity of the initial quad around its
+            // center), in coarsest level roi coordinates
+            const FloatPrec scale = m_coarse_search.m_scales[i_sc];
+            const FloatPrec cos_r = scale * std::cos(m_coarse_search.m_rotations[i_rot]);
+            const FloatPrec sin_r = scale * std::sin(m_coarse_search.m_rotations[i_rot]);
+            FloatPrec cand_pts[8];
+            FloatPrec lvl_quad[8];
+            for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+                const FloatPrec dx = io_pts(2*i_pt + 0) - cx;
+                const FloatPrec dy = io_pts(2*i_pt + 1) - cy;
+                cand_pts[2*i_pt + 0] = cx + cos_r * dx - sin_r * dy;
+                cand_pts[2*i_pt + 1] = cy + sin_r * dx + cos_r * dy;
+                lvl_quad[2*i_pt + 0] = lvl_ratio * (cand_pts[2*i_pt + 0] - m_reg_roi.x0());
+                lvl_quad[2*i_pt + 1] = lvl_ratio * (cand_pts[2*i_pt + 1] - m_reg_roi.y0());
+            }
+
+            // render the template over the candidate quad bounding box, with
+            // a mask of the pixels inside the quad (outside it the sampler
+            // only returns clamped border texels, which must not be scored)
+            const FloatPrec bx = std::floor(std::min(std::min(lvl_quad[0], lvl_quad[2]),
+                    std::min(lvl_quad[4], lvl_quad[6])));
+            const FloatPrec by = std::floor(std::min(std::min(lvl_quad[1], lvl_quad[3]),
+                    std::min(lvl_quad[5], lvl_quad[7])));
+            const FloatPrec bx_end = std::ceil(std::max(std::max(lvl_quad[0], lvl_quad[2]),
+                    std::max(lvl_quad[4], lvl_quad[6])));
+            const FloatPrec by_end = std::ceil(std::max(std::max(lvl_quad[1], lvl_quad[3]),
+                    std::max(lvl_quad[5], lvl_quad[7])));
+            const uint32_t pw = std::min((uint32_t)(bx_end - bx) + 1, im_width);
+            const uint32_t ph = std::min((uint32_t)(by_end - by) + 1, im_height);
+            m_coarse_patch_u8.resize((size_t)pw * ph);
+            m_coarse_mask_u8.resize((size_t)pw * ph);
+            uint32_t nb_valid = 0;
+            for (uint32_t i_y = 0; i_y<ph; ++i_y) {
+                for (uint32_t i_x = 0; i_x<pw; ++i_x) {
+                    bool inside = false;
+                    const FloatPrec val = inv_normz * sample_template_in_quad<FloatPrec>(
+                            m_model->lvl_template(lvl), m_model->lvl_templdim(lvl), lvl_quad,
+                            bx + i_x, by + i_y, &inside) + 0.5;
+                    m_coarse_patch_u8[i_y*pw + i_x] = inside ?
+                            (uint8_t)std::min(std::max(val, (FloatPrec)0.), (FloatPrec)255.) : 0;
+                    m_coarse_mask_u8[i_y*pw + i_x] = inside ? 0xFF : 0x00;
+                    nb_valid += inside ? 1 : 0;
+                }
+            }
+            if (nb_valid == 0) {
+                continue;
+            }
+            const Common::ImView<uint8_t> patch_view(&(m_coarse_patch_u8[0]), pw, ph, pw);
+            const Common::ImView<uint8_t> mask_view(&(m_coarse_mask_u8[0]), pw, ph, pw);
+
+            // full patches (axis aligned candidates) keep the unmasked path
+            // and its integral images for NCC
+            int32_t best_x = 0;
+            int32_t best_y = 0;
+            double score = 0.;
+            const bool found = (nb_valid == pw * ph) ?
+                    Common::match_patch_exhaustive(
+                            im_view, patch_view,
+                            (int32_t)bx - radius, (int32_t)bx + radius,
+                            (int32_t)by - radius, (int32_t)by + radius,
+                            m_coarse_search.m_criterion, &m_coarse_integral,
+                            best_x, best_y, score) :
+                    Common::match_patch_exhaustive_masked(
+                            im_view, patch_view, mask_view,
+                            (int32_t)bx - radius, (int32_t)bx + radius,
+                            (int32_t)by - radius, (int32_t)by + radius,
+                            m_coarse_search.m_criterion,
+                            best_x, best_y, score);
+            if (!found) {
+                continue;
+            }
+            if (m_coarse_search.m_criterion == Common::NCCMatch) {
+                score = -score; // lower is better from here
+            } else {
+                score /= nb_valid; // candidates differ in size: mean SAD / SSD
+            }
+            if (!has_best || (score < best_score)) {
+                has_best = true;
+                best_score = score;
+                const FloatPrec shift_x = (best_x - bx) / lvl_ratio;
+                const FloatPrec shift_y = (best_y - by) / lvl_ratio;
+                for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+                    best_pts[2*i_pt + 0] = cand_pts[2*i_pt + 0] + shift_x;
+                    best_pts[2*i_pt + 1] = cand_pts[2*i_pt + 1] + shift_y;
+                }
+            }
+        }
+    }
+
+    if (has_best) {
+        for (uint32_t i_c = 0; i_c<8; ++i_c) {
+            io_pts(i_c) = best_pts[i_c];
+        }
+    }
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_lvl_grid_coords(
+            const VecN & i_pts,
+            uint32_t     i_lvl)
+{
+    typedef typename Eigen::Map<const Matrix42> Matrix42_CstMap;
+    Matrix42_CstMap pts_eigen(&(i_pts(0)), 4, 2);
+    const FloatPrec lvl_ratio = m_model->lvl_abs_resz_ratio(i_lvl);
+
+    // points in level coordinates, relative to the level roi origin (rows of
+    // W sum to 1, so the offset can be applied on the quad vertices).
+    Matrix42 lvl_pts_eigen = lvl_ratio * pts_eigen;
+    lvl_pts_eigen.col(0).array() -= lvl_ratio * (FloatPrec)m_reg_roi.x0();
+    lvl_pts_eigen.col(1).array() -= lvl_ratio * (FloatPrec)m_reg_roi.y0();
+
+    m_lvl_gridpts_eigen[i_lvl].noalias() = m_model->lvl_W(i_lvl) * lvl_pts_eigen;
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_multires_pix_error(
+            const VecN & i_pts,
+            VecN &       o_mr_pix_err,
+            uint32_t     i_first_lvl)
+{
+    uint32_t err_offset = 0;
+    for (uint32_t i_lvl = 0; i_lvl<i_first_lvl; ++i_lvl) {
+        err_offset += m_model->lvl_templdim(i_lvl).size();
+    }
+    for (uint32_t i_lvl = i_first_lvl; i_lvl<m_model->nb_levels(); ++i_lvl) {
+        compute_lvl_pix_error(i_pts, i_lvl, m_lvl_errs[i_lvl]);
+        const uint32_t nb_lvl_err_comp = m_lvl_errs[i_lvl].size();
+        o_mr_pix_err.segment(err_offset, nb_lvl_err_comp) = m_lvl_errs[i_lvl];
+        err_offset += nb_lvl_err_comp;
+    }
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_lvl_pix_error(
+            const VecN & i_pts,
+            uint32_t     i_lvl,
+            VecN &       o_lvl_pix_err)
+{
+    compute_lvl_grid_coords(i_pts, i_lvl);
+    warp_grid(m_reg_im_pyr[i_lvl], m_lvl_gridpts_eigen[i_lvl], o_lvl_pix_err);
+    o_lvl_pix_err -= m_model->lvl_template(i_lvl);
+}
+
+
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_multires_pix_jacobian(
+            const VecN & i_pts,
+            MatrixNN &   o_mr_pix_jaco,
+            uint32_t     i_first_lvl)
+{
+    uint32_t err_offset = 0;
+    for (uint32_t i_lvl = 0; i_lvl<i_first_lvl; ++i_lvl) {
+        err_offset += m_model->lvl_templdim(i_lvl).size();
+    }
+    for (uint32_t i_lvl = i_first_lvl; i_lvl<m_model->nb_levels(); ++i_lvl) {
+        compute_lvl_pix_jacobian(i_pts, i_lvl, m_lvl_jacos[i_lvl]);
+        const uint32_t nb_lvl_err_comp = m_lvl_jacos[i_lvl].rows();
+        o_mr_pix_jaco.middleRows(err_offset, nb_lvl_err_comp) = m_lvl_jacos[i_lvl];
+        err_offset += nb_lvl_err_comp;
+    }
+}
+
+
+/*
+* Forward additive jacobian: the pixel i of the template is sampled at
+* ratio * sum_k(W_ik * P_k) in the level image, so the derivative of its error
+* w.r.t. vertex coordinate x_k (resp. y_k) is ratio * W_ik * gx (resp. gy).
+* (gx, gy) is the warped image gradient for Gauss-Newton updates. For ESM
+* updates it is the average of the warped image gradient and of the template
+* gradient mapped to the level image axes through the local warp jacobian
+* A = [dx/du dx/dv; dy/du dy/dv], i.e. A^-T * (dT/du, dT/dv).
+*/
+template <typename FloatPrec>
+void
+DenseImageRegistrationWorkspace<FloatPrec>::compute_lvl_pix_jacobian(
+            const VecN & i_pts,
+            uint32_t     i_lvl,
+            MatrixNN &   o_lvl_pix_jaco)
+{
+    compute_lvl_grid_coords(i_pts, i_lvl);
+    const MatrixN2 & grid_coords = m_lvl_gridpts_eigen[i_lvl];
+    const MatrixN4 & lvl_W = m_model->lvl_W(i_lvl);
+    const FloatPrec lvl_ratio = m_model->lvl_abs_resz_ratio(i_lvl);
+    const uint32_t nb_pix = grid_coords.rows();
+
+    // quad edges in level coordinates, for the local warp jacobians (ESM).
+    // With s = W_1 + W_2 and t = W_2 + W_3 the template grid position of a
+    // pixel normalized to [0, 1]:
+    // dx/du = ((1-t) * (xB - xA) + t * (xC - xD)) / (width - 1)
+    // dx/dv = ((1-s) * (xD - xA) + s * (xC - xB)) / (height - 1)
+    const bool use_esm = (m_update_mode == ESMUpdate);
+    const FloatPrec du_scale = lvl_ratio / (FloatPrec)(m_model->lvl_templdim(i_lvl).width() - 1);
+    const FloatPrec dv_scale = lvl_ratio / (FloatPrec)(m_model->lvl_templdim(i_lvl).height() - 1);
+    const FloatPrec ab_x = du_scale * (i_pts(2) - i_pts(0));
+    const FloatPrec ab_y = du_scale * (i_pts(3) - i_pts(1));
+    const FloatPrec dc_x = du_scale * (i_pts(4) - i_pts(6));
+    const FloatPrec dc_y = du_scale * (i_pts(5) - i_pts(7));
+    const FloatPrec ad_x = dv_scale * (i_pts(6) - i_pts(0));
+    const FloatPrec ad_y = dv_scale * (i_pts(7) - i_pts(1));
+    const FloatPrec bc_x = dv_scale * (i_pts(4) - i_pts(2));
+    const FloatPrec bc_y = dv_scale * (i_pts(5) - i_pts(3));
+
+    // pixels are independent: split them over m_nb_threads threads (OpenMP)
+    #pragma omp parallel for num_threads(m_nb_threads) if(m_nb_threads > 1)
+    for (uint32_t i_pixind=0; i_pixind<nb_pix; ++i_pixind) {
+        const FloatPrec x = grid_coords(i_pixind, 0);
+        const FloatPrec y = grid_coords(i_pixind, 1);
+        FloatPrec gx = Common::bilinear_pix_interp_clamped(
+                m_reg_im_gradx_pyr[i_lvl], x, y);
+        FloatPrec gy = Common::bilinear_pix_interp_clamped(
+                m_reg_im_grady_pyr[i_lvl], x, y);
+        if (use_esm) {
+            const FloatPrec s = lvl_W(i_pixind, 1) + lvl_W(i_pixind, 2);
+            const FloatPrec t = lvl_W(i_pixind, 2) + lvl_W(i_pixind, 3);
+            const FloatPrec a_xu = (1-t) * ab_x + t * dc_x;
+            const FloatPrec a_yu = (1-t) * ab_y + t * dc_y;
+            const FloatPrec a_xv = (1-s) * ad_x + s * bc_x;
+            const FloatPrec a_yv = (1-s) * ad_y + s * bc_y;
+            const FloatPrec det = a_xu * a_yv - a_xv * a_yu;
+            if (std::abs(det) > std::numeric_limits<FloatPrec>::epsilon()) {
+                const FloatPrec tu = m_model->lvl_templ_gradu(i_lvl)(i_pixind);
+                const FloatPrec tv = m_model->lvl_templ_gradv(i_lvl)(i_pixind);
+                const FloatPrec inv_det = 1. / det;
+                gx = 0.5 * (gx + inv_det * (a_yv * tu - a_yu * tv));
+                gy = 0.5 * (gy + inv_det * (a_xu * tv - a_xv * tu));
+            }
+        }
+        gx *= lvl_ratio;
+        gy *= lvl_ratio;
+        for (uint32_t i_vtx = 0; i_vtx<4; ++i_vtx) {
+            o_lvl_pix_jaco(i_pixind, 2*i_vtx + 0) = gx * lvl_W(i_pixind, i_vtx);
+            o_lvl_pix_jaco(i_pixind, 2*i_vtx + 1) = gy * lvl_W(i_pixind, i_vtx);
+        }
+    }
+}
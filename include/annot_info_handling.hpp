@@ -9,7 +9,11 @@
 #ifndef _ANNOT_INFO_HANDLING_HPP
 #define _ANNOT_INFO_HANDLING_HPP
 
+#include <stdint.h>
+#include <fstream>
+#include <iostream>
 #include <sstream>
+#include <string>
 #include <vector>
 
 #include "errCodes.h"
@@ -0,0 +1,283 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _BATCHED_SPD_SOLVER_HPP
+#define _BATCHED_SPD_SOLVER_HPP
+
+#include <stdint.h>
+#include <vector>
+#include <limits>
+
+#include <Eigen/Dense>
+
+#include "errCodes.h"
+
+namespace Common
+{
+
+/*
+* Solver for many small symmetric positive definite systems A x = b of the
+* same size (e.g. the 8x8 Gauss-Newton normal equations of several
+* registrations run in lockstep).
+* The systems are stored structure-of-arrays, i_lane_width systems side by
+* side: element (i, j) of the systems of a group is a contiguous run of
+* i_lane_width values, one per system (SIMD lane). The LDL^T factorization
+* (no pivoting) and the forward / back substitutions then run on all the
+* systems of a group at once, every loop over the lanes being a plain
+* vectorizable loop.
+* A system whose pivot gets below i_pivot_tol times its diagonal entry
+* (ill-conditioned, or not positive definite) is solved again on its own with
+* Eigen's pivoting LDLT (the solver used for single systems, see
+* 'gauss_newton_descent_step').
+*/
+template <typename FloatPrec, uint32_t Dim, uint32_t LaneWidth = 8>
+class BatchedSpdSolver
+{
+public:
+    typedef Eigen::Matrix<FloatPrec, Dim, Dim> MatrixDD;
+    typedef Eigen::Matrix<FloatPrec, Dim, 1>   VecD;
+public:
+    BatchedSpdSolver() {}
+    ~BatchedSpdSolver() {}
+public:
+    /*
+    * set the number of systems to solve at once (the buffers are only
+    * reallocated when they have to grow)
+    */
+    void
+    resize(
+            uint32_t i_nb_systems)
+    {
+        m_nb_systems = i_nb_systems;
+        m_nb_groups = (i_nb_systems + LaneWidth - 1) / LaneWidth;
+        const size_t nb_lanes = (size_t)m_nb_groups * LaneWidth;
+        if (m_a.size() < nb_lanes * Dim * Dim) {
+            m_a.resize(nb_lanes * Dim * Dim);
+            m_l.resize(nb_lanes * Dim * Dim);
+            m_b.resize(nb_lanes * Dim);
+            m_x.resize(nb_lanes * Dim);
+            m_fallback.resize(nb_lanes);
+        }
+        // unused lanes of the last group solve identity systems
+        for (uint32_t i_sys = i_nb_systems; i_sys<nb_lanes; ++i_sys) {
+            for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+                for (uint32_t i_c = 0; i_c<=i_r; ++i_c) {
+                    m_a[a_ind(i_sys, i_r, i_c)] = (i_r == i_c) ? 1. : 0.;
+                }
+                m_b[b_ind(i_sys, i_r)] = 0.;
+            }
+        }
+    }
+
+    inline uint32_t nb_systems() const {return m_nb_systems;}
+
+    /*
+    * relative pivot threshold under which a system is solved by the fallback
+    */
+    inline void set_pivot_tolerance(FloatPrec i_pivot_tol) {m_pivot_tol = i_pivot_tol;}
+
+    /*
+    * set system i_sys (only the lower triangle of i_A is read, i_b can be a
+    * row or a column vector)
+    */
+    template <typename MatT, typename VecT>
+    void
+    set_system(
+            uint32_t      i_sys,
+            const MatT &  i_A,
+            const VecT &  i_b)
+    {
+        for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+            for (uint32_t i_c = 0; i_c<=i_r; ++i_c) {
+                m_a[a_ind(i_sys, i_r, i_c)] = i_A(i_r, i_c);
+            }
+            m_b[b_ind(i_sys, i_r)] = i_b(i_r);
+        }
+    }
+
+    /*
+    * solve all the systems
+    */
+    ErrCode
+    solve()
+    {
+        m_nb_fallbacks = 0;
+        for (uint32_t i_g = 0; i_g<m_nb_groups; ++i_g) {
+            solve_group(i_g);
+        }
+        for (uint32_t i_sys = 0; i_sys<m_nb_systems; ++i_sys) {
+            if (m_fallback[i_sys]) {
+                solve_fallback(i_sys);
+                m_nb_fallbacks++;
+            }
+        }
+        return NoError;
+    }
+
+    /*
+    * solution of system i_sys (row or column vector of size Dim)
+    */
+    template <typename VecT>
+    void
+    get_solution(
+            uint32_t i_sys,
+            VecT &   o_x) const
+    {
+        for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+            o_x(i_r) = m_x[b_ind(i_sys, i_r)];
+        }
+    }
+
+    /*
+    * whether system i_sys was solved by the fallback in the last 'solve', and
+    * the number of such systems
+    */
+    inline bool used_fallback(uint32_t i_sys) const {return m_fallback[i_sys] != 0;}
+    inline uint32_t nb_fallbacks() const {return m_nb_fallbacks;}
+
+private:
+    inline size_t a_ind(uint32_t i_sys, uint32_t i_r, uint32_t i_c) const {
+        return (((size_t)(i_sys / LaneWidth) * Dim * Dim + i_r * Dim + i_c) * LaneWidth)
+                + i_sys % LaneWidth;
+    }
+    inline size_t b_ind(uint32_t i_sys, uint32_t i_r) const {
+        return (((size_t)(i_sys / LaneWidth) * Dim + i_r) * LaneWidth) + i_sys % LaneWidth;
+    }
+
+    /*
+    * LDL^T factorization and substitutions of the LaneWidth systems of group
+    * i_g (L is stored in the lower triangle of m_l, D on its diagonal)
+    */
+    void
+    solve_group(
+            uint32_t i_g)
+    {
+        const FloatPrec * a = &m_a[(size_t)i_g * Dim * Dim * LaneWidth];
+        FloatPrec * l = &m_l[(size_t)i_g * Dim * Dim * LaneWidth];
+        const FloatPrec * b = &m_b[(size_t)i_g * Dim * LaneWidth];
+        FloatPrec * x = &m_x[(size_t)i_g * Dim * LaneWidth];
+        uint8_t * fallback = &m_fallback[(size_t)i_g * LaneWidth];
+        FloatPrec inv_d[Dim][LaneWidth];
+        FloatPrec ld[LaneWidth];
+        for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+            fallback[i_k] = 0;
+        }
+
+        // factorization, column by column
+        for (uint32_t i_c = 0; i_c<Dim; ++i_c) {
+            FloatPrec * l_cc = l + (i_c * Dim + i_c) * LaneWidth;
+            const FloatPrec * a_cc = a + (i_c * Dim + i_c) * LaneWidth;
+            for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                l_cc[i_k] = a_cc[i_k];
+            }
+            for (uint32_t i_p = 0; i_p<i_c; ++i_p) {
+                const FloatPrec * l_cp = l + (i_c * Dim + i_p) * LaneWidth;
+                const FloatPrec * d_p = l + (i_p * Dim + i_p) * LaneWidth;
+                for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                    l_cc[i_k] -= l_cp[i_k] * l_cp[i_k] * d_p[i_k];
+                }
+            }
+            // pivot check: failing lanes go on with a unit pivot, and are
+            // solved again by the fallback
+            for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                const bool bad_pivot = !(l_cc[i_k] > m_pivot_tol * a_cc[i_k]);
+                fallback[i_k] |= bad_pivot ? 1 : 0;
+                l_cc[i_k] = bad_pivot ? (FloatPrec)1. : l_cc[i_k];
+                inv_d[i_c][i_k] = (FloatPrec)1. / l_cc[i_k];
+            }
+            for (uint32_t i_r = i_c + 1; i_r<Dim; ++i_r) {
+                FloatPrec * l_rc = l + (i_r * Dim + i_c) * LaneWidth;
+                const FloatPrec * a_rc = a + (i_r * Dim + i_c) * LaneWidth;
+                for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                    l_rc[i_k] = a_rc[i_k];
+                }
+                for (uint32_t i_p = 0; i_p<i_c; ++i_p) {
+                    const FloatPrec * l_rp = l + (i_r * Dim + i_p) * LaneWidth;
+                    const FloatPrec * l_cp = l + (i_c * Dim + i_p) * LaneWidth;
+                    const FloatPrec * d_p = l + (i_p * Dim + i_p) * LaneWidth;
+                    for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                        ld[i_k] = l_cp[i_k] * d_p[i_k];
+                        l_rc[i_k] -= l_rp[i_k] * ld[i_k];
+                    }
+                }
+                for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                    l_rc[i_k] *= inv_d[i_c][i_k];
+                }
+            }
+        }
+
+        // forward substitution (L y = b) and scaling (z = D^-1 y)
+        for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+            FloatPrec * x_r = x + i_r * LaneWidth;
+            const FloatPrec * b_r = b + i_r * LaneWidth;
+            for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                x_r[i_k] = b_r[i_k];
+            }
+            for (uint32_t i_p = 0; i_p<i_r; ++i_p) {
+                const FloatPrec * l_rp = l + (i_r * Dim + i_p) * LaneWidth;
+                const FloatPrec * x_p = x + i_p * LaneWidth;
+                for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                    x_r[i_k] -= l_rp[i_k] * x_p[i_k];
+                }
+            }
+        }
+        for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+            FloatPrec * x_r = x + i_r * LaneWidth;
+            for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                x_r[i_k] *= inv_d[i_r][i_k];
+            }
+        }
+        // back substitution (L^T x = z)
+        for (uint32_t i_r = Dim; i_r-->0;) {
+            FloatPrec * x_r = x + i_r * LaneWidth;
+            for (uint32_t i_p = i_r + 1; i_p<Dim; ++i_p) {
+                const FloatPrec * l_pr = l + (i_p * Dim + i_r) * LaneWidth;
+                const FloatPrec * x_p = x + i_p * LaneWidth;
+                for (uint32_t i_k = 0; i_k<LaneWidth; ++i_k) {
+                    x_r[i_k] -= l_pr[i_k] * x_p[i_k];
+                }
+            }
+        }
+    }
+
+    /*
+    * solve system i_sys on its own with a pivoting LDLT
+    */
+    void
+    solve_fallback(
+            uint32_t i_sys)
+    {
+        MatrixDD A;
+        VecD b;
+        for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+            for (uint32_t i_c = 0; i_c<=i_r; ++i_c) {
+                A(i_r, i_c) = m_a[a_ind(i_sys, i_r, i_c)];
+                A(i_c, i_r) = A(i_r, i_c);
+            }
+            b(i_r) = m_b[b_ind(i_sys, i_r)];
+        }
+        const VecD x = A.ldlt().solve(b);
+        for (uint32_t i_r = 0; i_r<Dim; ++i_r) {
+            m_x[b_ind(i_sys, i_r)] = x(i_r);
+        }
+    }
+
+private:
+    std::vector<FloatPrec> m_a; // systems, lower triangle
+    std::vector<FloatPrec> m_l; // LDL^T factors (D on the diagonal)
+    std::vector<FloatPrec> m_b;
+    std::vector<FloatPrec> m_x;
+    std::vector<uint8_t>   m_fallback;
+    uint32_t               m_nb_systems = 0;
+    uint32_t               m_nb_groups = 0;
+    uint32_t               m_nb_fallbacks = 0;
+    FloatPrec              m_pivot_tol = 100. * std::numeric_limits<FloatPrec>::epsilon();
+};
+
+} // end namespace Common
+
+#endif /* _BATCHED_SPD_SOLVER_HPP *  * */
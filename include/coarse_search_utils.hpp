@@ -0,0 +1,397 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _COARSE_SEARCH_UTILS_HPP
+#define _COARSE_SEARCH_UTILS_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "errCodes.h"
+#include "im_processing_utils.hpp"
+
+namespace Common
+{
+
+/*
+* Patch matching criteria for exhaustive searches
+*/
+typedef enum MatchCriterion_t
+{
+    SADMatch = 0, // sum of absolute differences
+    SSDMatch = 1, // sum of squared differences
+    NCCMatch = 2, // normalized cross-correlation
+} MatchCriterion;
+
+
+/*
+* Sum of absolute differences between two uint8 arrays of size n
+*/
+inline
+uint32_t
+sad_u8(
+        const uint8_t * i_a,
+        const uint8_t * i_b,
+        uint32_t        n)
+{
+    uint32_t i = 0;
+    uint32_t sad = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(i_a + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(i_b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(a, b));
+    }
+    sad = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; i<n; ++i) {
+        sad += std::abs((int32_t)i_a[i] - (int32_t)i_b[i]);
+    }
+    return sad;
+}
+
+/*
+* Sum of squared differences between two uint8 arrays of size n
+* (n < 2^15 to avoid 32 bits lane overflows)
+*/
+inline
+uint32_t
+ssd_u8(
+        const uint8_t * i_a,
+        const uint8_t * i_b,
+        uint32_t        n)
+{
+    uint32_t i = 0;
+    uint32_t ssd = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(i_a + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(i_b + i));
+        // |a - b| fits in uint8, then widen to int16 for the multiply-add
+        const __m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        const __m128i d_lo = _mm_unpacklo_epi8(d, zero);
+        const __m128i d_hi = _mm_unpackhi_epi8(d, zero);
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(d_lo, d_lo));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(d_hi, d_hi));
+    }
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+    ssd = _mm_cvtsi128_si32(acc);
+#endif
+    for (; i<n; ++i) {
+        const int32_t d = (int32_t)i_a[i] - (int32_t)i_b[i];
+        ssd += d * d;
+    }
+    return ssd;
+}
+
+/*
+* Dot product of two uint8 arrays of size n (n < 2^15)
+*/
+inline
+uint32_t
+dot_u8(
+        const uint8_t * i_a,
+        const uint8_t * i_b,
+        uint32_t        n)
+{
+    uint32_t i = 0;
+    uint32_t dot = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(i_a + i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(i_b + i));
+        // products of 2 uint8 overflow int16, but pairs of them summed by
+        // _mm_madd_epi16 still fit in the (unsigned) 32 bit lanes
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(
+                _mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(
+                _mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+    }
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+    dot = _mm_cvtsi128_si32(acc);
+#endif
+    for (; i<n; ++i) {
+        dot += (uint32_t)i_a[i] * (uint32_t)i_b[i];
+    }
+    return dot;
+}
+
+
+/*
+* o_out = i_a & i_mask for two uint8 arrays of size n (masks are 0x00 / 0xFF)
+*/
+inline
+void
+and_u8(
+        const uint8_t * i_a,
+        const uint8_t * i_mask,
+        uint8_t *       o_out,
+        uint32_t        n)
+{
+    uint32_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(i_a + i));
+        const __m128i m = _mm_loadu_si128((const __m128i *)(i_mask + i));
+        _mm_storeu_si128((__m128i *)(o_out + i), _mm_and_si128(a, m));
+    }
+#endif
+    for (; i<n; ++i) {
+        o_out[i] = i_a[i] & i_mask[i];
+    }
+}
+
+
+/*
+* Integral images of pixel values and squared pixel values, to get the sum and
+* sum of squares over any rectangle in constant time (NCC normalization).
+* Both are stored with an extra leading row and column of zeros.
+*/
+struct IntegralImages
+{
+public:
+    void
+    compute(
+            const ImView<uint8_t> & i_image)
+    {
+        m_width = i_image.width() + 1;
+        const uint32_t height = i_image.height() + 1;
+        m_sum.assign((size_t)m_width * height, 0);
+        m_sqsum.assign((size_t)m_width * height, 0);
+        for (uint32_t i_y = 1; i_y<height; ++i_y) {
+            const uint8_t * row = i_image.row(i_y - 1);
+            uint64_t row_sum = 0;
+            uint64_t row_sqsum = 0;
+            for (uint32_t i_x = 1; i_x<m_width; ++i_x) {
+                const uint64_t val = row[i_x - 1];
+                row_sum += val;
+                row_sqsum += val * val;
+                m_sum[i_y*m_width + i_x] = m_sum[(i_y-1)*m_width + i_x] + row_sum;
+                m_sqsum[i_y*m_width + i_x] = m_sqsum[(i_y-1)*m_width + i_x] + row_sqsum;
+            }
+        }
+    }
+
+    /*
+    * sums over the rectangle [x, x+w[ x [y, y+h[
+    */
+    inline void
+    rect_sums(
+            uint32_t   x,
+            uint32_t   y,
+            uint32_t   w,
+            uint32_t   h,
+            uint64_t & o_sum,
+            uint64_t & o_sqsum) const
+    {
+        const size_t i00 = (size_t)y * m_width + x;
+        const size_t i01 = i00 + w;
+        const size_t i10 = i00 + (size_t)h * m_width;
+        const size_t i11 = i10 + w;
+        o_sum = m_sum[i11] + m_sum[i00] - m_sum[i01] - m_sum[i10];
+        o_sqsum = m_sqsum[i11] + m_sqsum[i00] - m_sqsum[i01] - m_sqsum[i10];
+    }
+private:
+    uint32_t              m_width = 0;
+    std::vector<uint64_t> m_sum;
+    std::vector<uint64_t> m_sqsum;
+};
+
+
+/*
+* Exhaustive search of the best match of i_patch in i_image, for patch top-left
+* positions in [i_x_beg, i_x_end] x [i_y_beg, i_y_end] (clipped so that the
+* patch stays inside the image).
+* o_score is the best SAD or SSD (lower is better) or NCC (higher is better).
+* i_integral is only used (and must be computed on i_image) for NCCMatch.
+* Returns false if no valid position exists.
+*/
+inline
+bool
+match_patch_exhaustive(
+        const ImView<uint8_t> & i_image,
+        const ImView<uint8_t> & i_patch,
+        int32_t                 i_x_beg,
+        int32_t                 i_x_end,
+        int32_t                 i_y_beg,
+        int32_t                 i_y_end,
+        MatchCriterion          i_criterion,
+        const IntegralImages *  i_integral,
+        int32_t &               o_best_x,
+        int32_t &               o_best_y,
+        double &                o_score)
+{
+    const uint32_t pw = i_patch.width();
+    const uint32_t ph = i_patch.height();
+    i_x_beg = std::max(i_x_beg, 0);
+    i_y_beg = std::max(i_y_beg, 0);
+    i_x_end = std::min(i_x_end, (int32_t)i_image.width() - (int32_t)pw);
+    i_y_end = std::min(i_y_end, (int32_t)i_image.height() - (int32_t)ph);
+    if ((i_x_beg > i_x_end) || (i_y_beg > i_y_end) || (pw == 0) || (ph == 0)) {
+        return false;
+    }
+
+    // patch statistics, for NCC
+    const double n = (double)pw * ph;
+    double patch_sum = 0.;
+    double patch_sqsum = 0.;
+    if (i_criterion == NCCMatch) {
+        for (uint32_t i_y = 0; i_y<ph; ++i_y) {
+            for (uint32_t i_x = 0; i_x<pw; ++i_x) {
+                const double val = i_patch.row(i_y)[i_x];
+                patch_sum += val;
+                patch_sqsum += val * val;
+            }
+        }
+    }
+    const double patch_var = patch_sqsum - patch_sum * patch_sum / n;
+
+    const bool higher_is_better = (i_criterion == NCCMatch);
+    o_score = higher_is_better ? -std::numeric_limits<double>::max() :
+            std::numeric_limits<double>::max();
+    for (int32_t i_y = i_y_beg; i_y<=i_y_end; ++i_y) {
+        for (int32_t i_x = i_x_beg; i_x<=i_x_end; ++i_x) {
+            uint64_t acc = 0;
+            for (uint32_t i_py = 0; i_py<ph; ++i_py) {
+                const uint8_t * im_row = i_image.row(i_y + i_py) + i_x;
+                const uint8_t * patch_row = i_patch.row(i_py);
+                switch (i_criterion) {
+                    case SADMatch: acc += sad_u8(im_row, patch_row, pw); break;
+                    case SSDMatch: acc += ssd_u8(im_row, patch_row, pw); break;
+                    case NCCMatch: acc += dot_u8(im_row, patch_row, pw); break;
+                }
+            }
+            double score = (double)acc;
+            if (i_criterion == NCCMatch) {
+                uint64_t im_sum = 0;
+                uint64_t im_sqsum = 0;
+                i_integral->rect_sums(i_x, i_y, pw, ph, im_sum, im_sqsum);
+                const double im_var = (double)im_sqsum - (double)im_sum * im_sum / n;
+                const double covar = (double)acc - (double)im_sum * patch_sum / n;
+                const double denom = std::sqrt(std::max(im_var * patch_var, 0.));
+                score = (denom > 0.) ? covar / denom : 0.;
+            }
+            if (higher_is_better ? (score > o_score) : (score < o_score)) {
+                o_score = score;
+                o_best_x = i_x;
+                o_best_y = i_y;
+            }
+        }
+    }
+    return true;
+}
+
+
+/*
+* Masked version of match_patch_exhaustive: only the patch pixels where i_mask
+* is 0xFF are scored (i_mask is 0x00 elsewhere, and i_patch must be 0 there).
+* SAD and SSD are summed over the masked pixels only, NCC statistics are
+* computed over them directly (no integral images).
+* Returns false if no valid position exists or the mask is empty.
+*/
+inline
+bool
+match_patch_exhaustive_masked(
+        const ImView<uint8_t> & i_image,
+        const ImView<uint8_t> & i_patch,
+        const ImView<uint8_t> & i_mask,
+        int32_t                 i_x_beg,
+        int32_t                 i_x_end,
+        int32_t                 i_y_beg,
+        int32_t                 i_y_end,
+        MatchCriterion          i_criterion,
+        int32_t &               o_best_x,
+        int32_t &               o_best_y,
+        double &                o_score)
+{
+    const uint32_t pw = i_patch.width();
+    const uint32_t ph = i_patch.height();
+    i_x_beg = std::max(i_x_beg, 0);
+    i_y_beg = std::max(i_y_beg, 0);
+    i_x_end = std::min(i_x_end, (int32_t)i_image.width() - (int32_t)pw);
+    i_y_end = std::min(i_y_end, (int32_t)i_image.height() - (int32_t)ph);
+    if ((i_x_beg > i_x_end) || (i_y_beg > i_y_end) || (pw == 0) || (ph == 0)) {
+        return false;
+    }
+
+    // patch statistics over the mask (count, and sums for NCC)
+    double n = 0.;
+    double patch_sum = 0.;
+    double patch_sqsum = 0.;
+    for (uint32_t i_y = 0; i_y<ph; ++i_y) {
+        for (uint32_t i_x = 0; i_x<pw; ++i_x) {
+            if (i_mask.row(i_y)[i_x] != 0) {
+                const double val = i_patch.row(i_y)[i_x];
+                n += 1.;
+                patch_sum += val;
+                patch_sqsum += val * val;
+            }
+        }
+    }
+    if (n == 0.) {
+        return false;
+    }
+    const double patch_var = patch_sqsum - patch_sum * patch_sum / n;
+
+    std::vector<uint8_t> im_masked(pw);
+    const std::vector<uint8_t> zeros(pw, 0);
+    const bool higher_is_better = (i_criterion == NCCMatch);
+    o_score = higher_is_better ? -std::numeric_limits<double>::max() :
+            std::numeric_limits<double>::max();
+    for (int32_t i_y = i_y_beg; i_y<=i_y_end; ++i_y) {
+        for (int32_t i_x = i_x_beg; i_x<=i_x_end; ++i_x) {
+            uint64_t acc = 0;
+            uint64_t im_sum = 0;
+            uint64_t im_sqsum = 0;
+            for (uint32_t i_py = 0; i_py<ph; ++i_py) {
+                and_u8(i_image.row(i_y + i_py) + i_x, i_mask.row(i_py), &(im_masked[0]), pw);
+                const uint8_t * patch_row = i_patch.row(i_py);
+                switch (i_criterion) {
+                    case SADMatch: acc += sad_u8(&(im_masked[0]), patch_row, pw); break;
+                    case SSDMatch: acc += ssd_u8(&(im_masked[0]), patch_row, pw); break;
+                    case NCCMatch:
+                        acc += dot_u8(&(im_masked[0]), patch_row, pw);
+                        im_sum += sad_u8(&(im_masked[0]), &(zeros[0]), pw);
+                        im_sqsum += dot_u8(&(im_masked[0]), &(im_masked[0]), pw);
+                        break;
+                }
+            }
+            double score = (double)acc;
+            if (i_criterion == NCCMatch) {
+                const double im_var = (double)im_sqsum - (double)im_sum * im_sum / n;
+                const double covar = (double)acc - (double)im_sum * patch_sum / n;
+                const double denom = std::sqrt(std::max(im_var * patch_var, 0.));
+                score = (denom > 0.) ? covar / denom : 0.;
+            }
+            if (higher_is_better ? (score > o_score) : (score < o_score)) {
+                o_score = score;
+                o_best_x = i_x;
+                o_best_y = i_y;
+            }
+        }
+    }
+    return true;
+}
+
+} // end namespace Common
+
+#endif /* _COARSE_SEARCH_UTILS_HPP *  * */
@@ -0,0 +1,253 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _COLOR_CONVERSION_UTILS_HPP
+#define _COLOR_CONVERSION_UTILS_HPP
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <CImg.h>
+
+#include "errCodes.h"
+
+namespace Common
+{
+
+/*
+* Non-owning view on 8-bit RGB image data, either planar (one plane per
+* channel, e.g. CImg color images or RGB raw frames) or interleaved (RGBRGB...).
+* Rows are i_stride bytes apart in each plane, consecutive pixels of a row are
+* i_pixel_step bytes apart (1 for planar data, 3 for interleaved data).
+*/
+struct RgbImView
+{
+public:
+    RgbImView() {}
+    RgbImView(
+            const uint8_t * i_r,
+            const uint8_t * i_g,
+            const uint8_t * i_b,
+            uint32_t        i_width,
+            uint32_t        i_height,
+            uint32_t        i_stride,
+            uint32_t        i_pixel_step) :
+        m_r(i_r), m_g(i_g), m_b(i_b), m_width(i_width), m_height(i_height),
+        m_stride(i_stride), m_pixel_step(i_pixel_step) {}
+public:
+    inline const uint8_t * r_row(uint32_t i_y) const { return m_r + (size_t)i_y * m_stride; }
+    inline const uint8_t * g_row(uint32_t i_y) const { return m_g + (size_t)i_y * m_stride; }
+    inline const uint8_t * b_row(uint32_t i_y) const { return m_b + (size_t)i_y * m_stride; }
+    inline uint32_t width() const { return m_width; }
+    inline uint32_t height() const { return m_height; }
+    inline uint32_t stride() const { return m_stride; }
+    inline uint32_t pixel_step() const { return m_pixel_step; }
+    inline bool is_planar() const { return m_pixel_step == 1; }
+private:
+    const uint8_t * m_r = NULL;
+    const uint8_t * m_g = NULL;
+    const uint8_t * m_b = NULL;
+    uint32_t        m_width = 0;
+    uint32_t        m_height = 0;
+    uint32_t        m_stride = 0;
+    uint32_t        m_pixel_step = 1;
+};
+
+/*
+* RGB views on planar data (3 planes with the same stride) and on interleaved
+* data (RGBRGB..., i_stride bytes per row)
+*/
+inline
+RgbImView
+rgb_view_planar(
+        const uint8_t * i_r,
+        const uint8_t * i_g,
+        const uint8_t * i_b,
+        uint32_t        i_width,
+        uint32_t        i_height,
+        uint32_t        i_stride)
+{
+    return RgbImView(i_r, i_g, i_b, i_width, i_height, i_stride, 1);
+}
+
+inline
+RgbImView
+rgb_view_interleaved(
+        const uint8_t * i_data,
+        uint32_t        i_width,
+        uint32_t        i_height,
+        uint32_t        i_stride)
+{
+    return RgbImView(i_data, i_data + 1, i_data + 2, i_width, i_height, i_stride, 3);
+}
+
+/*
+* RGB view on a CImg color image (planar, at least 3 channels)
+*/
+inline
+RgbImView
+rgb_view_from_cimg(
+        const cimg_library::CImg<unsigned char> & i_image)
+{
+    const size_t plane_size = (size_t)i_image.width() * i_image.height();
+    return rgb_view_planar(i_image.data(), i_image.data() + plane_size,
+            i_image.data() + 2 * plane_size,
+            i_image.width(), i_image.height(), i_image.width());
+}
+
+
+/*
+* Luma of an RGB pixel: Y channel of the 8-bit BT.601 YCbCr conversion,
+* Y = (66 R + 129 G + 25 B + 128) / 256 + 16, identical to the Y channel of
+* CImg's 'RGBtoYCbCr' on 8-bit images.
+*/
+inline
+uint32_t
+rgb_to_luma(
+        uint32_t i_r,
+        uint32_t i_g,
+        uint32_t i_b)
+{
+    return ((66 * i_r + 129 * i_g + 25 * i_b + 128) >> 8) + 16;
+}
+
+#ifdef __SSE2__
+/*
+* luma of 8 planar pixels, as 8 16-bit lanes (the weighted sum is below 2^16,
+* so it is computed modulo 2^16 without any loss)
+*/
+inline
+__m128i
+rgb_to_luma_epi16(
+        const uint8_t * i_r,
+        const uint8_t * i_g,
+        const uint8_t * i_b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i r = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)i_r), zero);
+    const __m128i g = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)i_g), zero);
+    const __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)i_b), zero);
+    __m128i y = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+            _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+    y = _mm_add_epi16(y, _mm_mullo_epi16(b, _mm_set1_epi16(25)));
+    y = _mm_srli_epi16(_mm_add_epi16(y, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(y, _mm_set1_epi16(16));
+}
+
+/*
+* store 8 16-bit luma lanes scaled by i_normz_factor
+*/
+inline
+void
+store_normalized_luma(
+        __m128i  i_y,
+        float    i_normz_factor,
+        float *  o_dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 normz = _mm_set1_ps(i_normz_factor);
+    _mm_storeu_ps(o_dst, _mm_mul_ps(normz,
+            _mm_cvtepi32_ps(_mm_unpacklo_epi16(i_y, zero))));
+    _mm_storeu_ps(o_dst + 4, _mm_mul_ps(normz,
+            _mm_cvtepi32_ps(_mm_unpackhi_epi16(i_y, zero))));
+}
+
+template <typename FloatPrec>
+inline
+void
+store_normalized_luma(
+        __m128i     i_y,
+        FloatPrec   i_normz_factor,
+        FloatPrec * o_dst)
+{
+    uint16_t y[8];
+    _mm_storeu_si128((__m128i *)y, i_y);
+    for (uint32_t i_x = 0; i_x<8; ++i_x) {
+        o_dst[i_x] = i_normz_factor * (FloatPrec)y[i_x];
+    }
+}
+#endif
+
+/*
+* Convert i_width pixels of row i_y of an RGB image, from column i_x0, to luma
+* scaled by i_normz_factor, in one pass (same values as converting the image
+* to 8-bit luma, then to floating point). Planar rows are converted 8 pixels
+* at a time with SSE2 when available.
+*/
+template <typename FloatPrec>
+void
+rgb_row_to_luma(
+        const RgbImView & i_image,
+        uint32_t          i_y,
+        uint32_t          i_x0,
+        uint32_t          i_width,
+        FloatPrec         i_normz_factor,
+        FloatPrec *       o_row)
+{
+    const uint32_t step = i_image.pixel_step();
+    const uint8_t * r = i_image.r_row(i_y) + (size_t)i_x0 * step;
+    const uint8_t * g = i_image.g_row(i_y) + (size_t)i_x0 * step;
+    const uint8_t * b = i_image.b_row(i_y) + (size_t)i_x0 * step;
+    uint32_t i_x = 0;
+#ifdef __SSE2__
+    if (i_image.is_planar()) {
+        for (; i_x + 8 <= i_width; i_x += 8) {
+            store_normalized_luma(rgb_to_luma_epi16(r + i_x, g + i_x, b + i_x),
+                    i_normz_factor, o_row + i_x);
+        }
+    }
+#endif
+    for (; i_x<i_width; ++i_x) {
+        const size_t ind = (size_t)i_x * step;
+        o_row[i_x] = i_normz_factor * (FloatPrec)rgb_to_luma(r[ind], g[ind], b[ind]);
+    }
+}
+
+/*
+* Convert an RGB image to an 8-bit luma image (e.g. to set a template from a
+* color frame). o_gray_image is only reallocated if its size has to change.
+*/
+inline
+void
+rgb_image_to_luma(
+        const RgbImView &                   i_image,
+        cimg_library::CImg<unsigned char> & o_gray_image)
+{
+    const uint32_t width = i_image.width();
+    const uint32_t height = i_image.height();
+    if ((o_gray_image.width() != (int)width) || (o_gray_image.height() != (int)height)
+            || (o_gray_image.spectrum() != 1)) {
+        o_gray_image.assign(width, height, 1, 1);
+    }
+    const uint32_t step = i_image.pixel_step();
+    for (uint32_t i_y = 0; i_y<height; ++i_y) {
+        const uint8_t * r = i_image.r_row(i_y);
+        const uint8_t * g = i_image.g_row(i_y);
+        const uint8_t * b = i_image.b_row(i_y);
+        unsigned char * dst = o_gray_image.data() + (size_t)i_y * width;
+        uint32_t i_x = 0;
+#ifdef __SSE2__
+        if (i_image.is_planar()) {
+            for (; i_x + 8 <= width; i_x += 8) {
+                const __m128i y = rgb_to_luma_epi16(r + i_x, g + i_x, b + i_x);
+                _mm_storel_epi64((__m128i *)(dst + i_x), _mm_packus_epi16(y, y));
+            }
+        }
+#endif
+        for (; i_x<width; ++i_x) {
+            const size_t ind = (size_t)i_x * step;
+            dst[i_x] = (unsigned char)rgb_to_luma(r[ind], g[ind], b[ind]);
+        }
+    }
+}
+
+} // end namespace Common
+
+#endif /* _COLOR_CONVERSION_UTILS_HPP *  * */
@@ -25,6 +25,17 @@ typedef enum ErrCode_t
     InvalidTemplateDimension     = 4,
     SolverNotInitialized         = 5,
     TemplateNotSet               = 6,
+    UnsupportedImageFormat       = 7,
+    JobManifestParsingError      = 8,
+    InvalidRawFrameFile          = 9,
+    NoRegisteredImage            = 10,
+    InvalidTiledPyramidFile      = 11,
+    ConfigFileParsingError       = 12,
+    TrackingLost                 = 13,
+    ServiceConnectionError       = 14,
+    InvalidServiceRequest        = 15,
+    UnsupportedLockstepMode      = 16,
+    UnsupportedDeadlineMode      = 17,
 
 } ErrCode;
 
@@ -9,6 +9,11 @@
 #ifndef _IM_PROCESSING_UTILS_HPP
 #define _IM_PROCESSING_UTILS_HPP
 
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include <CImg.h>
 
 #include "errCodes.h"
@@ -47,6 +52,174 @@ private:
 };
 
 
+/*
+* Non-owning view on 2D single channel image data, with an arbitrary row
+* stride (expressed in number of elements).
+*/
+template <typename T>
+struct ImView
+{
+public:
+    ImView() {}
+    ImView(const T * i_data, uint32_t i_width, uint32_t i_height, uint32_t i_stride) :
+        m_data(i_data),
+        m_width(i_width),
+        m_height(i_height),
+        m_stride(i_stride)
+    {}
+public:
+    inline const T * data() const { return m_data; }
+    inline const T * row(uint32_t i_y) const { return m_data + (size_t)i_y * m_stride; }
+    inline uint32_t width() const { return m_width; }
+    inline uint32_t height() const { return m_height; }
+    inline uint32_t stride() const { return m_stride; }
+private:
+    const T * m_data = NULL;
+    uint32_t  m_width = 0;
+    uint32_t  m_height = 0;
+    uint32_t  m_stride = 0;
+};
+
+/*
+* View on the first channel of a CImg image (CImg data has no row padding)
+*/
+template <typename T>
+inline
+ImView<T>
+im_view_from_cimg(
+        const cimg_library::CImg<T> & i_image)
+{
+    return ImView<T>(i_image.data(), i_image.width(), i_image.height(), i_image.width());
+}
+
+
+/*
+* Axis aligned rectangular region of interest [x0, x1[ x [y0, y1[ (in pixels)
+*/
+struct ImRoi
+{
+public:
+    ImRoi() {}
+    ImRoi(uint32_t i_x0, uint32_t i_y0, uint32_t i_x1, uint32_t i_y1) :
+        m_x0(i_x0), m_y0(i_y0), m_x1(i_x1), m_y1(i_y1)
+    {}
+public:
+    inline uint32_t x0() const { return m_x0; }
+    inline uint32_t y0() const { return m_y0; }
+    inline uint32_t x1() const { return m_x1; }
+    inline uint32_t y1() const { return m_y1; }
+    inline uint32_t width() const { return m_x1 - m_x0; }
+    inline uint32_t height() const { return m_y1 - m_y0; }
+    inline uint32_t size() const { return width() * height(); }
+    /*
+    * smallest roi containing both this roi and i_other
+    */
+    inline ImRoi get_union(const ImRoi & i_other) const {
+        return ImRoi(std::min(m_x0, i_other.m_x0), std::min(m_y0, i_other.m_y0),
+                std::max(m_x1, i_other.m_x1), std::max(m_y1, i_other.m_y1));
+    }
+private:
+    uint32_t m_x0 = 0;
+    uint32_t m_y0 = 0;
+    uint32_t m_x1 = 0;
+    uint32_t m_y1 = 0;
+};
+
+/*
+* Compute the bounding box of a quad (4 2D-points x0, y0, ..., y3), enlarged by
+* i_margin pixels on each side and clipped to the image dimensions. The roi is
+* at least 2x2 pixels wide so that it can always be interpolated.
+*/
+template <typename FloatPrec>
+ImRoi
+quad_bounding_roi(
+        const FloatPrec * i_pts,
+        FloatPrec         i_margin,
+        uint32_t          i_im_width,
+        uint32_t          i_im_height)
+{
+    FloatPrec x_min = i_pts[0];
+    FloatPrec x_max = i_pts[0];
+    FloatPrec y_min = i_pts[1];
+    FloatPrec y_max = i_pts[1];
+    for (uint32_t i_pt = 1; i_pt<4; ++i_pt) {
+        x_min = std::min(x_min, i_pts[2*i_pt + 0]);
+        x_max = std::max(x_max, i_pts[2*i_pt + 0]);
+        y_min = std::min(y_min, i_pts[2*i_pt + 1]);
+        y_max = std::max(y_max, i_pts[2*i_pt + 1]);
+    }
+    const FloatPrec w = (FloatPrec)i_im_width;
+    const FloatPrec h = (FloatPrec)i_im_height;
+    const FloatPrec x0 = std::min(std::max(std::floor(x_min - i_margin), (FloatPrec)0.), w - 2);
+    const FloatPrec y0 = std::min(std::max(std::floor(y_min - i_margin), (FloatPrec)0.), h - 2);
+    const FloatPrec x1 = std::max(std::min(std::ceil(x_max + i_margin) + 1, w), x0 + 2);
+    const FloatPrec y1 = std::max(std::min(std::ceil(y_max + i_margin) + 1, h), y0 + 2);
+    return ImRoi((uint32_t)x0, (uint32_t)y0, (uint32_t)x1, (uint32_t)y1);
+}
+
+/*
+* Convert the i_roi region of an 8-bit image to floating point, scaled by
+* i_normz_factor. o_image is only reallocated if its size has to change.
+*/
+template <typename FloatPrec>
+void
+crop_to_float(
+        const ImView<unsigned char> &   i_image,
+        const ImRoi &                   i_roi,
+        FloatPrec                       i_normz_factor,
+        cimg_library::CImg<FloatPrec> & o_image)
+{
+    const uint32_t roi_width = i_roi.width();
+    const uint32_t roi_height = i_roi.height();
+    if ((o_image.width() != (int)roi_width) || (o_image.height() != (int)roi_height)) {
+        o_image.assign(roi_width, roi_height, 1, 1);
+    }
+    for (uint32_t i_y = 0; i_y<roi_height; ++i_y) {
+        const unsigned char * src = i_image.row(i_roi.y0() + i_y) + i_roi.x0();
+        FloatPrec * dst = o_image.data() + (size_t)i_y * roi_width;
+        for (uint32_t i_x = 0; i_x<roi_width; ++i_x) {
+            dst[i_x] = i_normz_factor * (FloatPrec)src[i_x];
+        }
+    }
+}
+
+/*
+* Compute the horizontal and vertical image gradients with central differences
+* (one-sided differences on the image borders).
+*/
+template <typename FloatPrec>
+void
+compute_image_gradients(
+        const cimg_library::CImg<FloatPrec> & i_image,
+        cimg_library::CImg<FloatPrec> &       o_gradx,
+        cimg_library::CImg<FloatPrec> &       o_grady)
+{
+    const int32_t width = i_image.width();
+    const int32_t height = i_image.height();
+    if ((o_gradx.width() != width) || (o_gradx.height() != height)) {
+        o_gradx.assign(width, height, 1, 1);
+    }
+    if ((o_grady.width() != width) || (o_grady.height() != height)) {
+        o_grady.assign(width, height, 1, 1);
+    }
+    for (int32_t i_y = 0; i_y<height; ++i_y) {
+        const FloatPrec * row = i_image.data() + (size_t)i_y * width;
+        const FloatPrec * row_up = i_image.data() + (size_t)std::max(i_y-1, 0) * width;
+        const FloatPrec * row_dn = i_image.data() + (size_t)std::min(i_y+1, height-1) * width;
+        const FloatPrec y_scale = ((i_y > 0) && (i_y < height-1)) ? 0.5 : 1.;
+        FloatPrec * gx = o_gradx.data() + (size_t)i_y * width;
+        FloatPrec * gy = o_grady.data() + (size_t)i_y * width;
+        gx[0] = row[1] - row[0];
+        for (int32_t i_x = 1; i_x<width-1; ++i_x) {
+            gx[i_x] = 0.5 * (row[i_x+1] - row[i_x-1]);
+        }
+        gx[width-1] = row[width-1] - row[width-2];
+        for (int32_t i_x = 0; i_x<width; ++i_x) {
+            gy[i_x] = y_scale * (row_dn[i_x] - row_up[i_x]);
+        }
+    }
+}
+
 /*
 * Generate coeeficient to warp pixel to a quad grid (the template)
 * What is generated here are the coefficients of a Nx4 matrix W (N: number of
@@ -54,21 +227,19 @@ private:
 * known in the current image, the warped coordinates of a given pixel of the
 * template are (W * [Xv1, Xv2, Xv3, Xv4].T, W * [Yv1, Yv2, Yv3, Yv4].T)
 * W is stored as a vector in raw-major fashion.
+* This version writes into a preallocated buffer of N*4 elements.
 */
 template <typename FloatPrec>
 ErrCode
 generate_quad_warping_coeffs(
         uint32_t                 template_width,
         uint32_t                 template_height,
-        std::vector<FloatPrec> & o_W)
+        FloatPrec *              o_W)
 {
-    const int32_t N = template_width * template_height;
-    o_W.resize(N * 4);
-
-    if ((template_width < 2) && (template_width > MAX_TEMPLATE_DIMENSION)) {
+    if ((template_width < 2) || (template_width > MAX_TEMPLATE_DIMENSION)) {
         return InvalidTemplateDimension;
     }
-    if ((template_height < 2) && (template_height > MAX_TEMPLATE_DIMENSION)) {
+    if ((template_height < 2) || (template_height > MAX_TEMPLATE_DIMENSION)) {
         return InvalidTemplateDimension;
     }
 
@@ -107,23 +278,37 @@ generate_quad_warping_coeffs(
     return NoError;
 }
 
+template <typename FloatPrec>
+ErrCode
+generate_quad_warping_coeffs(
+        uint32_t                 template_width,
+        uint32_t                 template_height,
+        std::vector<FloatPrec> & o_W)
+{
+    const int32_t N = template_width * template_height;
+    o_W.resize(N * 4);
+    if (N == 0) {
+        return InvalidTemplateDimension;
+    }
+    return generate_quad_warping_coeffs(template_width, template_height, &(o_W[0]));
+}
+
 /*
 * perform quad warping based on precomputed interpolation coefficient from
 * function 'generate_quad_warping_coeffs'
-* WARNING: for performance reasons, o_warped_pixCoords must be already allocated
-* with the right size (N*2)
+* i_W holds the N*4 coefficients, o_warped_pixCoords must be already allocated
+* with N*2 elements (interleaved x, y coordinates).
 * i_pts holds the 2D coordinates of the quad's vertices A,B,C,D, and so has size
 * 8.
 */
 template <typename FloatPrec>
 ErrCode
 apply_quad_warping(
-        const std::vector<FloatPrec> & i_W,
-        const std::vector<FloatPrec> & i_pts,
-        std::vector<FloatPrec> &       o_warped_pixCoords)
+        const FloatPrec * i_W,
+        const FloatPrec * i_pts,
+        uint32_t          N,
+        FloatPrec *       o_warped_pixCoords)
 {
-    const uint32_t N = o_warped_pixCoords.size() / 4;
-
     const FloatPrec xA = i_pts[0*2 + 0];
     const FloatPrec yA = i_pts[0*2 + 1];
     const FloatPrec xB = i_pts[1*2 + 0];
@@ -145,6 +330,25 @@ apply_quad_warping(
     return NoError;
 }
 
+/*
+* std::vector version of apply_quad_warping
+* WARNING: for performance reasons, o_warped_pixCoords must be already allocated
+* with the right size (N*2)
+*/
+template <typename FloatPrec>
+ErrCode
+apply_quad_warping(
+        const std::vector<FloatPrec> & i_W,
+        const std::vector<FloatPrec> & i_pts,
+        std::vector<FloatPrec> &       o_warped_pixCoords)
+{
+    const uint32_t N = o_warped_pixCoords.size() / 2;
+    if (N == 0) {
+        return NoError;
+    }
+    return apply_quad_warping(&(i_W[0]), &(i_pts[0]), N, &(o_warped_pixCoords[0]));
+}
+
 template <typename FloatPrec>
 FloatPrec
 bilinear_pix_interp(
@@ -170,6 +374,295 @@ bilinear_pix_interp(
     return a*wa + b*wb + c*wc + d*wd;
 }
 
+/*
+* Same as bilinear_pix_interp, but coordinates falling outside of the image
+* are clamped to the image borders (safe for arbitrary warps).
+*/
+template <typename FloatPrec>
+FloatPrec
+bilinear_pix_interp_clamped(
+        const cimg_library::CImg<FloatPrec> & image,
+        FloatPrec                             x,
+        FloatPrec                             y)
+{
+    const FloatPrec x_max = (FloatPrec)(image.width() - 1);
+    const FloatPrec y_max = (FloatPrec)(image.height() - 1);
+    x = std::min(std::max(x, (FloatPrec)0.), x_max);
+    y = std::min(std::max(y, (FloatPrec)0.), y_max);
+    const uint32_t x0 = std::min((uint32_t) x, (uint32_t) image.width() - 2);
+    const uint32_t y0 = std::min((uint32_t) y, (uint32_t) image.height() - 2);
+    const FloatPrec ax = x - x0;
+    const FloatPrec ay = y - y0;
+
+    const FloatPrec * row0 = image.data() + (size_t)y0 * image.width() + x0;
+    const FloatPrec * row1 = row0 + image.width();
+    return (1-ay) * ((1-ax)*row0[0] + ax*row0[1]) + ay * ((1-ax)*row1[0] + ax*row1[1]);
+}
+
+/*
+* Resample an image by a given scale factor into a (i_width x i_height) image:
+* pixel (x, y) of o_image is interpolated at (x/i_scale, y/i_scale) in i_image.
+* Unlike CImg's resize, the mapping between both pixel grids is exactly a
+* scaling by i_scale, which keeps level coordinates consistent whatever the
+* image (or region of interest) size.
+*/
+template <typename FloatPrec>
+void
+resample_image(
+        const cimg_library::CImg<FloatPrec> & i_image,
+        FloatPrec                             i_scale,
+        uint32_t                              i_width,
+        uint32_t                              i_height,
+        cimg_library::CImg<FloatPrec> &       o_image)
+{
+    if ((o_image.width() != (int)i_width) || (o_image.height() != (int)i_height)) {
+        o_image.assign(i_width, i_height, 1, 1);
+    }
+    const FloatPrec inv_scale = 1. / i_scale;
+    for (uint32_t i_y = 0; i_y<i_height; ++i_y) {
+        FloatPrec * dst = o_image.data() + (size_t)i_y * i_width;
+        const FloatPrec y = inv_scale * i_y;
+        for (uint32_t i_x = 0; i_x<i_width; ++i_x) {
+            dst[i_x] = bilinear_pix_interp_clamped(i_image, inv_scale * i_x, y);
+        }
+    }
+}
+
+/*
+* Downsampling by a scale factor with a box prefilter, with the same pixel
+* grid mapping as 'resample_image': pixel x of the output is centered on x /
+* i_scale in the input, and averages the input over a box of width 1 / i_scale
+* around it (pixels partially covered by the box get fractional weights, input
+* borders are clamped). For a 0.5 scale this is the separable [1 2 1] / 4
+* filter. The filter taps and the intermediate image are kept between calls so
+* that repeated pyramid builds do not allocate.
+*/
+template <typename FloatPrec>
+struct BoxDownsampler
+{
+public:
+    void
+    run(
+            const cimg_library::CImg<FloatPrec> & i_image,
+            FloatPrec                             i_scale,
+            uint32_t                              i_width,
+            uint32_t                              i_height,
+            cimg_library::CImg<FloatPrec> &       o_image)
+    {
+        const uint32_t src_width = i_image.width();
+        const uint32_t src_height = i_image.height();
+        begin(src_width, src_height, i_scale, i_width, i_height, o_image);
+        for (uint32_t i_y = 0; i_y<src_height; ++i_y) {
+            push_row(i_image.data() + (size_t)i_y * src_width);
+        }
+    }
+
+    /*
+    * same filter, fed row by row: 'begin' sets the input and output geometry,
+    * then the input rows are pushed in order with 'push_row'. Each input row
+    * goes through the horizontal pass when it is pushed, and each output row
+    * is computed as soon as the input rows under its filter are available, so
+    * that a producer of the input rows (e.g. a color conversion) can
+    * downsample them while they are still in cache. o_image must stay alive
+    * until the last row is pushed.
+    */
+    void
+    begin(
+            uint32_t                              i_src_width,
+            uint32_t                              i_src_height,
+            FloatPrec                             i_scale,
+            uint32_t                              i_width,
+            uint32_t                              i_height,
+            cimg_library::CImg<FloatPrec> &       o_image)
+    {
+        compute_taps(i_src_width, i_width, i_scale, m_nb_taps_x, m_taps_ind_x, m_taps_w_x);
+        compute_taps(i_src_height, i_height, i_scale, m_nb_taps_y, m_taps_ind_y, m_taps_w_y);
+        if ((m_tmp.width() != (int)i_width) || (m_tmp.height() != (int)i_src_height)) {
+            m_tmp.assign(i_width, i_src_height, 1, 1);
+        }
+        if ((o_image.width() != (int)i_width) || (o_image.height() != (int)i_height)) {
+            o_image.assign(i_width, i_height, 1, 1);
+        }
+        m_out = &o_image;
+        m_nb_pushed_rows = 0;
+        m_nb_out_rows = 0;
+    }
+
+    void
+    push_row(
+            const FloatPrec * i_row)
+    {
+        // horizontal pass: input row -> output width columns
+        const uint32_t width = m_out->width();
+        FloatPrec * tmp_row = m_tmp.data() + (size_t)m_nb_pushed_rows * width;
+        for (uint32_t i_x = 0; i_x<width; ++i_x) {
+            const int32_t * ind = &(m_taps_ind_x[i_x * m_nb_taps_x]);
+            const FloatPrec * w = &(m_taps_w_x[i_x * m_nb_taps_x]);
+            FloatPrec acc = 0.;
+            for (uint32_t i_t = 0; i_t<m_nb_taps_x; ++i_t) {
+                acc += w[i_t] * i_row[ind[i_t]];
+            }
+            tmp_row[i_x] = acc;
+        }
+        m_nb_pushed_rows++;
+
+        // vertical pass (weighted sums of whole rows) of the output rows whose
+        // input rows are all available
+        const uint32_t height = m_out->height();
+        while (m_nb_out_rows < height) {
+            const int32_t * taps_ind = &(m_taps_ind_y[m_nb_out_rows * m_nb_taps_y]);
+            if (*std::max_element(taps_ind, taps_ind + m_nb_taps_y)
+                    >= (int32_t)m_nb_pushed_rows) {
+                break;
+            }
+            FloatPrec * dst = m_out->data() + (size_t)m_nb_out_rows * width;
+            std::fill(dst, dst + width, (FloatPrec)0.);
+            for (uint32_t i_t = 0; i_t<m_nb_taps_y; ++i_t) {
+                const FloatPrec w = m_taps_w_y[m_nb_out_rows * m_nb_taps_y + i_t];
+                const FloatPrec * src = m_tmp.data() + (size_t)taps_ind[i_t] * width;
+                for (uint32_t i_x = 0; i_x<width; ++i_x) {
+                    dst[i_x] += w * src[i_x];
+                }
+            }
+            m_nb_out_rows++;
+        }
+    }
+
+    /*
+    * same filter, computing only the output rows [i_y_begin, i_y_end[ (into
+    * o_band) from an 8-bit input: only the input rows under the band filter
+    * are converted, so that very large images can be downsampled band by band.
+    */
+    void
+    run_band(
+            const ImView<unsigned char> &   i_image,
+            FloatPrec                       i_scale,
+            uint32_t                        i_width,
+            uint32_t                        i_height,
+            uint32_t                        i_y_begin,
+            uint32_t                        i_y_end,
+            cimg_library::CImg<FloatPrec> & o_band)
+    {
+        const uint32_t src_width = i_image.width();
+        const uint32_t band_height = i_y_end - i_y_begin;
+        compute_taps(src_width, i_width, i_scale, m_nb_taps_x, m_taps_ind_x, m_taps_w_x);
+        compute_taps(i_image.height(), i_height, i_scale, m_nb_taps_y, m_taps_ind_y, m_taps_w_y);
+        const int32_t * taps_ind_y = &(m_taps_ind_y[i_y_begin * m_nb_taps_y]);
+        const int32_t src_y_begin = *std::min_element(
+                taps_ind_y, taps_ind_y + band_height * m_nb_taps_y);
+        const int32_t src_y_end = 1 + *std::max_element(
+                taps_ind_y, taps_ind_y + band_height * m_nb_taps_y);
+        m_tmp.assign(i_width, src_y_end - src_y_begin, 1, 1);
+        if ((o_band.width() != (int)i_width) || (o_band.height() != (int)band_height)) {
+            o_band.assign(i_width, band_height, 1, 1);
+        }
+
+        // horizontal pass on the input rows of the band
+        for (int32_t i_y = src_y_begin; i_y<src_y_end; ++i_y) {
+            const unsigned char * src = i_image.row(i_y);
+            FloatPrec * dst = m_tmp.data() + (size_t)(i_y - src_y_begin) * i_width;
+            for (uint32_t i_x = 0; i_x<i_width; ++i_x) {
+                const int32_t * ind = &(m_taps_ind_x[i_x * m_nb_taps_x]);
+                const FloatPrec * w = &(m_taps_w_x[i_x * m_nb_taps_x]);
+                FloatPrec acc = 0.;
+                for (uint32_t i_t = 0; i_t<m_nb_taps_x; ++i_t) {
+                    acc += w[i_t] * (FloatPrec)src[ind[i_t]];
+                }
+                dst[i_x] = acc;
+            }
+        }
+        // vertical pass
+        for (uint32_t i_y = 0; i_y<band_height; ++i_y) {
+            FloatPrec * dst = o_band.data() + (size_t)i_y * i_width;
+            std::fill(dst, dst + i_width, (FloatPrec)0.);
+            for (uint32_t i_t = 0; i_t<m_nb_taps_y; ++i_t) {
+                const FloatPrec w = m_taps_w_y[(i_y_begin + i_y) * m_nb_taps_y + i_t];
+                const FloatPrec * src = m_tmp.data() + (size_t)(
+                        taps_ind_y[i_y * m_nb_taps_y + i_t] - src_y_begin) * i_width;
+                for (uint32_t i_x = 0; i_x<i_width; ++i_x) {
+                    dst[i_x] += w * src[i_x];
+                }
+            }
+        }
+    }
+private:
+    /*
+    * input indices (clamped) and normalized weights of the box filter of each
+    * output pixel along one axis. Output pixels all get o_nb_taps taps (unused
+    * ones have a zero weight).
+    */
+    static void
+    compute_taps(
+            uint32_t                 i_src_size,
+            uint32_t                 i_dst_size,
+            FloatPrec                i_scale,
+            uint32_t &               o_nb_taps,
+            std::vector<int32_t> &   o_taps_ind,
+            std::vector<FloatPrec> & o_taps_w)
+    {
+        const FloatPrec inv_scale = 1. / i_scale;
+        const FloatPrec half_width = 0.5 * std::max(inv_scale, (FloatPrec)1.);
+        o_nb_taps = 2 + (uint32_t)std::ceil(2. * half_width);
+        o_taps_ind.assign((size_t)i_dst_size * o_nb_taps, 0);
+        o_taps_w.assign((size_t)i_dst_size * o_nb_taps, 0.);
+        for (uint32_t i_d = 0; i_d<i_dst_size; ++i_d) {
+            const FloatPrec lo = inv_scale * i_d - half_width;
+            const FloatPrec hi = inv_scale * i_d + half_width;
+            const int32_t k_beg = (int32_t)std::floor(lo + 0.5);
+            FloatPrec w_sum = 0.;
+            for (uint32_t i_t = 0; i_t<o_nb_taps; ++i_t) {
+                const int32_t k = k_beg + (int32_t)i_t;
+                // overlap of the box with input pixel k, i.e. [k-0.5, k+0.5]
+                const FloatPrec w = std::max((FloatPrec)0.,
+                        std::min(hi, (FloatPrec)k + (FloatPrec)0.5)
+                        - std::max(lo, (FloatPrec)k - (FloatPrec)0.5));
+                o_taps_ind[i_d * o_nb_taps + i_t] =
+                        std::min(std::max(k, 0), (int32_t)i_src_size - 1);
+                o_taps_w[i_d * o_nb_taps + i_t] = w;
+                w_sum += w;
+            }
+            for (uint32_t i_t = 0; i_t<o_nb_taps; ++i_t) {
+                o_taps_w[i_d * o_nb_taps + i_t] /= w_sum;
+            }
+        }
+    }
+private:
+    uint32_t                      m_nb_taps_x = 0;
+    uint32_t                      m_nb_taps_y = 0;
+    std::vector<int32_t>          m_taps_ind_x;
+    std::vector<int32_t>          m_taps_ind_y;
+    std::vector<FloatPrec>        m_taps_w_x;
+    std::vector<FloatPrec>        m_taps_w_y;
+    cimg_library::CImg<FloatPrec> m_tmp;
+    // row streaming state (see 'begin')
+    cimg_library::CImg<FloatPrec> * m_out = NULL;
+    uint32_t                      m_nb_pushed_rows = 0;
+    uint32_t                      m_nb_out_rows = 0;
+};
+
+/*
+* Convert an 8-bit image to a single channel (luma) image.
+* Grayscale images are copied as is, RGB images are converted through their
+* luma (Y) channel.
+*/
+inline
+ErrCode
+convert_to_gray(
+        const cimg_library::CImg<unsigned char> & i_image,
+        cimg_library::CImg<unsigned char> &       o_gray_image)
+{
+    switch(i_image.spectrum())
+    {
+        case 1:
+            o_gray_image = i_image;
+            return NoError;
+        case 3:
+            o_gray_image = i_image.get_RGBtoYCbCr().get_channel(0);
+            return NoError;
+    }
+    return UnsupportedImageFormat;
+}
+
 
 } // end namespace Common
 
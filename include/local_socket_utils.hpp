@@ -0,0 +1,190 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _LOCAL_SOCKET_UTILS_HPP
+#define _LOCAL_SOCKET_UTILS_HPP
+
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define LOCAL_SOCKETS_SUPPORTED 1
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // no such flag on macOS
+#endif
+#endif
+
+#include "errCodes.h"
+
+namespace Common
+{
+
+/*
+* Blocking Unix-domain stream sockets, for control channels between local
+* processes (fixed-size binary messages sent and received whole).
+*/
+
+#ifdef LOCAL_SOCKETS_SUPPORTED
+inline
+bool
+local_socket_address(
+        const std::string &  i_path,
+        struct sockaddr_un & o_address)
+{
+    std::memset(&o_address, 0, sizeof(o_address));
+    o_address.sun_family = AF_UNIX;
+    if (i_path.empty() || (i_path.size() >= sizeof(o_address.sun_path))) {
+        return false;
+    }
+    std::memcpy(o_address.sun_path, i_path.c_str(), i_path.size());
+    return true;
+}
+#endif
+
+/*
+* create a listening socket bound to i_path (a stale socket file left at
+* i_path by a previous server is replaced)
+*/
+inline
+ErrCode
+local_socket_listen(
+        const std::string & i_path,
+        int &               o_fd)
+{
+    o_fd = -1;
+#ifdef LOCAL_SOCKETS_SUPPORTED
+    struct sockaddr_un address;
+    if (!local_socket_address(i_path, address)) {
+        return ServiceConnectionError;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return ServiceConnectionError;
+    }
+    unlink(i_path.c_str());
+    if ((bind(fd, (const struct sockaddr *)&address, sizeof(address)) != 0)
+            || (listen(fd, 16) != 0)) {
+        ::close(fd);
+        return ServiceConnectionError;
+    }
+    o_fd = fd;
+    return NoError;
+#else
+    return ServiceConnectionError;
+#endif
+}
+
+/*
+* connect to the socket listening at i_path
+*/
+inline
+ErrCode
+local_socket_connect(
+        const std::string & i_path,
+        int &               o_fd)
+{
+    o_fd = -1;
+#ifdef LOCAL_SOCKETS_SUPPORTED
+    struct sockaddr_un address;
+    if (!local_socket_address(i_path, address)) {
+        return ServiceConnectionError;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return ServiceConnectionError;
+    }
+    if (connect(fd, (const struct sockaddr *)&address, sizeof(address)) != 0) {
+        ::close(fd);
+        return ServiceConnectionError;
+    }
+    o_fd = fd;
+    return NoError;
+#else
+    return ServiceConnectionError;
+#endif
+}
+
+/*
+* send / receive exactly i_size bytes (retrying partial transfers and
+* interrupted calls). Receiving fails when the peer closed the connection.
+*/
+inline
+ErrCode
+local_socket_send(
+        int          i_fd,
+        const void * i_data,
+        size_t       i_size)
+{
+#ifdef LOCAL_SOCKETS_SUPPORTED
+    const uint8_t * data = (const uint8_t *)i_data;
+    while (i_size > 0) {
+        const ssize_t nb_sent = send(i_fd, data, i_size, MSG_NOSIGNAL);
+        if (nb_sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ServiceConnectionError;
+        }
+        data += nb_sent;
+        i_size -= nb_sent;
+    }
+    return NoError;
+#else
+    return ServiceConnectionError;
+#endif
+}
+
+inline
+ErrCode
+local_socket_recv(
+        int    i_fd,
+        void * o_data,
+        size_t i_size)
+{
+#ifdef LOCAL_SOCKETS_SUPPORTED
+    uint8_t * data = (uint8_t *)o_data;
+    while (i_size > 0) {
+        const ssize_t nb_received = recv(i_fd, data, i_size, 0);
+        if (nb_received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ServiceConnectionError;
+        }
+        if (nb_received == 0) {
+            return ServiceConnectionError; // connection closed
+        }
+        data += nb_received;
+        i_size -= nb_received;
+    }
+    return NoError;
+#else
+    return ServiceConnectionError;
+#endif
+}
+
+inline
+void
+local_socket_close(
+        int & io_fd)
+{
+#ifdef LOCAL_SOCKETS_SUPPORTED
+    if (io_fd >= 0) {
+        ::close(io_fd);
+    }
+#endif
+    io_fd = -1;
+}
+
+} // end namespace Common
+
+#endif /* _LOCAL_SOCKET_UTILS_HPP *  * */
@@ -0,0 +1,44 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _OPTIMIZATION_UTILS_HPP
+#define _OPTIMIZATION_UTILS_HPP
+
+#include <Eigen/Dense>
+
+#include "errCodes.h"
+
+namespace Common
+{
+
+/*
+* Perform one Gauss-Newton descent step on a least-squares problem of the form
+* min 0.5 * |e(x)|^2, given the error vector e (stored as a row vector of size
+* N) and its jacobian J (N x nb_vars) at the current x.
+* The normal equations (J^T J) dx = -J^T e are assembled in the (preallocated)
+* o_jTj and o_jTb containers and solved with a robust Cholesky (LDLT)
+* decomposition. The solution is returned as a row vector in o_delta.
+* i_errs and i_jaco can be block expressions (e.g. a subset of the rows).
+*/
+template <typename ErrT, typename JacoT, typename VecT, typename MatT>
+ErrCode
+gauss_newton_descent_step(
+        const ErrT &  i_errs,
+        const JacoT & i_jaco,
+        MatT &        o_jTj,
+        VecT &        o_jTb,
+        VecT &        o_delta)
+{
+    o_jTj.noalias() = i_jaco.transpose() * i_jaco;
+    o_jTb.noalias() = i_errs * i_jaco;
+    o_delta = -(o_jTj.ldlt().solve(o_jTb.transpose())).transpose();
+    return NoError;
+}
+
+} // end namespace Common
+
+#endif /* _OPTIMIZATION_UTILS_HPP *  * */
@@ -0,0 +1,330 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _RAW_FRAME_CONTAINER_HPP
+#define _RAW_FRAME_CONTAINER_HPP
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RAW_FRAMES_USE_MMAP 1
+#endif
+
+#include "errCodes.h"
+#include "im_processing_utils.hpp"
+
+namespace Common
+{
+
+/*
+* Raw frame container: a fixed-size header, then contiguous uint8 frames.
+* Each frame stores its channels as planes (same layout as CImg) of m_height
+* rows of m_stride bytes. Rows and frames are padded to 64 bytes, and the
+* first frame starts on a page boundary, so that frames of a memory-mapped
+* file can be handed out as zero-copy views.
+*/
+typedef enum RawFrameFormat_t
+{
+    RawFrameGray8      = 0,
+    RawFrameRGB8Planar = 1,
+} RawFrameFormat;
+
+inline
+uint32_t
+raw_frame_nb_channels(
+        uint32_t i_format)
+{
+    return (i_format == RawFrameRGB8Planar) ? 3 : 1;
+}
+
+struct RawFrameFileHeader
+{
+    char     m_magic[4];    // "DIRF"
+    uint32_t m_version;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_stride;      // bytes per row
+    uint32_t m_format;      // RawFrameFormat
+    uint64_t m_nb_frames;
+    uint64_t m_frame_size;  // bytes per frame, padding included
+    uint64_t m_data_offset; // offset of the first frame in the file
+};
+
+static const uint32_t RAW_FRAMES_VERSION = 1;
+static const uint32_t RAW_FRAMES_ALIGNMENT = 64;
+static const uint64_t RAW_FRAMES_DATA_OFFSET = 4096;
+
+
+/*
+* Sequential writer of a raw frame file
+*/
+struct RawFrameWriter
+{
+public:
+    RawFrameWriter() {}
+    ~RawFrameWriter() { close(); }
+public:
+    /*
+    * create the file for frames of the given dimensions and format
+    */
+    ErrCode
+    open(
+            const std::string & i_filename,
+            uint32_t            i_width,
+            uint32_t            i_height,
+            RawFrameFormat      i_format)
+    {
+        if ((i_width == 0) || (i_height == 0)) {
+            return InvalidRawFrameFile;
+        }
+        m_file = std::fopen(i_filename.c_str(), "wb");
+        if (m_file == NULL) {
+            return IOCantOpenFile;
+        }
+        const uint32_t align = RAW_FRAMES_ALIGNMENT;
+        std::memcpy(m_header.m_magic, "DIRF", 4);
+        m_header.m_version = RAW_FRAMES_VERSION;
+        m_header.m_width = i_width;
+        m_header.m_height = i_height;
+        m_header.m_stride = ((i_width + align - 1) / align) * align;
+        m_header.m_format = i_format;
+        m_header.m_nb_frames = 0;
+        m_header.m_frame_size = (uint64_t)raw_frame_nb_channels(i_format)
+                * m_header.m_stride * i_height;
+        m_header.m_frame_size = ((m_header.m_frame_size + align - 1) / align) * align;
+        m_header.m_data_offset = RAW_FRAMES_DATA_OFFSET;
+        m_frame_buffer.assign(m_header.m_frame_size, 0);
+
+        // header, padded up to the first frame
+        std::vector<uint8_t> header_block(m_header.m_data_offset, 0);
+        std::memcpy(&(header_block[0]), &m_header, sizeof(m_header));
+        if (std::fwrite(&(header_block[0]), 1, header_block.size(), m_file)
+                != header_block.size()) {
+            return IOCantOpenFile;
+        }
+        return NoError;
+    }
+
+    /*
+    * append a frame, given as one view per channel (all with the dimensions
+    * given to 'open')
+    */
+    ErrCode
+    write_frame(
+            const ImView<uint8_t> * i_channels)
+    {
+        if (m_file == NULL) {
+            return IOCantOpenFile;
+        }
+        const uint32_t nb_channels = raw_frame_nb_channels(m_header.m_format);
+        for (uint32_t i_c = 0; i_c<nb_channels; ++i_c) {
+            if ((i_channels[i_c].width() != m_header.m_width)
+                    || (i_channels[i_c].height() != m_header.m_height)) {
+                return UnsupportedImageFormat;
+            }
+            uint8_t * plane = &(m_frame_buffer[0])
+                    + (size_t)i_c * m_header.m_stride * m_header.m_height;
+            for (uint32_t i_y = 0; i_y<m_header.m_height; ++i_y) {
+                std::memcpy(plane + (size_t)i_y * m_header.m_stride,
+                        i_channels[i_c].row(i_y), m_header.m_width);
+            }
+        }
+        if (std::fwrite(&(m_frame_buffer[0]), 1, m_frame_buffer.size(), m_file)
+                != m_frame_buffer.size()) {
+            return IOCantOpenFile;
+        }
+        m_header.m_nb_frames++;
+        return NoError;
+    }
+
+    /*
+    * update the frame count in the header and close the file
+    */
+    ErrCode
+    close()
+    {
+        if (m_file == NULL) {
+            return NoError;
+        }
+        ErrCode errCode = NoError;
+        if ((std::fseek(m_file, 0, SEEK_SET) != 0)
+                || (std::fwrite(&m_header, sizeof(m_header), 1, m_file) != 1)) {
+            errCode = IOCantOpenFile;
+        }
+        std::fclose(m_file);
+        m_file = NULL;
+        return errCode;
+    }
+
+    inline uint64_t nb_frames() const { return m_header.m_nb_frames; }
+private:
+    std::FILE *          m_file = NULL;
+    RawFrameFileHeader   m_header = RawFrameFileHeader();
+    std::vector<uint8_t> m_frame_buffer;
+private:
+    // non-copyable
+    RawFrameWriter(RawFrameWriter const &);
+    RawFrameWriter & operator = (RawFrameWriter const &);
+};
+
+
+/*
+* Memory-mapped reader of a raw frame file: frames are handed out as views on
+* the mapping, without any copy or decoding. On platforms without mmap the
+* whole file is read in memory instead.
+*/
+struct RawFrameReader
+{
+public:
+    RawFrameReader() {}
+    ~RawFrameReader() { close(); }
+public:
+    ErrCode
+    open(
+            const std::string & i_filename)
+    {
+        close();
+#ifdef RAW_FRAMES_USE_MMAP
+        const int fd = ::open(i_filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return IOCantOpenFile;
+        }
+        struct stat file_stat;
+        if ((fstat(fd, &file_stat) != 0) || (file_stat.st_size == 0)) {
+            ::close(fd);
+            return IOCantOpenFile;
+        }
+        m_file_size = file_stat.st_size;
+        void * mapping = mmap(NULL, m_file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd); // the mapping stays valid
+        if (mapping == MAP_FAILED) {
+            m_file_size = 0;
+            return IOCantOpenFile;
+        }
+        m_data = (const uint8_t *)mapping;
+        madvise(mapping, m_file_size, MADV_SEQUENTIAL);
+#else
+        std::FILE * file = std::fopen(i_filename.c_str(), "rb");
+        if (file == NULL) {
+            return IOCantOpenFile;
+        }
+        std::fseek(file, 0, SEEK_END);
+        m_file_size = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+        m_file_copy.resize(m_file_size);
+        const size_t nb_read = (m_file_size > 0) ?
+                std::fread(&(m_file_copy[0]), 1, m_file_size, file) : 0;
+        std::fclose(file);
+        if ((m_file_size == 0) || (nb_read != m_file_size)) {
+            close();
+            return IOCantOpenFile;
+        }
+        m_data = &(m_file_copy[0]);
+#endif
+        return check_header();
+    }
+
+    void
+    close()
+    {
+#ifdef RAW_FRAMES_USE_MMAP
+        if (m_data != NULL) {
+            munmap((void *)m_data, m_file_size);
+        }
+#else
+        m_file_copy.clear();
+#endif
+        m_data = NULL;
+        m_file_size = 0;
+        std::memset(&m_header, 0, sizeof(m_header));
+    }
+
+    /*
+    * touch every page of the frames, so that the replay of the sequence is not
+    * slowed down by page faults (mapped files are loaded lazily)
+    */
+    uint64_t
+    preload() const
+    {
+        uint64_t checksum = 0;
+        for (uint64_t i_b = m_header.m_data_offset; i_b<m_file_size; i_b += 4096) {
+            checksum += m_data[i_b];
+        }
+        return checksum;
+    }
+
+    /*
+    * view on one channel of a frame (no copy)
+    */
+    inline ImView<uint8_t> frame_view(uint64_t i_frame, uint32_t i_channel = 0) const {
+        const uint8_t * frame = m_data + m_header.m_data_offset
+                + i_frame * m_header.m_frame_size
+                + (size_t)i_channel * m_header.m_stride * m_header.m_height;
+        return ImView<uint8_t>(frame, m_header.m_width, m_header.m_height, m_header.m_stride);
+    }
+
+    inline bool is_open() const { return m_data != NULL; }
+    inline uint64_t nb_frames() const { return m_header.m_nb_frames; }
+    inline uint32_t width() const { return m_header.m_width; }
+    inline uint32_t height() const { return m_header.m_height; }
+    inline uint32_t stride() const { return m_header.m_stride; }
+    inline RawFrameFormat format() const { return (RawFrameFormat)m_header.m_format; }
+    inline uint32_t nb_channels() const { return raw_frame_nb_channels(m_header.m_format); }
+private:
+    ErrCode
+    check_header()
+    {
+        if (m_file_size < sizeof(RawFrameFileHeader)) {
+            close();
+            return InvalidRawFrameFile;
+        }
+        std::memcpy(&m_header, m_data, sizeof(m_header));
+        // the size checks are written as divisions, so that bogus header
+        // values cannot overflow them
+        const uint64_t plane_size = (uint64_t)m_header.m_stride * m_header.m_height;
+        const bool is_valid = (std::memcmp(m_header.m_magic, "DIRF", 4) == 0)
+                && (m_header.m_version == RAW_FRAMES_VERSION)
+                && (m_header.m_format <= RawFrameRGB8Planar)
+                && (m_header.m_width > 0) && (m_header.m_height > 0)
+                && (m_header.m_stride >= m_header.m_width)
+                && (m_header.m_frame_size > 0)
+                && (raw_frame_nb_channels(m_header.m_format)
+                        <= m_header.m_frame_size / plane_size)
+                && (m_header.m_data_offset >= sizeof(RawFrameFileHeader))
+                && (m_header.m_data_offset <= m_file_size)
+                && (m_header.m_nb_frames
+                        <= (m_file_size - m_header.m_data_offset) / m_header.m_frame_size);
+        if (!is_valid) {
+            close();
+            return InvalidRawFrameFile;
+        }
+        return NoError;
+    }
+private:
+    const uint8_t *      m_data = NULL;
+    uint64_t             m_file_size = 0;
+    RawFrameFileHeader   m_header = RawFrameFileHeader();
+#ifndef RAW_FRAMES_USE_MMAP
+    std::vector<uint8_t> m_file_copy;
+#endif
+private:
+    // non-copyable
+    RawFrameReader(RawFrameReader const &);
+    RawFrameReader & operator = (RawFrameReader const &);
+};
+
+} // end namespace Common
+
+#endif /* _RAW_FRAME_CONTAINER_HPP *  * */
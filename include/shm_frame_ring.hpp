@@ -0,0 +1,265 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _SHM_FRAME_RING_HPP
+#define _SHM_FRAME_RING_HPP
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHM_FRAME_RING_SUPPORTED 1
+#endif
+
+#include "errCodes.h"
+#include "im_processing_utils.hpp"
+
+namespace Common
+{
+
+/*
+* Frame ring buffer in POSIX shared memory, to hand frames from a client
+* process to a server process without copies: the client creates the ring
+* (named shared memory object), writes each frame in a slot and sends the slot
+* index on its control channel, the server attaches the ring and reads the
+* frame in place.
+* The ring holds no synchronization of its own: a slot belongs to the server
+* from the request naming it to the reply, and the client only reuses it after
+* the reply (the socket round trip orders the memory accesses).
+* Each slot holds one frame, stored as in raw frame files (channel planes of
+* rows padded to 64 bytes, see raw_frame_container.hpp), with the row stride
+* of the ring.
+*/
+struct ShmFrameRingHeader
+{
+    char     m_magic[4];        // "DIRR"
+    uint32_t m_version;
+    uint32_t m_nb_slots;
+    uint32_t m_max_width;
+    uint32_t m_max_height;
+    uint32_t m_max_nb_channels;
+    uint32_t m_stride;          // bytes per row
+    uint32_t m_padding;
+    uint64_t m_slot_size;       // bytes per slot, padding included
+    uint64_t m_data_offset;     // offset of the first slot
+};
+
+static const uint32_t SHM_FRAME_RING_VERSION = 1;
+static const uint32_t SHM_FRAME_RING_ALIGNMENT = 64;
+static const uint64_t SHM_FRAME_RING_DATA_OFFSET = 4096;
+
+
+struct ShmFrameRing
+{
+public:
+    ShmFrameRing() {}
+    ~ShmFrameRing() { close(); }
+public:
+    /*
+    * create the shared memory object i_name ('/name', as for shm_open) for
+    * i_nb_slots frames of up to i_max_width x i_max_height pixels and
+    * i_max_nb_channels channels. The object is removed by 'close'.
+    */
+    ErrCode
+    create(
+            const std::string & i_name,
+            uint32_t            i_nb_slots,
+            uint32_t            i_max_width,
+            uint32_t            i_max_height,
+            uint32_t            i_max_nb_channels)
+    {
+        close();
+        if ((i_nb_slots == 0) || (i_max_width == 0) || (i_max_height == 0)
+                || (i_max_nb_channels == 0)) {
+            return UnsupportedImageFormat;
+        }
+        const uint32_t align = SHM_FRAME_RING_ALIGNMENT;
+        ShmFrameRingHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.m_magic, "DIRR", 4);
+        header.m_version = SHM_FRAME_RING_VERSION;
+        header.m_nb_slots = i_nb_slots;
+        header.m_max_width = i_max_width;
+        header.m_max_height = i_max_height;
+        header.m_max_nb_channels = i_max_nb_channels;
+        header.m_stride = ((i_max_width + align - 1) / align) * align;
+        header.m_slot_size = (uint64_t)i_max_nb_channels * header.m_stride * i_max_height;
+        header.m_slot_size = ((header.m_slot_size + align - 1) / align) * align;
+        header.m_data_offset = SHM_FRAME_RING_DATA_OFFSET;
+#ifdef SHM_FRAME_RING_SUPPORTED
+        const int fd = shm_open(i_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            return ServiceConnectionError;
+        }
+        m_size = header.m_data_offset + header.m_slot_size * i_nb_slots;
+        if (ftruncate(fd, m_size) != 0) {
+            ::close(fd);
+            shm_unlink(i_name.c_str());
+            return ServiceConnectionError;
+        }
+        m_is_owner = true;
+        m_name = i_name;
+        const ErrCode errCode = map(fd);
+        if (errCode != NoError) {
+            close();
+            return errCode;
+        }
+        std::memcpy(m_data, &header, sizeof(header));
+        m_header = header;
+        return NoError;
+#else
+        return ServiceConnectionError;
+#endif
+    }
+
+    /*
+    * map the existing ring i_name (created by another process)
+    */
+    ErrCode
+    attach(
+            const std::string & i_name)
+    {
+        close();
+#ifdef SHM_FRAME_RING_SUPPORTED
+        const int fd = shm_open(i_name.c_str(), O_RDWR, 0600);
+        if (fd < 0) {
+            return ServiceConnectionError;
+        }
+        struct stat shm_stat;
+        if ((fstat(fd, &shm_stat) != 0)
+                || ((uint64_t)shm_stat.st_size < SHM_FRAME_RING_DATA_OFFSET)) {
+            ::close(fd);
+            return ServiceConnectionError;
+        }
+        m_size = shm_stat.st_size;
+        m_name = i_name;
+        const ErrCode errCode = map(fd);
+        if (errCode != NoError) {
+            close();
+            return errCode;
+        }
+        return check_header();
+#else
+        return ServiceConnectionError;
+#endif
+    }
+
+    /*
+    * unmap the ring (and remove the shared memory object if this ring created
+    * it: processes that attached it keep their mapping)
+    */
+    void
+    close()
+    {
+#ifdef SHM_FRAME_RING_SUPPORTED
+        if (m_data != NULL) {
+            munmap(m_data, m_size);
+        }
+        if (m_is_owner) {
+            shm_unlink(m_name.c_str());
+        }
+#endif
+        m_data = NULL;
+        m_size = 0;
+        m_is_owner = false;
+        m_name.clear();
+        std::memset(&m_header, 0, sizeof(m_header));
+    }
+
+    /*
+    * first byte of a slot, and view on one channel of the frame it holds
+    */
+    inline uint8_t * slot(uint32_t i_slot) const {
+        return m_data + m_header.m_data_offset + (uint64_t)i_slot * m_header.m_slot_size;
+    }
+    inline uint8_t * slot_plane(uint32_t i_slot, uint32_t i_height, uint32_t i_channel) const {
+        return slot(i_slot) + (size_t)i_channel * m_header.m_stride * i_height;
+    }
+    inline ImView<uint8_t> slot_view(
+            uint32_t i_slot, uint32_t i_width, uint32_t i_height, uint32_t i_channel = 0) const {
+        return ImView<uint8_t>(slot_plane(i_slot, i_height, i_channel),
+                i_width, i_height, m_header.m_stride);
+    }
+
+    /*
+    * whether a frame of the given geometry fits in slot i_slot
+    */
+    inline bool
+    frame_fits(
+            uint32_t i_slot, uint32_t i_width, uint32_t i_height, uint32_t i_nb_channels) const {
+        return is_open() && (i_slot < m_header.m_nb_slots)
+                && (i_width > 0) && (i_width <= m_header.m_max_width)
+                && (i_height > 0) && (i_height <= m_header.m_max_height)
+                && (i_nb_channels > 0) && (i_nb_channels <= m_header.m_max_nb_channels);
+    }
+
+    inline bool is_open() const { return m_data != NULL; }
+    inline const std::string & name() const { return m_name; }
+    inline uint32_t nb_slots() const { return m_header.m_nb_slots; }
+    inline uint32_t max_width() const { return m_header.m_max_width; }
+    inline uint32_t max_height() const { return m_header.m_max_height; }
+    inline uint32_t max_nb_channels() const { return m_header.m_max_nb_channels; }
+    inline uint32_t stride() const { return m_header.m_stride; }
+private:
+#ifdef SHM_FRAME_RING_SUPPORTED
+    ErrCode
+    map(
+            int i_fd)
+    {
+        void * mapping = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, i_fd, 0);
+        ::close(i_fd); // the mapping stays valid
+        if (mapping == MAP_FAILED) {
+            m_size = 0;
+            return ServiceConnectionError;
+        }
+        m_data = (uint8_t *)mapping;
+        return NoError;
+    }
+#endif
+
+    ErrCode
+    check_header()
+    {
+        std::memcpy(&m_header, m_data, sizeof(m_header));
+        // the header is written by the other process: the size checks are
+        // written as divisions, so that bogus values cannot overflow them
+        const uint64_t plane_size = (uint64_t)m_header.m_stride * m_header.m_max_height;
+        const bool is_valid = (std::memcmp(m_header.m_magic, "DIRR", 4) == 0)
+                && (m_header.m_version == SHM_FRAME_RING_VERSION)
+                && (m_header.m_stride >= m_header.m_max_width)
+                && (plane_size != 0) && (m_header.m_slot_size != 0)
+                && (m_header.m_max_nb_channels <= m_header.m_slot_size / plane_size)
+                && (m_header.m_data_offset >= sizeof(ShmFrameRingHeader))
+                && (m_header.m_data_offset <= m_size)
+                && (m_header.m_nb_slots
+                        <= (m_size - m_header.m_data_offset) / m_header.m_slot_size);
+        if (!is_valid) {
+            close();
+            return ServiceConnectionError;
+        }
+        return NoError;
+    }
+private:
+    uint8_t *          m_data = NULL;
+    uint64_t           m_size = 0;
+    bool               m_is_owner = false;
+    std::string        m_name;
+    ShmFrameRingHeader m_header = ShmFrameRingHeader();
+private:
+    // non-copyable
+    ShmFrameRing(ShmFrameRing const &);
+    ShmFrameRing & operator = (ShmFrameRing const &);
+};
+
+} // end namespace Common
+
+#endif /* _SHM_FRAME_RING_HPP *  * */
@@ -0,0 +1,250 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _SYNTHETIC_WORKLOAD_HPP
+#define _SYNTHETIC_WORKLOAD_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <CImg.h>
+
+#include "errCodes.h"
+
+namespace Common
+{
+
+/*
+* Generate a smooth random grayscale texture (sum of random sinusoidal gratings
+* and gaussian blobs), with content at all the scales used by the
+* registration pyramid.
+*/
+inline
+void
+generate_synthetic_texture(
+        uint32_t                            i_width,
+        uint32_t                            i_height,
+        uint32_t                            i_seed,
+        cimg_library::CImg<unsigned char> & o_image)
+{
+    const double pi = 3.14159265358979323846;
+    const uint32_t nb_gratings = 12;
+    const uint32_t nb_blobs = 40;
+    std::mt19937 rng(i_seed);
+    std::uniform_real_distribution<double> unif(0., 1.);
+
+    std::vector<double> accum((size_t)i_width * i_height, 0.);
+    for (uint32_t i_g = 0; i_g<nb_gratings; ++i_g) {
+        const double angle = 2. * pi * unif(rng);
+        const double freq = 0.005 + 0.06 * unif(rng) * unif(rng); // cycles/pixel
+        const double phase = 2. * pi * unif(rng);
+        const double fx = 2. * pi * freq * std::cos(angle);
+        const double fy = 2. * pi * freq * std::sin(angle);
+        const double amp = 20. * unif(rng);
+        for (uint32_t i_y = 0; i_y<i_height; ++i_y) {
+            for (uint32_t i_x = 0; i_x<i_width; ++i_x) {
+                accum[(size_t)i_y*i_width + i_x] +=
+                        amp * std::sin(fx * i_x + fy * i_y + phase);
+            }
+        }
+    }
+    for (uint32_t i_b = 0; i_b<nb_blobs; ++i_b) {
+        const double cx = i_width * unif(rng);
+        const double cy = i_height * unif(rng);
+        const double sigma = 4. + 0.05 * std::min(i_width, i_height) * unif(rng);
+        const double amp = 120. * (unif(rng) - 0.5);
+        const int32_t rad = (int32_t)(3. * sigma);
+        const int32_t x_beg = std::max((int32_t)cx - rad, 0);
+        const int32_t x_end = std::min((int32_t)cx + rad, (int32_t)i_width);
+        const int32_t y_beg = std::max((int32_t)cy - rad, 0);
+        const int32_t y_end = std::min((int32_t)cy + rad, (int32_t)i_height);
+        for (int32_t i_y = y_beg; i_y<y_end; ++i_y) {
+            for (int32_t i_x = x_beg; i_x<x_end; ++i_x) {
+                const double d2 = (i_x-cx)*(i_x-cx) + (i_y-cy)*(i_y-cy);
+                accum[(size_t)i_y*i_width + i_x] +=
+                        amp * std::exp(-0.5 * d2 / (sigma*sigma));
+            }
+        }
+    }
+
+    o_image.assign(i_width, i_height, 1, 1);
+    for (size_t i_pix = 0; i_pix<accum.size(); ++i_pix) {
+        const double val = 128. + accum[i_pix];
+        o_image.data()[i_pix] = (unsigned char)std::min(std::max(val, 0.), 255.);
+    }
+}
+
+/*
+* 2D affine transform x' = A * x + b, stored as [a00, a01, b0, a10, a11, b1]
+*/
+template <typename FloatPrec>
+struct Affine2D
+{
+public:
+    Affine2D() {}
+    Affine2D(FloatPrec a00, FloatPrec a01, FloatPrec b0,
+            FloatPrec a10, FloatPrec a11, FloatPrec b1)
+    {
+        m_coeffs[0] = a00; m_coeffs[1] = a01; m_coeffs[2] = b0;
+        m_coeffs[3] = a10; m_coeffs[4] = a11; m_coeffs[5] = b1;
+    }
+public:
+    inline void apply(FloatPrec i_x, FloatPrec i_y, FloatPrec & o_x, FloatPrec & o_y) const {
+        o_x = m_coeffs[0]*i_x + m_coeffs[1]*i_y + m_coeffs[2];
+        o_y = m_coeffs[3]*i_x + m_coeffs[4]*i_y + m_coeffs[5];
+    }
+    Affine2D get_inverse() const {
+        const FloatPrec inv_det = 1. / (m_coeffs[0]*m_coeffs[4] - m_coeffs[1]*m_coeffs[3]);
+        const FloatPrec i00 = inv_det * m_coeffs[4];
+        const FloatPrec i01 = -inv_det * m_coeffs[1];
+        const FloatPrec i10 = -inv_det * m_coeffs[3];
+        const FloatPrec i11 = inv_det * m_coeffs[0];
+        return Affine2D(i00, i01, -(i00*m_coeffs[2] + i01*m_coeffs[5]),
+                i10, i11, -(i10*m_coeffs[2] + i11*m_coeffs[5]));
+    }
+private:
+    FloatPrec m_coeffs[6] = {1., 0., 0., 0., 1., 0.};
+};
+
+/*
+* Bounds of the random affine motions applied between reference and
+* registration images.
+*/
+template <typename FloatPrec>
+struct SyntheticMotion
+{
+    FloatPrec m_max_translation = 8.;     // pixels
+    FloatPrec m_max_rotation = 0.05;      // radians
+    FloatPrec m_max_scale_change = 0.05;  // relative
+};
+
+/*
+* Draw a random affine motion (rotation, scaling and translation around the
+* point (i_cx, i_cy)) within the given bounds.
+*/
+template <typename FloatPrec>
+Affine2D<FloatPrec>
+random_affine_motion(
+        const SyntheticMotion<FloatPrec> & i_motion,
+        FloatPrec                          i_cx,
+        FloatPrec                          i_cy,
+        std::mt19937 &                     io_rng)
+{
+    std::uniform_real_distribution<FloatPrec> unif(-1., 1.);
+    const FloatPrec angle = i_motion.m_max_rotation * unif(io_rng);
+    const FloatPrec scale = 1. + i_motion.m_max_scale_change * unif(io_rng);
+    const FloatPrec tx = i_motion.m_max_translation * unif(io_rng);
+    const FloatPrec ty = i_motion.m_max_translation * unif(io_rng);
+    const FloatPrec a00 = scale * std::cos(angle);
+    const FloatPrec a01 = -scale * std::sin(angle);
+    const FloatPrec a10 = scale * std::sin(angle);
+    const FloatPrec a11 = scale * std::cos(angle);
+    return Affine2D<FloatPrec>(
+            a00, a01, i_cx + tx - (a00*i_cx + a01*i_cy),
+            a10, a11, i_cy + ty - (a10*i_cx + a11*i_cy));
+}
+
+/*
+* Warp an 8-bit single channel image with an affine transform:
+* o_image(x) = i_image(T^-1(x)) (bilinear interpolation, clamped borders).
+*/
+template <typename FloatPrec>
+void
+warp_image_affine(
+        const cimg_library::CImg<unsigned char> & i_image,
+        const Affine2D<FloatPrec> &               i_transform,
+        cimg_library::CImg<unsigned char> &       o_image)
+{
+    const int32_t width = i_image.width();
+    const int32_t height = i_image.height();
+    const Affine2D<FloatPrec> inv_transform = i_transform.get_inverse();
+    o_image.assign(width, height, 1, 1);
+    for (int32_t i_y = 0; i_y<height; ++i_y) {
+        for (int32_t i_x = 0; i_x<width; ++i_x) {
+            FloatPrec sx, sy;
+            inv_transform.apply(i_x, i_y, sx, sy);
+            sx = std::min(std::max(sx, (FloatPrec)0.), (FloatPrec)(width - 1));
+            sy = std::min(std::max(sy, (FloatPrec)0.), (FloatPrec)(height - 1));
+            const int32_t x0 = std::min((int32_t)sx, width - 2);
+            const int32_t y0 = std::min((int32_t)sy, height - 2);
+            const FloatPrec ax = sx - x0;
+            const FloatPrec ay = sy - y0;
+            const FloatPrec val =
+                    (1-ay) * ((1-ax)*i_image(x0, y0) + ax*i_image(x0+1, y0))
+                    + ay * ((1-ax)*i_image(x0, y0+1) + ax*i_image(x0+1, y0+1));
+            o_image(i_x, i_y) = (unsigned char)(val + 0.5);
+        }
+    }
+}
+
+/*
+* A synthetic registration problem. Quads store the 4 2D-points x0, y0, ...,
+* y3. The registration starts from m_init_pts (the reference annotation) and
+* should end up on m_gt_pts. Since the motion is affine, the ground truth is
+* exact for the bilinear quad warp of the solver.
+*/
+template <typename FloatPrec>
+struct SyntheticRegistrationSample
+{
+    cimg_library::CImg<unsigned char> m_reg_image;
+    std::vector<FloatPrec>            m_init_pts;
+    std::vector<FloatPrec>            m_gt_pts;
+};
+
+/*
+* Generate a registration image by applying a random affine motion (centered
+* on the annotated quad) to the reference image.
+*/
+template <typename FloatPrec>
+void
+generate_synthetic_sample(
+        const cimg_library::CImg<unsigned char> & i_ref_image,
+        const std::vector<FloatPrec> &            i_annot_pts,
+        const SyntheticMotion<FloatPrec> &        i_motion,
+        std::mt19937 &                            io_rng,
+        SyntheticRegistrationSample<FloatPrec> &  o_sample)
+{
+    FloatPrec cx = 0.;
+    FloatPrec cy = 0.;
+    for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+        cx += 0.25 * i_annot_pts[2*i_pt + 0];
+        cy += 0.25 * i_annot_pts[2*i_pt + 1];
+    }
+    const Affine2D<FloatPrec> motion = random_affine_motion(i_motion, cx, cy, io_rng);
+    warp_image_affine(i_ref_image, motion, o_sample.m_reg_image);
+    o_sample.m_init_pts = i_annot_pts;
+    o_sample.m_gt_pts.resize(8);
+    for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+        motion.apply(i_annot_pts[2*i_pt + 0], i_annot_pts[2*i_pt + 1],
+                o_sample.m_gt_pts[2*i_pt + 0], o_sample.m_gt_pts[2*i_pt + 1]);
+    }
+}
+
+/*
+* Mean euclidean distance between the vertices of two quads
+*/
+template <typename FloatPrec>
+FloatPrec
+mean_corner_error(
+        const std::vector<FloatPrec> & i_pts,
+        const std::vector<FloatPrec> & i_ref_pts)
+{
+    FloatPrec err = 0.;
+    for (uint32_t i_pt = 0; i_pt<4; ++i_pt) {
+        const FloatPrec dx = i_pts[2*i_pt + 0] - i_ref_pts[2*i_pt + 0];
+        const FloatPrec dy = i_pts[2*i_pt + 1] - i_ref_pts[2*i_pt + 1];
+        err += 0.25 * std::sqrt(dx*dx + dy*dy);
+    }
+    return err;
+}
+
+} // end namespace Common
+
+#endif /* _SYNTHETIC_WORKLOAD_HPP *  * */
@@ -0,0 +1,56 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _THREAD_UTILS_HPP
+#define _THREAD_UTILS_HPP
+
+#include <stdint.h>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Common
+{
+
+/*
+* Number of hardware threads available (at least 1).
+*/
+inline
+uint32_t
+nb_hardware_threads()
+{
+    const uint32_t nb_threads = std::thread::hardware_concurrency();
+    return (nb_threads > 0) ? nb_threads : 1;
+}
+
+/*
+* Pin the calling thread to the given core (modulo the number of cores).
+* Returns false if pinning is not supported on this platform or failed.
+*/
+inline
+bool
+pin_current_thread_to_core(
+        uint32_t i_core_ind)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(i_core_ind % nb_hardware_threads(), &cpu_set);
+    return pthread_setaffinity_np(
+            pthread_self(), sizeof(cpu_set_t), &cpu_set) == 0;
+#else
+    (void)i_core_ind;
+    return false;
+#endif
+}
+
+} // end namespace Common
+
+#endif /* _THREAD_UTILS_HPP *  * */
@@ -0,0 +1,451 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _TILED_PYRAMID_HPP
+#define _TILED_PYRAMID_HPP
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define TILED_PYRAMID_USE_PREAD 1
+#endif
+
+#include <CImg.h>
+
+#include "errCodes.h"
+#include "im_processing_utils.hpp"
+
+namespace Common
+{
+
+/*
+* Tiled pyramid file: out-of-core storage of very large 8-bit grayscale
+* images (e.g. aerial mosaics) for registration.
+* A fixed-size header (level table included), then the tiles of each level,
+* level after level, in row-major tile order. Tiles are m_tile_size x
+* m_tile_size uint8 squares (tiles on the right/bottom borders are padded by
+* replicating the last column/row), so that any tile can be read with a single
+* aligned read.
+* Level 0 is the image, each next level is downsampled from the previous one
+* with Common::BoxDownsampler, i.e. with the same pixel grid mapping as the
+* registration pyramids: pixel x of level l is centered on x / ratio_l in the
+* full resolution image.
+*/
+static const uint32_t TILED_PYRAMID_VERSION = 1;
+static const uint32_t TILED_PYRAMID_MAX_LEVELS = 16;
+static const uint32_t TILED_PYRAMID_MAX_TILE_SIZE = 4096;
+static const uint64_t TILED_PYRAMID_DATA_OFFSET = 4096;
+static const uint64_t TILED_PYRAMID_NO_TILE_KEY = ~(uint64_t)0; // empty cache slot
+
+struct TiledPyramidLevel
+{
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_nb_tiles_x;
+    uint32_t m_nb_tiles_y;
+    uint64_t m_offset;      // offset of the first tile of the level in the file
+};
+
+struct TiledPyramidFileHeader
+{
+    char      m_magic[4];   // "DITP"
+    uint32_t  m_version;
+    uint32_t  m_nb_levels;
+    uint32_t  m_tile_size;  // in pixels, multiple of 64, at most 4096
+    float     m_lvl_resz_ratio;
+    uint32_t  m_reserved;
+    TiledPyramidLevel m_levels[TILED_PYRAMID_MAX_LEVELS];
+};
+
+
+/*
+* Write the tiled pyramid of an 8-bit image.
+* Levels are built band by band (one row of tiles at a time), so that only
+* the previous level has to be resident: i_image itself can be a view on a
+* memory-mapped raw frame file (see raw_frame_container.hpp).
+*/
+inline
+ErrCode
+write_tiled_pyramid(
+        const std::string &     i_filename,
+        const ImView<uint8_t> & i_image,
+        uint32_t                i_nb_levels,
+        float                   i_lvl_resz_ratio,
+        uint32_t                i_tile_size = 256)
+{
+    if ((i_image.width() < 2) || (i_image.height() < 2)
+            || (i_nb_levels == 0) || (i_nb_levels > TILED_PYRAMID_MAX_LEVELS)
+            || (i_tile_size == 0) || ((i_tile_size % 64) != 0)
+            || (i_tile_size > TILED_PYRAMID_MAX_TILE_SIZE)
+            || (i_lvl_resz_ratio <= 0.f) || (i_lvl_resz_ratio > 1.f)) {
+        return UnsupportedImageFormat;
+    }
+
+    // level table (same level dimensions as the registration pyramids)
+    TiledPyramidFileHeader header = TiledPyramidFileHeader();
+    std::memcpy(header.m_magic, "DITP", 4);
+    header.m_version = TILED_PYRAMID_VERSION;
+    header.m_nb_levels = i_nb_levels;
+    header.m_tile_size = i_tile_size;
+    header.m_lvl_resz_ratio = i_lvl_resz_ratio;
+    const uint64_t tile_bytes = (uint64_t)i_tile_size * i_tile_size;
+    uint64_t offset = TILED_PYRAMID_DATA_OFFSET;
+    float this_lvl_ratio = 1.0;
+    for (uint32_t i_lvl = 0; i_lvl<i_nb_levels; ++i_lvl) {
+        TiledPyramidLevel & level = header.m_levels[i_lvl];
+        level.m_width = std::max(2u, (uint32_t)(this_lvl_ratio * i_image.width()));
+        level.m_height = std::max(2u, (uint32_t)(this_lvl_ratio * i_image.height()));
+        level.m_nb_tiles_x = (level.m_width + i_tile_size - 1) / i_tile_size;
+        level.m_nb_tiles_y = (level.m_height + i_tile_size - 1) / i_tile_size;
+        level.m_offset = offset;
+        offset += tile_bytes * level.m_nb_tiles_x * level.m_nb_tiles_y;
+        this_lvl_ratio *= i_lvl_resz_ratio;
+    }
+
+    std::FILE * file = std::fopen(i_filename.c_str(), "wb");
+    if (file == NULL) {
+        return IOCantOpenFile;
+    }
+    std::vector<uint8_t> header_block(TILED_PYRAMID_DATA_OFFSET, 0);
+    std::memcpy(&(header_block[0]), &header, sizeof(header));
+    bool write_ok = (std::fwrite(&(header_block[0]), 1, header_block.size(), file)
+            == header_block.size());
+
+    BoxDownsampler<float> downsampler;
+    cimg_library::CImg<float> band;
+    std::vector<uint8_t> band_pixels;
+    std::vector<uint8_t> prev_lvl_pixels;
+    std::vector<uint8_t> lvl_pixels;
+    std::vector<uint8_t> tile_row(tile_bytes * header.m_levels[0].m_nb_tiles_x);
+    ImView<uint8_t> prev_lvl = i_image; // source of the level being built
+    for (uint32_t i_lvl = 0; (i_lvl<i_nb_levels) && write_ok; ++i_lvl) {
+        const TiledPyramidLevel & level = header.m_levels[i_lvl];
+        // downsampled levels are kept until the next level is built
+        const bool keep_level = (i_lvl > 0) && (i_lvl + 1 < i_nb_levels);
+        if (keep_level) {
+            lvl_pixels.resize((size_t)level.m_width * level.m_height);
+        }
+        for (uint32_t i_ty = 0; (i_ty<level.m_nb_tiles_y) && write_ok; ++i_ty) {
+            const uint32_t y_begin = i_ty * i_tile_size;
+            const uint32_t band_height = std::min(i_tile_size, level.m_height - y_begin);
+
+            // 8-bit rows of the band
+            const uint8_t * band_rows = NULL;
+            size_t band_stride = level.m_width;
+            if (i_lvl == 0) {
+                band_rows = i_image.row(y_begin);
+                band_stride = i_image.stride();
+            } else {
+                downsampler.run_band(prev_lvl, i_lvl_resz_ratio,
+                        level.m_width, level.m_height, y_begin, y_begin + band_height, band);
+                uint8_t * dst = NULL;
+                if (keep_level) {
+                    dst = &(lvl_pixels[(size_t)y_begin * level.m_width]);
+                } else {
+                    band_pixels.resize((size_t)band_height * level.m_width);
+                    dst = &(band_pixels[0]);
+                }
+                for (size_t i_pix = 0; i_pix<(size_t)band_height * level.m_width; ++i_pix) {
+                    dst[i_pix] = (uint8_t)std::min(std::max(
+                            band.data()[i_pix] + 0.5f, 0.f), 255.f);
+                }
+                band_rows = dst;
+            }
+
+            // spread the band over its row of tiles (replicated borders)
+            for (uint32_t i_ly = 0; i_ly<i_tile_size; ++i_ly) {
+                const uint8_t * src_row = band_rows
+                        + std::min(i_ly, band_height - 1) * band_stride;
+                for (uint32_t i_tx = 0; i_tx<level.m_nb_tiles_x; ++i_tx) {
+                    uint8_t * dst = &(tile_row[i_tx * tile_bytes + (size_t)i_ly * i_tile_size]);
+                    const uint32_t x_begin = i_tx * i_tile_size;
+                    const uint32_t nb_cols = std::min(i_tile_size, level.m_width - x_begin);
+                    std::memcpy(dst, src_row + x_begin, nb_cols);
+                    std::fill(dst + nb_cols, dst + i_tile_size, src_row[level.m_width - 1]);
+                }
+            }
+            const size_t row_bytes = tile_bytes * level.m_nb_tiles_x;
+            write_ok = (std::fwrite(&(tile_row[0]), 1, row_bytes, file) == row_bytes);
+        }
+        if (keep_level) {
+            prev_lvl_pixels.swap(lvl_pixels);
+            prev_lvl = ImView<uint8_t>(&(prev_lvl_pixels[0]),
+                    level.m_width, level.m_height, level.m_width);
+        }
+    }
+    if (std::fclose(file) != 0) {
+        write_ok = false;
+    }
+    return write_ok ? NoError : IOCantOpenFile;
+}
+
+
+/*
+* Reader of a tiled pyramid file. Tiles are read lazily, only when a region
+* overlapping them is requested, and kept in a bounded LRU tile cache: the
+* resident memory never exceeds the cache budget, whatever the image size.
+* The cache statistics (hit rate, bytes read from the file) help sizing the
+* budget for a given tracking workload.
+* A reader is not thread safe (its cache is updated by every read): use one
+* reader per registration workspace.
+*/
+struct TiledPyramidReader
+{
+public:
+    TiledPyramidReader() {}
+    ~TiledPyramidReader() { close(); }
+public:
+    /*
+    * open the file, with a tile cache of at most i_cache_bytes (at least one
+    * tile is always cached)
+    */
+    ErrCode
+    open(
+            const std::string & i_filename,
+            uint64_t            i_cache_bytes = 64 << 20)
+    {
+        close();
+        m_file = std::fopen(i_filename.c_str(), "rb");
+        if (m_file == NULL) {
+            return IOCantOpenFile;
+        }
+        const bool size_ok = (std::fseek(m_file, 0, SEEK_END) == 0);
+        const long file_size = size_ok ? std::ftell(m_file) : -1;
+        if ((file_size < 0) || (std::fseek(m_file, 0, SEEK_SET) != 0)
+                || (std::fread(&m_header, sizeof(m_header), 1, m_file) != 1)
+                || !header_is_valid((uint64_t)file_size)) {
+            close();
+            return InvalidTiledPyramidFile;
+        }
+        m_tile_bytes = (size_t)m_header.m_tile_size * m_header.m_tile_size;
+        const uint64_t nb_slots = std::max((uint64_t)1, i_cache_bytes / m_tile_bytes);
+        m_slot_keys.assign(nb_slots, 0);
+        m_cache.clear();
+        m_cache.reserve(nb_slots);
+        m_lru.clear();
+        reset_cache_stats();
+        return NoError;
+    }
+
+    void
+    close()
+    {
+        if (m_file != NULL) {
+            std::fclose(m_file);
+            m_file = NULL;
+        }
+        std::memset(&m_header, 0, sizeof(m_header));
+        m_cache.clear();
+        m_lru.clear();
+        m_slot_keys.clear();
+        m_slots.clear();
+        m_slots.shrink_to_fit();
+    }
+
+    /*
+    * copy the region i_roi of level i_lvl (level pixel coordinates, inside the
+    * level) to a floating point image, scaled by i_normz_factor. Only the
+    * tiles overlapping the region are read. o_image is only reallocated if
+    * its size has to change.
+    */
+    template <typename FloatPrec>
+    ErrCode
+    read_region(
+            uint32_t                        i_lvl,
+            const ImRoi &                   i_roi,
+            FloatPrec                       i_normz_factor,
+            cimg_library::CImg<FloatPrec> & o_image)
+    {
+        if ((m_file == NULL) || (i_lvl >= m_header.m_nb_levels)
+                || (i_roi.x1() > m_header.m_levels[i_lvl].m_width)
+                || (i_roi.y1() > m_header.m_levels[i_lvl].m_height)
+                || (i_roi.width() == 0) || (i_roi.height() == 0)) {
+            return UnsupportedImageFormat;
+        }
+        const uint32_t roi_width = i_roi.width();
+        const uint32_t roi_height = i_roi.height();
+        if ((o_image.width() != (int)roi_width) || (o_image.height() != (int)roi_height)) {
+            o_image.assign(roi_width, roi_height, 1, 1);
+        }
+        const uint32_t tile_size = m_header.m_tile_size;
+        for (uint32_t i_ty = i_roi.y0() / tile_size; i_ty<=(i_roi.y1() - 1) / tile_size; ++i_ty) {
+            for (uint32_t i_tx = i_roi.x0() / tile_size; i_tx<=(i_roi.x1() - 1) / tile_size; ++i_tx) {
+                const uint8_t * tile = get_tile(i_lvl, i_tx, i_ty);
+                if (tile == NULL) {
+                    return IOCantOpenFile;
+                }
+                // intersection of the tile and the region, in level coordinates
+                const uint32_t x_begin = std::max(i_roi.x0(), i_tx * tile_size);
+                const uint32_t x_end = std::min(i_roi.x1(), (i_tx + 1) * tile_size);
+                const uint32_t y_begin = std::max(i_roi.y0(), i_ty * tile_size);
+                const uint32_t y_end = std::min(i_roi.y1(), (i_ty + 1) * tile_size);
+                for (uint32_t i_y = y_begin; i_y<y_end; ++i_y) {
+                    const uint8_t * src = tile + (size_t)(i_y - i_ty * tile_size) * tile_size
+                            + (x_begin - i_tx * tile_size);
+                    FloatPrec * dst = o_image.data() + (size_t)(i_y - i_roi.y0()) * roi_width
+                            + (x_begin - i_roi.x0());
+                    for (uint32_t i_x = 0; i_x<x_end - x_begin; ++i_x) {
+                        dst[i_x] = i_normz_factor * (FloatPrec)src[i_x];
+                    }
+                }
+            }
+        }
+        return NoError;
+    }
+
+    inline void reset_cache_stats() {
+        m_nb_tile_requests = 0;
+        m_nb_tile_hits = 0;
+        m_nb_bytes_read = 0;
+    }
+
+    inline bool is_open() const { return m_file != NULL; }
+    inline uint32_t width() const { return m_header.m_levels[0].m_width; }
+    inline uint32_t height() const { return m_header.m_levels[0].m_height; }
+    inline uint32_t nb_levels() const { return m_header.m_nb_levels; }
+    inline float lvl_resz_ratio() const { return m_header.m_lvl_resz_ratio; }
+    inline uint32_t tile_size() const { return m_header.m_tile_size; }
+    inline uint32_t lvl_width(uint32_t i_lvl) const { return m_header.m_levels[i_lvl].m_width; }
+    inline uint32_t lvl_height(uint32_t i_lvl) const { return m_header.m_levels[i_lvl].m_height; }
+    /*
+    * cache statistics (since 'open' or the last 'reset_cache_stats')
+    */
+    inline uint64_t nb_tile_requests() const { return m_nb_tile_requests; }
+    inline uint64_t nb_tile_hits() const { return m_nb_tile_hits; }
+    inline double cache_hit_rate() const {
+        return (m_nb_tile_requests > 0) ? (double)m_nb_tile_hits / m_nb_tile_requests : 0.;
+    }
+    inline uint64_t nb_bytes_read() const { return m_nb_bytes_read; }
+    inline uint64_t cache_capacity_bytes() const { return m_slot_keys.size() * m_tile_bytes; }
+    inline uint64_t cache_resident_bytes() const { return m_slots.size(); }
+private:
+    bool
+    header_is_valid(
+            uint64_t i_file_size) const
+    {
+        if ((std::memcmp(m_header.m_magic, "DITP", 4) != 0)
+                || (m_header.m_version != TILED_PYRAMID_VERSION)
+                || (m_header.m_nb_levels == 0)
+                || (m_header.m_nb_levels > TILED_PYRAMID_MAX_LEVELS)
+                || (m_header.m_tile_size == 0)
+                || ((m_header.m_tile_size % 64) != 0)
+                || (m_header.m_tile_size > TILED_PYRAMID_MAX_TILE_SIZE)) {
+            return false;
+        }
+        // the level tiles must be in the file (64 bit tile counts can't
+        // overflow, the size check is written as a division so that it can't
+        // either)
+        const uint64_t tile_bytes = (uint64_t)m_header.m_tile_size * m_header.m_tile_size;
+        for (uint32_t i_lvl = 0; i_lvl<m_header.m_nb_levels; ++i_lvl) {
+            const TiledPyramidLevel & level = m_header.m_levels[i_lvl];
+            const uint64_t nb_tiles = (uint64_t)level.m_nb_tiles_x * level.m_nb_tiles_y;
+            if ((level.m_width < 2) || (level.m_height < 2)
+                    || ((uint64_t)level.m_nb_tiles_x * m_header.m_tile_size < level.m_width)
+                    || ((uint64_t)level.m_nb_tiles_y * m_header.m_tile_size < level.m_height)
+                    || (level.m_offset < sizeof(TiledPyramidFileHeader))
+                    || (level.m_offset > i_file_size)
+                    || (nb_tiles > (i_file_size - level.m_offset) / tile_bytes)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /*
+    * cached tile (i_tx, i_ty) of level i_lvl, read from the file on a miss
+    * (the least recently used tile is evicted when the cache is full)
+    */
+    const uint8_t *
+    get_tile(
+            uint32_t i_lvl,
+            uint32_t i_tx,
+            uint32_t i_ty)
+    {
+        const TiledPyramidLevel & level = m_header.m_levels[i_lvl];
+        const uint64_t tile_ind = (uint64_t)i_ty * level.m_nb_tiles_x + i_tx;
+        const uint64_t key = ((uint64_t)i_lvl << 56) | tile_ind;
+        m_nb_tile_requests++;
+
+        CacheMap::iterator it = m_cache.find(key);
+        if (it != m_cache.end()) {
+            m_nb_tile_hits++;
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return &(m_slots[*(it->second) * m_tile_bytes]);
+        }
+
+        // miss: take a free slot, or evict the least recently used tile
+        uint32_t slot = 0;
+        const bool fresh_slot = (m_lru.size() < m_slot_keys.size());
+        if (fresh_slot) {
+            slot = m_lru.size();
+            m_slots.resize((slot + 1) * m_tile_bytes);
+            m_lru.push_front(slot);
+        } else {
+            slot = m_lru.back();
+            m_cache.erase(m_slot_keys[slot]);
+            m_lru.splice(m_lru.begin(), m_lru, --m_lru.end());
+        }
+        m_slot_keys[slot] = key;
+        m_cache[key] = m_lru.begin();
+
+        uint8_t * tile = &(m_slots[slot * m_tile_bytes]);
+        const uint64_t offset = level.m_offset + tile_ind * m_tile_bytes;
+#ifdef TILED_PYRAMID_USE_PREAD
+        const bool read_ok = (pread(fileno(m_file), tile, m_tile_bytes, offset)
+                == (ssize_t)m_tile_bytes);
+#else
+        const bool read_ok = (std::fseek(m_file, (long)offset, SEEK_SET) == 0)
+                && (std::fread(tile, 1, m_tile_bytes, m_file) == m_tile_bytes);
+#endif
+        if (!read_ok) {
+            // give the slot back: a fresh one is released, an evicted one
+            // holds no tile and is the next to be reused
+            m_cache.erase(key);
+            m_slot_keys[slot] = TILED_PYRAMID_NO_TILE_KEY;
+            if (fresh_slot) {
+                m_lru.pop_front();
+            } else {
+                m_lru.splice(m_lru.end(), m_lru, m_lru.begin());
+            }
+            return NULL;
+        }
+        m_nb_bytes_read += m_tile_bytes;
+        return tile;
+    }
+private:
+    typedef std::list<uint32_t> LruList; // slot indices, most recent first
+    typedef std::unordered_map<uint64_t, LruList::iterator> CacheMap;
+private:
+    std::FILE *            m_file = NULL;
+    TiledPyramidFileHeader m_header = TiledPyramidFileHeader();
+    size_t                 m_tile_bytes = 0;
+    std::vector<uint8_t>   m_slots;     // tile pixels, grown up to the budget
+    std::vector<uint64_t>  m_slot_keys; // (level, tile index) held by each slot
+    CacheMap               m_cache;
+    LruList                m_lru;
+    uint64_t               m_nb_tile_requests = 0;
+    uint64_t               m_nb_tile_hits = 0;
+    uint64_t               m_nb_bytes_read = 0;
+private:
+    // non-copyable
+    TiledPyramidReader(TiledPyramidReader const &);
+    TiledPyramidReader & operator = (TiledPyramidReader const &);
+};
+
+} // end namespace Common
+
+#endif /* _TILED_PYRAMID_HPP *  * */
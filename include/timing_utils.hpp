@@ -0,0 +1,41 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _TIMING_UTILS_HPP
+#define _TIMING_UTILS_HPP
+
+#include <chrono>
+
+namespace Common
+{
+
+/*
+* Simple wall-clock timer based on the monotonic std::chrono::steady_clock.
+* The timer starts on construction and can be restarted with 'reset'.
+*/
+struct Timer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+public:
+    Timer() : m_start(Clock::now()) {}
+public:
+    inline void reset() { m_start = Clock::now(); }
+    inline double elapsed_s() const {
+        return std::chrono::duration<double>(Clock::now() - m_start).count();
+    }
+    inline double elapsed_us() const {
+        return std::chrono::duration<double, std::micro>(
+                Clock::now() - m_start).count();
+    }
+private:
+    Clock::time_point m_start;
+};
+
+} // end namespace Common
+
+#endif /* _TIMING_UTILS_HPP *  * */
@@ -0,0 +1,117 @@
+/*
+* Authors:
+* Nicolas Stoiber (nicolas.stoi@gmail.com)
+*
+* 2016
+*/
+
+#ifndef _WORK_STEALING_SCHEDULER_HPP
+#define _WORK_STEALING_SCHEDULER_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace Common
+{
+
+/*
+* Work-stealing job scheduler for independent jobs.
+* Each worker owns a job deque: it pops its own jobs from the back, and when
+* its deque runs dry it steals jobs from the front of the other workers'
+* deques. Jobs are expected to be coarse-grained (e.g. a full image
+* registration), so each deque is simply protected by its own mutex: contention
+* only happens on steals.
+*/
+template <typename Job>
+struct WorkStealingScheduler
+{
+public:
+    explicit WorkStealingScheduler(uint32_t i_nb_workers) :
+        m_queues(i_nb_workers > 0 ? i_nb_workers : 1),
+        m_nb_steals(0)
+    {}
+public:
+    inline uint32_t nb_workers() const { return m_queues.size(); }
+    inline uint64_t nb_steals() const { return m_nb_steals.load(); }
+
+    /*
+    * add a job to the deque of a given worker
+    */
+    void
+    push(
+            uint32_t    i_worker_ind,
+            const Job & i_job)
+    {
+        WorkerQueue & queue = m_queues[i_worker_ind % m_queues.size()];
+        std::lock_guard<std::mutex> lock(queue.m_mutex);
+        queue.m_jobs.push_back(i_job);
+    }
+
+    /*
+    * distribute a list of jobs over the workers' deques in contiguous chunks
+    * (neighbouring jobs tend to share data, so keep them on the same worker).
+    */
+    void
+    push_all(
+            const std::vector<Job> & i_jobs)
+    {
+        const uint32_t nb_jobs = i_jobs.size();
+        const uint32_t nb_w = m_queues.size();
+        for (uint32_t i_job = 0; i_job<nb_jobs; ++i_job) {
+            push((uint64_t)i_job * nb_w / nb_jobs, i_jobs[i_job]);
+        }
+    }
+
+    /*
+    * get the next job for a given worker: own jobs first (LIFO), then steal
+    * from the other workers (FIFO). Returns false when no job is left.
+    */
+    bool
+    pop(
+            uint32_t i_worker_ind,
+            Job &    o_job)
+    {
+        const uint32_t nb_w = m_queues.size();
+        i_worker_ind = i_worker_ind % nb_w;
+        {
+            WorkerQueue & queue = m_queues[i_worker_ind];
+            std::lock_guard<std::mutex> lock(queue.m_mutex);
+            if (!queue.m_jobs.empty()) {
+                o_job = queue.m_jobs.back();
+                queue.m_jobs.pop_back();
+                return true;
+            }
+        }
+        for (uint32_t i_off = 1; i_off<nb_w; ++i_off) {
+            WorkerQueue & victim = m_queues[(i_worker_ind + i_off) % nb_w];
+            std::lock_guard<std::mutex> lock(victim.m_mutex);
+            if (!victim.m_jobs.empty()) {
+                o_job = victim.m_jobs.front();
+                victim.m_jobs.pop_front();
+                m_nb_steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+private:
+    struct WorkerQueue
+    {
+        std::mutex      m_mutex;
+        std::deque<Job> m_jobs;
+    };
+private:
+    std::vector<WorkerQueue> m_queues;
+    std::atomic<uint64_t>    m_nb_steals;
+private:
+    // non-copyable
+    WorkStealingScheduler(WorkStealingScheduler const &);
+    WorkStealingScheduler & operator = (WorkStealingScheduler const &);
+};
+
+} // end namespace Common
+
+#endif /* _WORK_STEALING_SCHEDULER_HPP *  * */